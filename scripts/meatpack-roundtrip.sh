@@ -0,0 +1,29 @@
+#!/bin/sh
+# Checks that MeatPack output unpacks to the same GCODE as plain output.
+# Usage: meatpack-roundtrip.sh PROGRAM [CONFIG] INPUT.svg...
+set -e
+program=$1
+shift
+config=config.lwc
+case "$1" in
+    *.lwc) config=$1; shift ;;
+esac
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+status=0
+for input in "$@"; do
+    "$program" -c "$config" -o "$work/plain.gcode" "$input" > /dev/null
+    "$program" -c "$config" --meatpack -o "$work/packed.gcode" "$input" > /dev/null
+    "$program" --unpack -o "$work/unpacked.gcode" "$work/packed.gcode"
+    # Packed output has no estimate comment and its last line always ends
+    sed '1{/^;/d}' "$work/plain.gcode" | awk 1 > "$work/expected.gcode"
+    plain=$(wc -c < "$work/expected.gcode")
+    packed=$(wc -c < "$work/packed.gcode")
+    if cmp -s "$work/expected.gcode" "$work/unpacked.gcode"; then
+        echo "$input: $plain bytes packed to $packed"
+    else
+        echo "$input: unpacked output differs"
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,90 @@
+#!/bin/sh
+# Converts synthetic drawings of growing size and reports time and peak memory of loading and export.
+# Fails if time per segment of loading, export or the whole run grows too much with size, which shows work growing
+# faster than the drawing, or if one of them got slower for a size than in a baseline file written by an earlier run.
+# Usage: scaling-benchmark.sh PROGRAM GENERATOR [BASELINE.tsv]
+# PROGRAM has to be built with LASERWORKS_STATS. Environment:
+#   SIZES      Segments of the drawings, defaults to "1000 10000 100000 1000000"
+#   GENERATE   More options of the generator, like "--mix L=1 --depth 8"
+#   CONFIG     Machine profile, defaults to the one the program finds
+#   SCALING    Largest growth of time per segment over the smallest drawing of 10000 segments or more taking at
+#              least 20 ms, defaults to 4
+#   THRESHOLD  Largest ratio of time to the baseline, defaults to 1.5
+#   RESULTS    File to write results to, to be used as a baseline later
+set -e
+program=$1
+generator=$2
+baseline=$3
+if [ -z "$program" ] || [ -z "$generator" ]; then
+    echo "Usage: $0 PROGRAM GENERATOR [BASELINE.tsv]" >&2
+    exit 1
+fi
+sizes=${SIZES:-1000 10000 100000 1000000}
+scaling=${SCALING:-4}
+threshold=${THRESHOLD:-1.5}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+printf "segments\tload_ms\toptimize_ms\texport_ms\twall_ms\tload_mb\tpeak_mb\n" > "$work/results.tsv"
+for segments in $sizes; do
+    # shellcheck disable=SC2086
+    "$generator" --segments "$segments" $GENERATE -o "$work/drawing.svg"
+    start=$(date +%s%N)
+    # shellcheck disable=SC2086
+    "$program" --no-cache --stats ${CONFIG:+-c "$CONFIG"} -o /dev/null "$work/drawing.svg" > "$work/stats.txt"
+    end=$(date +%s%N)
+    # Stage names have spaces, the last four columns are time, calls, allocations and peak memory so far
+    awk -v segments="$segments" -v wall=$(((end - start) / 1000000)) '
+        $NF ~ /^[0-9.]+$/ && NF >= 5 {
+            stage = $1; for(i = 2 ; i <= NF - 4 ; i++) stage = stage " " $i
+            time = $(NF - 3); peak = $NF
+            if(stage ~ /^(read file|parse XML|parse tree|parse geometry)$/) {load += time; if(peak > loadPeak) loadPeak = peak}
+            else if(stage ~ /^(remove duplicates|join paths)$/) optimize += time
+            else if(stage == "export GCODE") export = time
+            if(peak > maxPeak) maxPeak = peak
+            found = 1
+        }
+        END {
+            if(!found) exit 1
+            printf "%d\t%.1f\t%.1f\t%.1f\t%d\t%.1f\t%.1f\n", segments, load, optimize, export, wall, loadPeak, maxPeak
+        }' "$work/stats.txt" >> "$work/results.tsv" || {
+        echo "No statistics in the output of $program, it has to be built with LASERWORKS_STATS." >&2
+        exit 1
+    }
+    tail -n 1 "$work/results.tsv"
+done
+[ -n "$RESULTS" ] && cp "$work/results.tsv" "$RESULTS"
+
+# Time per segment of loading, export and the whole run against the smallest drawing of each that isn't dominated
+# by startup, and against the baseline
+awk -v scaling="$scaling" -v threshold="$threshold" -v baseline="$baseline" '
+    BEGIN {
+        FS = "\t"
+        split("2 4 5", columns, " ")
+        names[2] = "loading"; names[4] = "export"; names[5] = "the run"
+        if(baseline != "") {
+            while((getline line < baseline) > 0) {
+                split(line, fields, "\t")
+                if(fields[1] ~ /^[0-9]+$/) for(c in columns) previous[fields[1], columns[c]] = fields[columns[c]]
+            }
+        }
+    }
+    NR == 1 {next}
+    {
+        for(c = 1 ; c <= 3 ; c++) {
+            column = columns[c]
+            perSegment = $column / $1
+            if($1 >= 10000 && $column >= 20 && !(column in reference)) {reference[column] = perSegment; referenceSize[column] = $1}
+            if((column in reference) && perSegment > scaling * reference[column]) {
+                printf "%s of %d segments takes %.1f times as long per segment as of %d segments\n", names[column], $1,
+                    perSegment / reference[column], referenceSize[column]
+                failed = 1
+            }
+            if((($1, column) in previous) && previous[$1, column] >= 100 && $column > threshold * previous[$1, column]) {
+                printf "%s of %d segments takes %d ms, %.2f times as long as the baseline\n", names[column], $1, $column,
+                    $column / previous[$1, column]
+                failed = 1
+            }
+        }
+    }
+    END {exit failed}' "$work/results.tsv"
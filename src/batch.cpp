@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "cache.h"
+#include "optimize.h"
+#include "trace.h"
+#include "utils.h"
+
+namespace batch {
+
+    using namespace std;
+
+    vector<string> collectInputs(const vector<string> &paths) {
+        vector<string> inputs;
+        for(const string &path : paths) {
+            struct stat status;
+            if(stat(path.c_str(), &status) != 0) throw runtime_error("Unable to open " + path);
+            if(!S_ISDIR(status.st_mode)) {
+                inputs.push_back(path);
+                continue;
+            }
+            DIR *dir = opendir(path.c_str());
+            if(!dir) throw runtime_error("Unable to open " + path);
+            vector<string> files;
+            string prefix = path.back() == '/' ? path : path + "/";
+            while(struct dirent *entry = readdir(dir)) {
+                string file = prefix + entry->d_name;
+                if(entry->d_name[0] == '.' || !has_suffix(file, ".svg")) continue;
+                if(stat(file.c_str(), &status) == 0 && S_ISREG(status.st_mode)) files.push_back(file);
+            }
+            closedir(dir);
+            sort(files.begin(), files.end());
+            inputs.insert(inputs.end(), files.begin(), files.end());
+        }
+        return inputs;
+    }
+
+    string outputPath(const string &input, const string &directory) {
+        string output = has_suffix(input, ".svg") ? input.substr(0, input.length() - 4) : input;
+        output += ".gcode";
+        if(directory.empty()) return output;
+        size_t slash = output.rfind('/');
+        string name = slash == string::npos ? output : output.substr(slash + 1);
+        return directory.back() == '/' ? directory + name : directory + "/" + name;
+    }
+
+    vector<Job> createJobs(const vector<string> &inputs, const string &directory) {
+        vector<Job> jobs;
+        set<string> outputs;
+        for(const string &input : inputs) {
+            jobs.push_back({input, outputPath(input, directory)});
+            if(!outputs.insert(jobs.back().output).second) {
+                throw invalid_argument(jobs.back().output + " would be written by two files");
+            }
+        }
+        return jobs;
+    }
+
+    //Writes the output next to its final path and renames it into place, so other programs never see a
+    //partial file and a failed conversion keeps the previous one
+    static void writeOutput(const Job &job, const gcode::Settings &settings, svg::Document &document, Result &result) {
+        static atomic<unsigned int> outputs {0};
+        string temporary = job.output + ".tmp" + to_string(getpid()) + "-" + to_string(outputs++);
+        fstream file;
+        file.open(temporary, ios::out);
+        if(!file.good()) throw runtime_error("Unable to open " + temporary);
+        try {
+            result.estimate = gcode::exportPaths(document, settings, file);
+            file.close();
+            if(!file) throw runtime_error("Output error");
+            if(rename(temporary.c_str(), job.output.c_str()) != 0) throw runtime_error("Unable to write " + job.output + ": " + strerror(errno));
+        } catch(...) {
+            unlink(temporary.c_str());
+            throw;
+        }
+    }
+
+    Result convert(const Job &job, const gcode::Settings &settings, bool useCache) {
+        TRACE_SPAN("convert file");
+        Result result;
+        result.input = job.input;
+        result.output = job.output;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        svg::Document *document = nullptr;
+        try {
+            document = useCache ? cache::loadDocument(job.input, nullptr, &result.cached) : svg::loadDocument(job.input);
+            optimize::Report report = optimize::removeDuplicates(document->paths, settings.duplicateTolerance, settings.hatchSpacing > 0);
+            result.removed = report.removed;
+            result.joins = optimize::joinPaths(document->paths, settings.joinTolerance, settings.hatchSpacing > 0);
+            writeOutput(job, settings, *document, result);
+            result.converted = true;
+        } catch(exception const &e) {
+            result.error = e.what();
+        }
+        delete document;
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    vector<Result> run(const vector<Job> &jobs, const gcode::Settings &settings, size_t concurrency, bool useCache,
+                       const function<void(const Result&)> &finished, scheduler::CancellationToken token) {
+        vector<Result> results(jobs.size());
+        if(concurrency == 0) concurrency = max(1u, thread::hardware_concurrency());
+        concurrency = min(concurrency, jobs.size());
+
+        //Files are taken by dedicated threads rather than pool tasks: a file converted inside a pool task could be
+        //left waiting while its thread helps with another file. Conversions still split their work over the pool.
+        atomic<size_t> next {0};
+        mutex reportLock;
+        auto worker = [&]() {
+            TRACE_THREAD("batch");
+            for(size_t i = next++ ; i < jobs.size() ; i = next++) {
+                if(token.isCancelled()) {
+                    results[i].input = jobs[i].input;
+                    results[i].output = jobs[i].output;
+                    results[i].error = "Cancelled";
+                } else {
+                    results[i] = convert(jobs[i], settings, useCache);
+                }
+                if(finished) {
+                    lock_guard<mutex> guard(reportLock);
+                    finished(results[i]);
+                }
+            }
+        };
+        vector<thread> threads;
+        for(size_t i = 1 ; i < concurrency ; i++) threads.emplace_back(worker);
+        worker(); //Calling thread takes files as well
+        for(thread &t : threads) t.join();
+        return results;
+    }
+
+    string describe(const Result &result) {
+        char text[512];
+        if(!result.converted) {
+            snprintf(text, sizeof(text), "%s: failed after %.0f ms: %s", result.input.c_str(), result.seconds * 1000, result.error.c_str());
+        } else {
+            snprintf(text, sizeof(text), "%s: %s, cut %.0f mm, travel %.0f mm, converted in %.0f ms%s", result.input.c_str(),
+                estimate::formatTime(result.estimate.totalTime()).c_str(), result.estimate.cutDistance, result.estimate.travelDistance,
+                result.seconds * 1000, result.cached ? " from cache" : "");
+        }
+        return text;
+    }
+
+    string summary(const vector<Result> &results, double seconds) {
+        size_t converted = 0;
+        double total = 0, jobTime = 0;
+        for(const Result &result : results) {
+            if(result.converted) {
+                converted++;
+                jobTime += result.estimate.totalTime();
+            }
+            total += result.seconds;
+        }
+        char text[256];
+        snprintf(text, sizeof(text), "Converted %zu of %zu files in %.2f s (%.2f s of conversion), estimated time of all jobs %s",
+            converted, results.size(), seconds, total, estimate::formatTime(jobTime).c_str());
+        string line = text;
+        if(converted < results.size()) line += ", " + to_string(results.size() - converted) + " failed";
+        return line;
+    }
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "estimate.h"
+#include "gcode.h"
+#include "scheduler.h"
+
+//Conversion of many SVG files with one machine profile. Several files are converted at once, each through the
+//cached load and parallel export of single files, and written through temporary files renamed into place.
+namespace batch {
+
+    using namespace std;
+
+    struct Job {
+        string input;
+        string output;
+    };
+
+    struct Result {
+        string input;
+        string output;
+        bool converted = false;
+        string error; //Set if the file wasn't converted
+        double seconds = 0;
+        estimate::Result estimate;
+        size_t removed = 0; //Duplicate segments
+        size_t joins = 0;
+        bool cached = false; //Geometry was read from the cache
+    };
+
+    //SVG files of the paths. Directories add the .svg files they contain, sorted by name, without going into
+    //subdirectories. Throws if a path doesn't exist.
+    vector<string> collectInputs(const vector<string> &paths);
+
+    //Input with .gcode suffix, in directory if it isn't empty
+    string outputPath(const string &input, const string &directory);
+
+    //Throws if two inputs would be written to the same file
+    vector<Job> createJobs(const vector<string> &inputs, const string &directory);
+
+    //Converts one file. Errors are returned in the result, and the output is left untouched if there is one.
+    Result convert(const Job &job, const gcode::Settings &settings, bool useCache);
+
+    //Converts files with at most concurrency of them at once, 0 for one per hardware thread. Finished is called
+    //for every file as it is done, one call at a time, from the threads converting. Jobs not started when the
+    //token is cancelled are returned with an error. Results are in order of the jobs.
+    vector<Result> run(const vector<Job> &jobs, const gcode::Settings &settings, size_t concurrency, bool useCache,
+                       const function<void(const Result&)> &finished = nullptr,
+                       scheduler::CancellationToken token = scheduler::CancellationToken());
+
+    //One line of a file: estimate and time, or the error
+    string describe(const Result &result);
+
+    //Converted and failed files, and time of the batch
+    string summary(const vector<Result> &results, double seconds);
+
+}
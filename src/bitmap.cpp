@@ -0,0 +1,67 @@
+#include <stdexcept>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "raster.h"
+
+namespace raster {
+
+    using namespace std;
+
+    //C interface of GdkPixbuf is used, because gtkmm wrappers aren't initialized when converting from the command line
+    Bitmap loadBitmap(const string &href) {
+        GError *error = nullptr;
+        GdkPixbuf *pixbuf = nullptr;
+        if(href.compare(0, 5, "data:") == 0) {
+            size_t comma = href.find(',');
+            if(comma == string::npos || href.rfind(";base64", comma) == string::npos) {
+                throw invalid_argument("Unsupported image data.");
+            }
+            gsize length = 0;
+            guchar *data = g_base64_decode(href.c_str() + comma + 1, &length);
+            GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
+            if(gdk_pixbuf_loader_write(loader, data, length, &error) && gdk_pixbuf_loader_close(loader, &error)) {
+                pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+                if(pixbuf) g_object_ref(pixbuf);
+            } else {
+                gdk_pixbuf_loader_close(loader, nullptr);
+            }
+            g_object_unref(loader);
+            g_free(data);
+        } else {
+            pixbuf = gdk_pixbuf_new_from_file(href.c_str(), &error);
+        }
+        if(!pixbuf) {
+            string message = "Unable to load image " + (href.length() > 64 ? href.substr(0, 64) + "..." : href);
+            if(error) {
+                message += ": ";
+                message += error->message;
+                g_error_free(error);
+            }
+            throw invalid_argument(message);
+        }
+
+        Bitmap bitmap;
+        bitmap.width = gdk_pixbuf_get_width(pixbuf);
+        bitmap.height = gdk_pixbuf_get_height(pixbuf);
+        bitmap.pixels.resize(static_cast<size_t>(bitmap.width) * bitmap.height);
+        int channels = gdk_pixbuf_get_n_channels(pixbuf);
+        int stride = gdk_pixbuf_get_rowstride(pixbuf);
+        bool alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+        const guchar *pixels = gdk_pixbuf_read_pixels(pixbuf);
+        for(int y = 0 ; y < bitmap.height ; y++) {
+            const guchar *row = pixels + static_cast<size_t>(y) * stride;
+            for(int x = 0 ; x < bitmap.width ; x++) {
+                const guchar *p = row + x * channels;
+                float luminance = (0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]) / 255.0f;
+                if(alpha) { //Transparent pixels are composed over white
+                    float a = p[3] / 255.0f;
+                    luminance = luminance * a + (1 - a);
+                }
+                bitmap.at(x, y) = luminance;
+            }
+        }
+        g_object_unref(pixbuf);
+        return bitmap;
+    }
+
+}
@@ -0,0 +1,486 @@
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace cache {
+
+    using namespace std;
+
+    //All records are multiples of 8 bytes, so every array of the file is aligned for reading in place
+    struct Header {
+        char magic[8];
+        uint32_t formatVersion;
+        uint32_t parserVersion;
+        uint64_t sourceHash;
+        uint64_t sourceSize;
+        uint64_t geometries;
+        uint64_t elements;
+        uint64_t values;
+        uint64_t instances;
+        uint64_t images;
+        uint64_t textSize;
+        uint64_t directoryLength; //Directory is the start of the text, followed by image references
+        uint64_t fileSize; //Catches truncated files
+        uint64_t contentHash; //Of everything after the header, catches damaged files
+    };
+
+    //First element and value of a geometry. There is one more, ending the last geometry.
+    struct GeometryRecord {
+        uint64_t element;
+        uint64_t value;
+        uint64_t source; //Hash of the element it was built from, 0 if unknown
+    };
+
+    struct InstanceRecord {
+        uint64_t geometry;
+        double matrix[6];
+        int32_t paint;
+        int32_t evenOdd;
+    };
+
+    struct ImageRecord {
+        double x, y, width, height;
+        double matrix[6];
+        uint64_t href; //Offset in the text
+        uint64_t hrefLength;
+        uint64_t preserveAspectRatio;
+    };
+
+    //Elements are stored as a kind and a fixed number of values
+    enum Kind : uint8_t {line = 0, cubicBezier = 1, quadraticBezier = 2, arc = 3};
+    static const size_t kind_values[] = {4, 8, 6, 8};
+
+    static const char magic[8] = {'L', 'W', 'C', 'A', 'C', 'H', 'E', '\0'};
+    const size_t hash_block = 1 << 22;
+
+    static size_t align(size_t size) {
+        return (size + 7) & ~static_cast<size_t>(7);
+    }
+
+    string directory() {
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        if(xdg && xdg[0] == '/') return string(xdg) + "/laserworks";
+        const char *home = getenv("HOME");
+        if(home && home[0]) return string(home) + "/.cache/laserworks";
+        return string();
+    }
+
+    //Creates the directory and its missing parents
+    static bool createDirectory(const string &path) {
+        for(size_t slash = path.find('/', 1) ; ; slash = path.find('/', slash + 1)) {
+            string part = path.substr(0, slash);
+            if(mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) return false;
+            if(slash == string::npos) return true;
+        }
+    }
+
+    //Mixes 8 bytes at a time, finished like splitmix64
+    static uint64_t hashBlock(const unsigned char *data, size_t length, uint64_t seed) {
+        uint64_t h = seed ^ (length * 0x9E3779B97F4A7C15ULL);
+        size_t i = 0;
+        for( ; i + 8 <= length ; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            h = (h ^ word) * 0xBF58476D1CE4E5B9ULL;
+            h ^= h >> 31;
+        }
+        uint64_t tail = 0;
+        if(length > i) memcpy(&tail, data + i, length - i);
+        h = (h ^ tail) * 0x94D049BB133111EBULL;
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        return h ^ (h >> 32);
+    }
+
+    //Read only mapping of a whole file, unmapped when destroyed
+    class Mapping {
+    public:
+        const unsigned char *data = nullptr;
+        size_t length = 0;
+
+        Mapping(const string &path) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if(fd < 0) return;
+            struct stat status;
+            if(fstat(fd, &status) == 0 && status.st_size > 0) {
+                void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapping != MAP_FAILED) {
+                    data = static_cast<const unsigned char*>(mapping);
+                    length = static_cast<size_t>(status.st_size);
+                }
+            }
+            close(fd);
+        }
+        ~Mapping() {
+            if(data) munmap(const_cast<unsigned char*>(data), length);
+        }
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+    };
+
+    //Blocks are hashed in parallel and their hashes are combined in order
+    static uint64_t hashData(const unsigned char *data, size_t length) {
+        size_t blocks = (length + hash_block - 1) / hash_block;
+        vector<uint64_t> hashes(blocks);
+        scheduler::parallelFor(0, blocks, [&](size_t begin, size_t end) {
+            for(size_t i = begin ; i < end ; i++) {
+                size_t offset = i * hash_block;
+                hashes[i] = hashBlock(data + offset, min(hash_block, length - offset), i);
+            }
+        }, 1);
+        return hashBlock(reinterpret_cast<const unsigned char*>(hashes.data()), hashes.size() * sizeof(uint64_t), length);
+    }
+
+    uint64_t hashFile(const string &path, uint64_t &size) {
+        TRACE_SPAN("hash file");
+        struct stat status;
+        if(stat(path.c_str(), &status) != 0) throw invalid_argument("Unable to open " + path);
+        size = static_cast<uint64_t>(status.st_size);
+        if(size == 0) return hashData(nullptr, 0);
+        Mapping file(path);
+        if(!file.data) throw invalid_argument("Unable to read " + path);
+        size = file.length;
+        madvise(const_cast<unsigned char*>(file.data), file.length, MADV_SEQUENTIAL);
+        return hashData(file.data, file.length);
+    }
+
+    static svg::Transformation transformation(const double matrix[6]) {
+        return svg::Transformation(matrix[0], matrix[1], matrix[2], matrix[3], matrix[4], matrix[5]);
+    }
+
+    //Builds element of a kind from its values. Returns nullptr for unknown kinds.
+    static svg::PathElement* createElement(uint8_t kind, const double *v) {
+        switch(kind) {
+            case line: return new svg::Line({v[0], v[1]}, {v[2], v[3]});
+            case cubicBezier: return new svg::CubicBezier({v[0], v[1]}, {v[2], v[3]}, {v[4], v[5]}, {v[6], v[7]});
+            case quadraticBezier: return new svg::QuadraticBezier({v[0], v[1]}, {v[2], v[3]}, {v[4], v[5]});
+            case arc: return new svg::Arc({v[0], v[1]}, {v[2], v[3]}, {v[4], v[5]}, v[6], v[7]);
+        }
+        return nullptr;
+    }
+
+    svg::Document* read(const string &cachePath, uint64_t hash, uint64_t size, const string &directory) {
+        Mapping file(cachePath);
+        if(!file.data || file.length < sizeof(Header)) return nullptr;
+        const Header &header = *reinterpret_cast<const Header*>(file.data);
+        if(memcmp(header.magic, magic, sizeof(magic)) != 0 || header.formatVersion != format_version ||
+           header.parserVersion != svg::parser_version || header.sourceHash != hash || header.sourceSize != size ||
+           header.fileSize != file.length) return nullptr;
+        if(hashData(file.data + sizeof(Header), file.length - sizeof(Header)) != header.contentHash) return nullptr;
+
+        //Every array has to fit in the file before anything is read from it
+        uint64_t limit = file.length;
+        if(header.geometries >= limit || header.elements > limit || header.values > limit / 8 ||
+           header.instances > limit || header.images > limit || header.textSize > limit) return nullptr;
+        size_t offset = sizeof(Header);
+        const GeometryRecord *geometries = reinterpret_cast<const GeometryRecord*>(file.data + offset);
+        offset += (header.geometries + 1) * sizeof(GeometryRecord);
+        const uint8_t *kinds = file.data + offset;
+        offset += align(header.elements);
+        const double *values = reinterpret_cast<const double*>(file.data + offset);
+        offset += header.values * sizeof(double);
+        const InstanceRecord *instances = reinterpret_cast<const InstanceRecord*>(file.data + offset);
+        offset += header.instances * sizeof(InstanceRecord);
+        const ImageRecord *images = reinterpret_cast<const ImageRecord*>(file.data + offset);
+        offset += header.images * sizeof(ImageRecord);
+        const char *text = reinterpret_cast<const char*>(file.data + offset);
+        offset += align(header.textSize);
+        if(offset != file.length || header.directoryLength > header.textSize) return nullptr;
+        if(geometries[0].element != 0 || geometries[0].value != 0 || geometries[header.geometries].element != header.elements ||
+           geometries[header.geometries].value != header.values) return nullptr;
+        for(size_t i = 0 ; i < header.geometries ; i++) {
+            if(geometries[i].element > geometries[i + 1].element || geometries[i].value > geometries[i + 1].value) return nullptr;
+        }
+        for(size_t i = 0 ; i < header.instances ; i++) {
+            if(instances[i].geometry >= header.geometries) return nullptr;
+        }
+        bool linked = false;
+        for(size_t i = 0 ; i < header.images ; i++) {
+            if(images[i].href > header.textSize || images[i].hrefLength > header.textSize - images[i].href) return nullptr;
+            linked |= images[i].hrefLength < 5 || memcmp(text + images[i].href, "data:", 5) != 0;
+        }
+        //Relative links were resolved against the directory of the file that was parsed
+        if(linked && string(text, header.directoryLength) != directory) return nullptr;
+
+        //Geometries are built in parallel, like they are parsed
+        vector<shared_ptr<svg::Geometry>> built(header.geometries);
+        atomic<bool> damaged {false};
+        uint64_t counts[4] = {0, 0, 0, 0};
+        mutex countLock;
+        scheduler::parallelFor(0, built.size(), [&](size_t begin, size_t end) {
+            TRACE_SPAN("cached geometry batch", end - begin);
+            uint64_t localCounts[4] = {0, 0, 0, 0};
+            for(size_t i = begin ; i < end ; i++) {
+                shared_ptr<svg::Geometry> geometry = make_shared<svg::Geometry>();
+                const double *v = values + geometries[i].value;
+                const double *valuesEnd = values + geometries[i + 1].value;
+                geometry->reserve(geometries[i + 1].element - geometries[i].element);
+                for(uint64_t e = geometries[i].element ; e < geometries[i + 1].element ; e++) {
+                    uint8_t kind = kinds[e];
+                    if(kind > arc || static_cast<size_t>(valuesEnd - v) < kind_values[kind]) {
+                        damaged = true;
+                        return;
+                    }
+                    geometry->push_back(createElement(kind, v));
+                    v += kind_values[kind];
+                    localCounts[kind]++;
+                }
+                if(v != valuesEnd) {
+                    damaged = true;
+                    return;
+                }
+                built[i] = geometry;
+            }
+            lock_guard<mutex> guard(countLock);
+            for(int k = 0 ; k < 4 ; k++) counts[k] += localCounts[k];
+        });
+        if(damaged) return nullptr;
+        STATS_COUNT(lines, counts[line]);
+        STATS_COUNT(cubicBeziers, counts[cubicBezier]);
+        STATS_COUNT(quadraticBeziers, counts[quadraticBezier]);
+        STATS_COUNT(arcs, counts[arc]);
+
+        svg::Document *document = new svg::Document();
+        document->sources.reserve(built.size());
+        for(size_t i = 0 ; i < built.size() ; i++) {
+            if(geometries[i].source) document->sources[geometries[i].source] = built[i];
+        }
+        document->paths.reserve(header.instances);
+        for(size_t i = 0 ; i < header.instances ; i++) {
+            const InstanceRecord &record = instances[i];
+            svg::Fill fill;
+            fill.paint = record.paint;
+            fill.evenOdd = record.evenOdd;
+            document->paths.push_back(svg::Path(built[record.geometry], transformation(record.matrix), fill));
+        }
+        for(size_t i = 0 ; i < header.images ; i++) {
+            const ImageRecord &record = images[i];
+            svg::Image image;
+            image.href = string(text + record.href, record.hrefLength);
+            image.x = record.x;
+            image.y = record.y;
+            image.width = record.width;
+            image.height = record.height;
+            image.preserveAspectRatio = record.preserveAspectRatio != 0;
+            image.transformation = transformation(record.matrix);
+            document->images.push_back(image);
+        }
+        STATS_COUNT(paths, document->paths.size());
+        STATS_COUNT(images, document->images.size());
+        return document;
+    }
+
+    //Kind and values of an element
+    static uint8_t elementValues(svg::PathElement *element, double *v) {
+        svg::Point p[4];
+        size_t count;
+        uint8_t kind;
+        if(svg::Line *line = dynamic_cast<svg::Line*>(element)) {
+            p[0] = line->getP1();
+            p[1] = line->getP2();
+            count = 2;
+            kind = cache::line;
+        } else if(svg::CubicBezier *cubic = dynamic_cast<svg::CubicBezier*>(element)) {
+            p[0] = cubic->getP1();
+            p[1] = cubic->getP2();
+            p[2] = cubic->getP3();
+            p[3] = cubic->getP4();
+            count = 4;
+            kind = cubicBezier;
+        } else if(svg::QuadraticBezier *quadratic = dynamic_cast<svg::QuadraticBezier*>(element)) {
+            p[0] = quadratic->getP1();
+            p[1] = quadratic->getP2();
+            p[2] = quadratic->getP3();
+            count = 3;
+            kind = quadraticBezier;
+        } else if(svg::Arc *a = dynamic_cast<svg::Arc*>(element)) {
+            p[0] = a->getCenter();
+            p[1] = a->getU();
+            p[2] = a->getV();
+            p[3] = svg::Point {a->getStart(), a->getSweep()};
+            count = 4;
+            kind = arc;
+        } else {
+            throw invalid_argument("Unknown path element");
+        }
+        for(size_t i = 0 ; i < count ; i++) {
+            v[i * 2] = p[i].x;
+            v[i * 2 + 1] = p[i].y;
+        }
+        return kind;
+    }
+
+    bool write(const string &cachePath, const svg::Document &document, uint64_t hash, uint64_t size, const string &directory) {
+        map<svg::Geometry*, uint64_t> sources;
+        for(auto &source : document.sources) sources[source.second.get()] = source.first;
+
+        //Geometries shared by clones are stored once
+        map<svg::Geometry*, size_t> indices;
+        vector<svg::Geometry*> geometries;
+        vector<InstanceRecord> instances(document.paths.size());
+        for(size_t i = 0 ; i < document.paths.size() ; i++) {
+            svg::Path path = document.paths[i];
+            svg::Geometry *geometry = path.getGeometry().get();
+            auto found = indices.find(geometry);
+            if(found == indices.end()) {
+                found = indices.insert({geometry, geometries.size()}).first;
+                geometries.push_back(geometry);
+            }
+            InstanceRecord &record = instances[i];
+            record.geometry = found->second;
+            path.getTransformation().getMatrix(record.matrix);
+            record.paint = path.getFill().paint;
+            record.evenOdd = path.getFill().evenOdd;
+        }
+
+        vector<GeometryRecord> geometryRecords(geometries.size() + 1);
+        vector<uint8_t> kinds;
+        vector<double> values;
+        double v[8];
+        for(size_t i = 0 ; i < geometries.size() ; i++) {
+            auto source = sources.find(geometries[i]);
+            geometryRecords[i] = GeometryRecord {kinds.size(), values.size(), source != sources.end() ? source->second : 0};
+            for(svg::PathElement *element : *geometries[i]) {
+                uint8_t kind = elementValues(element, v);
+                kinds.push_back(kind);
+                values.insert(values.end(), v, v + kind_values[kind]);
+            }
+        }
+        geometryRecords.back() = GeometryRecord {kinds.size(), values.size(), 0};
+        kinds.resize(align(kinds.size()), 0);
+
+        string text = directory;
+        vector<ImageRecord> images(document.images.size());
+        for(size_t i = 0 ; i < images.size() ; i++) {
+            const svg::Image &image = document.images[i];
+            ImageRecord &record = images[i];
+            record.x = image.x;
+            record.y = image.y;
+            record.width = image.width;
+            record.height = image.height;
+            image.transformation.getMatrix(record.matrix);
+            record.href = text.size();
+            record.hrefLength = image.href.size();
+            record.preserveAspectRatio = image.preserveAspectRatio;
+            text += image.href;
+        }
+
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, magic, sizeof(magic));
+        header.formatVersion = format_version;
+        header.parserVersion = svg::parser_version;
+        header.sourceHash = hash;
+        header.sourceSize = size;
+        header.geometries = geometries.size();
+        header.elements = geometryRecords.back().element;
+        header.values = values.size();
+        header.instances = instances.size();
+        header.images = images.size();
+        header.textSize = text.size();
+        header.directoryLength = directory.size();
+        text.resize(align(text.size()), '\0');
+        header.fileSize = sizeof(Header) + geometryRecords.size() * sizeof(GeometryRecord) + kinds.size() +
+                          values.size() * sizeof(double) + instances.size() * sizeof(InstanceRecord) +
+                          images.size() * sizeof(ImageRecord) + text.size();
+
+        //Arrays are joined once to hash them, which costs less than reading the file back
+        string content;
+        content.reserve(header.fileSize - sizeof(Header));
+        content.append(reinterpret_cast<const char*>(geometryRecords.data()), geometryRecords.size() * sizeof(GeometryRecord));
+        content.append(reinterpret_cast<const char*>(kinds.data()), kinds.size());
+        content.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+        content.append(reinterpret_cast<const char*>(instances.data()), instances.size() * sizeof(InstanceRecord));
+        content.append(reinterpret_cast<const char*>(images.data()), images.size() * sizeof(ImageRecord));
+        content.append(text);
+        header.contentHash = hashData(reinterpret_cast<const unsigned char*>(content.data()), content.size());
+
+        static atomic<unsigned int> writes {0}; //Documents of the same contents may be written by several threads at once
+        string temporary = cachePath + ".tmp" + to_string(getpid()) + "-" + to_string(writes++);
+        FILE *file = fopen(temporary.c_str(), "wb");
+        if(!file) return false;
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+        written = written && fwrite(content.data(), 1, content.size(), file) == content.size();
+        written = fclose(file) == 0 && written;
+        if(!written || rename(temporary.c_str(), cachePath.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    //Removes least recently used files until the cache fits the size limit
+    static void prune(const string &directory) {
+        DIR *dir = opendir(directory.c_str());
+        if(!dir) return;
+        vector<pair<time_t, pair<string, uint64_t>>> files;
+        uint64_t total = 0;
+        while(struct dirent *entry = readdir(dir)) {
+            string path = directory + "/" + entry->d_name;
+            struct stat status;
+            if(entry->d_name[0] == '.' || strstr(entry->d_name, ".tmp") || stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) continue;
+            files.push_back({status.st_mtime, {path, static_cast<uint64_t>(status.st_size)}});
+            total += status.st_size;
+        }
+        closedir(dir);
+        sort(files.begin(), files.end());
+        for(size_t i = 0 ; i < files.size() && total > size_limit ; i++) {
+            if(unlink(files[i].second.first.c_str()) == 0) total -= files[i].second.second;
+        }
+    }
+
+    svg::Document* loadDocument(const string &path, const svg::Document *previous, bool *hit) {
+        if(hit) *hit = false;
+        string cacheDirectory = directory();
+        if(cacheDirectory.empty()) return svg::loadDocument(path, previous);
+
+        uint64_t hash, size;
+        string cachePath, linkDirectory;
+        {
+            STATS_TIMER(readCache);
+            hash = hashFile(path, size);
+            char name[64];
+            snprintf(name, sizeof(name), "/%016llx-%u.geometry", static_cast<unsigned long long>(hash), svg::parser_version);
+            cachePath = cacheDirectory + name;
+            size_t slash = path.rfind('/');
+            char *resolved = realpath(slash == string::npos ? "." : path.substr(0, slash + 1).c_str(), nullptr);
+            if(resolved) {
+                linkDirectory = resolved;
+                free(resolved);
+            }
+            svg::Document *document = read(cachePath, hash, size, linkDirectory);
+            if(document) {
+                utimes(cachePath.c_str(), nullptr); //Marks the file as recently used
+                if(hit) *hit = true;
+                return document;
+            }
+        }
+
+        svg::Document *document = svg::loadDocument(path, previous);
+        STATS_TIMER(writeCache);
+        try {
+            if(createDirectory(cacheDirectory) && write(cachePath, *document, hash, size, linkDirectory)) prune(cacheDirectory);
+        } catch(...) {
+            //Document is still good without the cache
+        }
+        return document;
+    }
+
+}
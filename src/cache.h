@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "svg.h"
+
+//Binary cache of parsed documents, so large drawings open again without parsing XML and path data.
+//Files are named after a hash of the SVG contents and the parser version, and stored in the user cache
+//directory. They hold flat arrays of elements, path instances and images behind a versioned header, and
+//are mapped into memory and read in place.
+namespace cache {
+
+    using namespace std;
+
+    const uint32_t format_version = 2; //Layout of cache files
+    const uint64_t size_limit = 1ULL << 31; //Least recently used files are removed above that
+
+    //$XDG_CACHE_HOME/laserworks or ~/.cache/laserworks, empty if neither is set
+    string directory();
+
+    //Hash of file contents, computed in parallel over the mapped file. Throws if the file can't be read.
+    uint64_t hashFile(const string &path, uint64_t &size);
+
+    //Reads a cached document of a source file with the hash and size. Returns nullptr if the cache file is
+    //missing, stale or damaged. Linked images are resolved against directory, so documents cached from
+    //another directory aren't used.
+    svg::Document* read(const string &cachePath, uint64_t hash, uint64_t size, const string &directory);
+
+    //Writes a document through a temporary file renamed into place, so readers never see a partial file.
+    //Returns false if it can't be written.
+    bool write(const string &cachePath, const svg::Document &document, uint64_t hash, uint64_t size, const string &directory);
+
+    //Loads a document from the cache, or parses it and stores it for the next time. Problems with the
+    //cache only make it parse the file. Unchanged geometries of the previous document are reused when
+    //parsing. Hit is set if the cache was used.
+    svg::Document* loadDocument(const string &path, const svg::Document *previous = nullptr, bool *hit = nullptr);
+
+}
@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <exception>
+#include <vector>
+
+#include "cli.h"
+#include "batch.h"
+#include "cache.h"
+#include "gcode.h"
+#include "meatpack.h"
+#include "utils.h"
+#include "optimize.h"
+#include "preview.h"
+#include "sender.h"
+#include "stats.h"
+#include "trace.h"
+#include "viewer.h"
+#include "watch.h"
+
+namespace cli {
+
+    using namespace std;
+
+    static void printUsage(const char *program) {
+        printf("Usage: %s [options] input.svg\n", program);
+        printf("       %s --batch [options] input.svg|directory...\n", program);
+        printf("       %s --analyze [options] input.gcode\n", program);
+        printf("       %s --unpack -o output.gcode input.gcode\n", program);
+        printf("Options:\n");
+        printf("  -o, --output FILE   GCODE file to write, defaults to input name with .gcode suffix. With --batch,\n");
+        printf("                      directory to write files to instead of next to the inputs\n");
+        printf("  -c, --config FILE   Machine profile, defaults to config.lwc\n");
+        printf("      --stream        Convert paths while reading the file, memory use doesn't depend on file size.\n");
+        printf("                      Default of --send\n");
+        printf("      --no-stream     Load the whole file before converting, with duplicates removed and paths joined\n");
+        printf("      --watch         Convert again whenever the SVG file changes, parsing only shapes that changed\n");
+        printf("      --batch         Convert every input, and the SVG files of input directories, several at once\n");
+        printf("      --jobs N        Files converted at once by --batch, defaults to one per processor\n");
+        printf("      --no-cache      Parse the SVG file again instead of loading geometry cached by earlier runs\n");
+        printf("      --meatpack      Pack the output with MeatPack, for Marlin controllers streamed over serial\n");
+        printf("      --unpack        Restore text of a packed GCODE file\n");
+        printf("      --stats         Print time, allocations and memory of every stage and counts of elements\n");
+        printf("      --analyze       Print lines, moves, cut and travel length and bounds of a GCODE file\n");
+        printf("      --preview FILE  Write an SVG drawing of the toolpath instead of GCODE, cuts in red and travel in blue\n");
+        printf("      --trace FILE    Write a Chrome trace of the conversion, to open in chrome://tracing or Perfetto\n");
+        printf("      --send DEVICE   Stream the GCODE to a controller on a serial port while it is generated\n");
+        printf("      --protocol NAME Flow control of --send: grbl counts characters in the receive buffer, marlin\n");
+        printf("                      sends a window of lines ahead of ok responses, defaults to grbl\n");
+        printf("      --baud RATE     Baud rate of the serial port, any rate like 250000 on Linux, defaults to 115200\n");
+        printf("      --buffer BYTES  Receive buffer of a GRBL controller, defaults to 128\n");
+        printf("      --window LINES  Lines sent ahead to a Marlin controller, defaults to 4\n");
+        printf("  -h, --help          Show this message\n");
+    }
+
+    //Loads a document with duplicates removed and paths joined, as they are exported
+    static svg::Document* loadOptimized(const string &input, const gcode::Settings &settings, bool useCache, const svg::Document *previous = nullptr) {
+        svg::Document *document = useCache ? cache::loadDocument(input, previous) : svg::loadDocument(input, previous);
+        try {
+            optimize::Report report = optimize::removeDuplicates(document->paths, settings.duplicateTolerance, settings.hatchSpacing > 0);
+            if(report.removed > 0) {
+                printf("Removed %zu duplicate segments, cut is %.1f mm shorter.\n", report.removed, report.savedLength);
+            }
+            size_t joins = optimize::joinPaths(document->paths, settings.joinTolerance, settings.hatchSpacing > 0);
+            if(joins > 0) printf("Joined %zu segments with neighbouring ones.\n", joins);
+        } catch(...) {
+            delete document;
+            throw;
+        }
+        return document;
+    }
+
+    static estimate::Result convert(const string &input, const gcode::Settings &settings, ostream &out, bool stream, bool useCache) {
+        if(stream) {
+            ifstream in(input, ios::binary);
+            if(!in.good()) throw runtime_error("Unable to open " + input);
+            gcode::StreamReader reader(in);
+            return gcode::exportPipelined(reader, settings, out);
+        }
+        svg::Document *document = loadOptimized(input, settings, useCache);
+        estimate::Result estimate;
+        try {
+            estimate = gcode::exportPaths(*document, settings, out);
+        } catch(...) {
+            delete document;
+            throw;
+        }
+        delete document;
+        return estimate;
+    }
+
+    //Same toolpath as the GCODE export, drawn through the SVG emitter
+    static int previewFile(const string &input, const gcode::Settings &settings, const string &output, bool printStats, bool useCache) {
+        try {
+            stats::reset();
+            svg::Document *document = loadOptimized(input, settings, useCache);
+            toolpath::Toolpath toolpath;
+            try {
+                gcode::buildToolpath(*document, settings, toolpath);
+            } catch(...) {
+                delete document;
+                throw;
+            }
+            delete document;
+            toolpath::PassManager passes;
+            gcode::createPasses(settings, passes);
+            passes.run(toolpath);
+            ofstream file(output);
+            if(!file.good()) throw runtime_error("Unable to open " + output);
+            preview::SvgEmitter emitter(file);
+            toolpath::State state;
+            vector<svg::Point> offsets = gcode::arrayOffsets(settings);
+            toolpath::OffsetEmitter shifted(emitter, offsets[0]);
+            for(const svg::Point &offset : offsets) { //Copies of an array
+                shifted.setOffset(offset, state);
+                toolpath::emit(toolpath, 0, toolpath.cuts.size(), gcode::toolpathSettings(settings), state, shifted);
+            }
+            toolpath::finish(state, shifted);
+            emitter.close();
+            file.close();
+            if(!file) throw runtime_error("Output error");
+            for(const toolpath::PassManager::Timing &timing : passes.getTimings()) {
+                printf("%s: %.1f ms\n", timing.name.c_str(), timing.seconds * 1000);
+            }
+            if(printStats) printf("%s", stats::report().c_str());
+        } catch(exception const &e) {
+            fprintf(stderr, "Previewing %s failed: %s\n", input.c_str(), e.what());
+            return 1;
+        }
+        return 0;
+    }
+
+    const int watch_settle = 200; //ms without changes before converting again
+
+    //Converts the file again whenever it changes. Geometries of the previous conversion are kept, so only shapes
+    //that changed are parsed again.
+    static int watchFile(const string &input, const gcode::Settings &settings, const string &output, bool useCache, bool printStats) {
+        svg::Document *document = nullptr;
+        try {
+            watch::FileWatcher watcher(input);
+            while(true) {
+                stats::reset();
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                try {
+                    svg::Document *loaded = loadOptimized(input, settings, useCache, document);
+                    delete document;
+                    document = loaded;
+                    fstream file;
+                    file.open(output, ios::out);
+                    if(!file.good()) throw runtime_error("Unable to open " + output);
+                    estimate::Result estimate = gcode::exportPaths(*document, settings, file);
+                    file.close();
+                    if(!file) throw runtime_error("Output error");
+                    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                    printf("%s\nConverted in %.0f ms, watching %s for changes.\n", estimate::describe(estimate).c_str(), elapsed * 1000, input.c_str());
+                    if(printStats) printf("%s", stats::report().c_str());
+                } catch(exception const &e) { //File may be saved again with the mistake fixed
+                    fprintf(stderr, "Converting %s failed: %s\n", input.c_str(), e.what());
+                }
+                fflush(stdout);
+                watcher.wait(watch_settle);
+            }
+        } catch(exception const &e) {
+            fprintf(stderr, "Watching %s failed: %s\n", input.c_str(), e.what());
+        }
+        delete document;
+        return 1;
+    }
+
+    //Converts files concurrently with the same profile, reporting every file as it is done
+    static int batchFiles(const vector<string> &paths, const gcode::Settings &settings, const string &directory, size_t jobs, bool useCache, bool printStats) {
+        vector<batch::Job> batchJobs;
+        try {
+            batchJobs = batch::createJobs(batch::collectInputs(paths), directory);
+        } catch(exception const &e) {
+            fprintf(stderr, "Batch conversion failed: %s\n", e.what());
+            return 1;
+        }
+        stats::reset();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<batch::Result> results = batch::run(batchJobs, settings, jobs, useCache, [](const batch::Result &result) {
+            fprintf(result.converted ? stdout : stderr, "%s\n", batch::describe(result).c_str());
+            fflush(stdout);
+        });
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("%s\n", batch::summary(results, elapsed).c_str());
+        if(printStats) printf("%s", stats::report().c_str());
+        for(const batch::Result &result : results) {
+            if(!result.converted) return 1;
+        }
+        return 0;
+    }
+
+    static int unpackFile(const string &input, const string &output) {
+        ifstream in(input, ios::binary);
+        ofstream out(output, ios::binary | ios::trunc);
+        if(!in.good() || !out.good()) {
+            fprintf(stderr, "Unable to open %s\n", (in.good() ? output : input).c_str());
+            return 1;
+        }
+        meatpack::Decoder decoder;
+        vector<char> buffer(1 << 16);
+        string text;
+        while(in) {
+            in.read(buffer.data(), buffer.size());
+            decoder.decode(buffer.data(), in.gcount(), text);
+            out << text;
+            text.clear();
+        }
+        out.close();
+        if(in.bad() || !out) {
+            fprintf(stderr, "Unpacking %s failed\n", input.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    static void printProgress(const sender::Metrics &metrics) {
+        fprintf(stderr, "\r%s\033[K", sender::describe(metrics).c_str());
+    }
+
+    static int sendFile(const string &input, const gcode::Settings &settings, const string &device, const sender::Settings &sendSettings, bool stream, bool useCache) {
+        try {
+            sender::SendBuffer port(device, sendSettings, printProgress);
+            ostream out(&port);
+            estimate::Result estimate = convert(input, settings, out, stream, useCache);
+            sender::Metrics metrics = port.finish();
+            fprintf(stderr, "\r\033[K");
+            printf("%s\n%s\n", estimate::describe(estimate).c_str(), sender::describe(metrics, true).c_str());
+        } catch(exception const &e) {
+            fprintf(stderr, "\r\033[KSending %s to %s failed: %s\n", input.c_str(), device.c_str(), e.what());
+            return 1;
+        }
+        return 0;
+    }
+
+    int run(int argc, char **argv) {
+        string input, output, config = "config.lwc", tracePath, device, previewPath;
+        sender::Settings sendSettings;
+        vector<string> inputs;
+        size_t jobs = 0;
+        bool stream = false, noStream = false, printStats = false, analyze = false, pack = false, unpack = false, useCache = true, watching = false, batching = false;
+
+        for(int i = 1 ; i < argc ; i++) {
+            string arg = argv[i];
+            if((arg == "-o" || arg == "--output") && i + 1 < argc) {
+                output = argv[++i];
+            } else if((arg == "-c" || arg == "--config") && i + 1 < argc) {
+                config = argv[++i];
+            } else if(arg == "--stream") {
+                stream = true;
+                noStream = false;
+            } else if(arg == "--no-stream") {
+                noStream = true;
+                stream = false;
+            } else if(arg == "--watch") {
+                watching = true;
+            } else if(arg == "--batch") {
+                batching = true;
+            } else if(arg == "--jobs" && i + 1 < argc) {
+                jobs = strtoul(argv[++i], nullptr, 10);
+            } else if(arg == "--no-cache") {
+                useCache = false;
+            } else if(arg == "--trace" && i + 1 < argc) {
+                tracePath = argv[++i];
+            } else if(arg == "--analyze") {
+                analyze = true;
+            } else if(arg == "--preview" && i + 1 < argc) {
+                previewPath = argv[++i];
+            } else if(arg == "--meatpack") {
+                pack = true;
+            } else if(arg == "--unpack") {
+                unpack = true;
+            } else if(arg == "--send" && i + 1 < argc) {
+                device = argv[++i];
+            } else if(arg == "--protocol" && i + 1 < argc) {
+                string name = argv[++i];
+                if(name != "grbl" && name != "marlin") {
+                    fprintf(stderr, "Unknown protocol: %s\n", name.c_str());
+                    return 1;
+                }
+                sendSettings.protocol = name == "grbl" ? sender::grbl : sender::marlin;
+            } else if(arg == "--baud" && i + 1 < argc) {
+                sendSettings.baudRate = atoi(argv[++i]);
+            } else if(arg == "--buffer" && i + 1 < argc) {
+                sendSettings.bufferSize = strtoul(argv[++i], nullptr, 10);
+            } else if(arg == "--window" && i + 1 < argc) {
+                sendSettings.window = strtoul(argv[++i], nullptr, 10);
+            } else if(arg == "--stats") {
+                printStats = true;
+            } else if(arg == "-h" || arg == "--help") {
+                printUsage(argv[0]);
+                return 0;
+            } else if(arg[0] != '-') {
+                inputs.push_back(arg);
+            } else {
+                fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        if(inputs.empty()) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if(inputs.size() > 1 && !batching) {
+            fprintf(stderr, "Unknown argument: %s\n", inputs[1].c_str());
+            printUsage(argv[0]);
+            return 1;
+        }
+        if(batching && (stream || watching || pack || unpack || analyze || !device.empty() || !previewPath.empty())) {
+            fprintf(stderr, "--batch writes GCODE files and can't be combined with --stream, --watch, --meatpack, --unpack, --analyze, --send or --preview.\n");
+            return 1;
+        }
+        if(!tracePath.empty() && (watching || unpack || analyze || !device.empty() || !previewPath.empty())) {
+            fprintf(stderr, "--trace records conversions to GCODE files and can't be combined with --watch, --unpack, --analyze, --send or --preview.\n");
+            return 1;
+        }
+        input = inputs[0];
+        if(unpack) {
+            if(output.empty()) {
+                fprintf(stderr, "Unpacking needs an output file.\n");
+                return 1;
+            }
+            return unpackFile(input, output);
+        }
+
+        gcode::Settings settings;
+        if(!gcode::loadSettings(config, settings)) {
+            fprintf(stderr, "Using default machine profile, %s couldn't be loaded.\n", config.c_str());
+        }
+
+        if(batching) {
+            unique_ptr<trace::Recording> recording;
+            try {
+                recording.reset(new trace::Recording(tracePath));
+            } catch(exception const &e) {
+                fprintf(stderr, "Tracing failed: %s\n", e.what());
+                return 1;
+            }
+            int result = batchFiles(inputs, settings, output, jobs, useCache, printStats);
+            if(!recording->finish()) {
+                fprintf(stderr, "Writing trace %s failed.\n", tracePath.c_str());
+                return 1;
+            }
+            return result;
+        }
+
+        if(output.empty()) output = batch::outputPath(input, "");
+
+        if(analyze) { //Tool commands of the profile tell cuts from travel
+            try {
+                viewer::GcodeFile gcodeFile(input, settings.toolOnGcode, settings.toolOffGcode);
+                printf("%s\n", viewer::describe(gcodeFile.getSummary()).c_str());
+            } catch(exception const &e) {
+                fprintf(stderr, "Analyzing %s failed: %s\n", input.c_str(), e.what());
+                return 1;
+            }
+            return 0;
+        }
+
+        if(watching) return watchFile(input, settings, output, useCache, printStats);
+
+        if(!previewPath.empty()) return previewFile(input, settings, previewPath, printStats, useCache);
+
+        if(!device.empty()) {
+            sendSettings.meatpack = pack;
+            //Streamed unless asked not to, so the controller gets the first lines while the file is still read
+            return sendFile(input, settings, device, sendSettings, !noStream, useCache);
+        }
+
+        try {
+            stats::reset();
+            estimate::Result estimate;
+            fstream file;
+            trace::Recording recording(tracePath); //Written when the conversion fails as well
+            file.open(output, pack ? ios::out | ios::binary : ios::out);
+            if(!file.good()) throw runtime_error("Unable to open " + output);
+            if(pack) { //Packed output can't be rewritten, so it has no estimate comment
+                meatpack::EncodeBuffer encoder(file.rdbuf());
+                ostream packed(&encoder);
+                estimate = convert(input, settings, packed, stream, useCache);
+                if(!packed || !encoder.finish()) file.setstate(ios::badbit);
+            } else {
+                estimate = convert(input, settings, file, stream, useCache);
+            }
+            file.close();
+            if(!file) throw runtime_error("Output error");
+            printf("%s\n", estimate::describe(estimate).c_str());
+            if(printStats) printf("%s", stats::report().c_str());
+            if(!recording.finish()) {
+                fprintf(stderr, "Writing trace %s failed.\n", tracePath.c_str());
+                return 1;
+            }
+        } catch(exception const &e) {
+            fprintf(stderr, "Converting %s failed: %s\n", input.c_str(), e.what());
+            return 1;
+        }
+        return 0;
+    }
+
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+namespace cli {
+
+    //Converts files given on the command line without opening the window. Returns process exit code.
+    int run(int argc, char **argv);
+
+}
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "estimate.h"
+#include "stats.h"
+
+namespace estimate {
+
+    using namespace std;
+
+    const double arc_tolerance = 0.002; //Largest distance between an arc and its chords, as in GRBL
+
+    string formatTime(double seconds) {
+        long total = static_cast<long>(round(seconds));
+        char text[32];
+        snprintf(text, sizeof(text), "%ld:%02ld:%02ld", total / 3600, total / 60 % 60, total % 60);
+        return text;
+    }
+
+    string describe(const Result &result) {
+        char text[256];
+        snprintf(text, sizeof(text), "Estimated time %s (cutting %s, travel %s), cut %.0f mm in %zu moves, travel %.0f mm in %zu moves",
+            formatTime(result.totalTime()).c_str(), formatTime(result.cutTime).c_str(), formatTime(result.travelTime).c_str(),
+            result.cutDistance, result.cutSegments, result.travelDistance, result.travelSegments);
+        return text;
+    }
+
+    //First line of a command, which is what the estimator recognizes
+    static string firstLine(const string &gcode) {
+        size_t begin = gcode.find_first_not_of(" \t\r\n");
+        if(begin == string::npos) return string();
+        size_t end = gcode.find_first_of(";\r\n", begin); //Lines are compared without comments
+        string result = gcode.substr(begin, end == string::npos ? string::npos : end - begin);
+        return result.substr(0, result.find_last_not_of(" \t") + 1);
+    }
+
+    Estimator::Estimator(const Settings &settings) : settings(settings) {
+        toolOn = firstLine(settings.toolOnGcode);
+        toolOff = firstLine(settings.toolOffGcode);
+        if(this->settings.blocks < 1) this->settings.blocks = 1;
+    }
+
+    void Estimator::parse(const char *text, size_t length) {
+        const char *end = text + length;
+        while(text < end) {
+            const char *newline = static_cast<const char*>(memchr(text, '\n', end - text));
+            if(!newline) {
+                line.append(text, end);
+                return;
+            }
+            if(line.empty()) {
+                parseLine(text, newline);
+            } else {
+                line.append(text, newline);
+                parseLine(line.data(), line.data() + line.length());
+                line.clear();
+            }
+            text = newline + 1;
+        }
+    }
+
+    void Estimator::parseLine(const char *begin, const char *end) {
+        const char *comment = static_cast<const char*>(memchr(begin, ';', end - begin));
+        if(comment) end = comment;
+        while(begin < end && (*begin == ' ' || *begin == '\t')) begin++;
+        while(end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+        if(begin == end) return;
+        size_t length = end - begin;
+        if(length == toolOn.length() && toolOn.compare(0, length, begin, length) == 0) {
+            synchronize();
+            toolEnabled = true;
+            return;
+        }
+        if(length == toolOff.length() && toolOff.compare(0, length, begin, length) == 0) {
+            synchronize();
+            toolEnabled = false;
+            return;
+        }
+
+        //Words are letters followed by numbers
+        int g = -1, m = -1;
+        bool hasX = false, hasY = false, hasI = false, hasJ = false;
+        double wx = 0, wy = 0, wi = 0, wj = 0;
+        const char *p = begin;
+        while(p < end) {
+            char letter = toupper(*p++);
+            if(letter < 'A' || letter > 'Z') continue;
+            if(p == end || !(isdigit(*p) || *p == '-' || *p == '+' || *p == '.')) continue;
+            char *next;
+            double value = strtod(p, &next);
+            if(next == p || next > end) continue;
+            p = next;
+            switch(letter) {
+                case 'G': g = static_cast<int>(value); break;
+                case 'M': m = static_cast<int>(value); break;
+                case 'X': wx = value; hasX = true; break;
+                case 'Y': wy = value; hasY = true; break;
+                case 'I': wi = value; hasI = true; break;
+                case 'J': wj = value; hasJ = true; break;
+                case 'F': if(g >= 0 && g <= 3) feed = value / 60; break;
+            }
+        }
+
+        if(m == 203 && hasX) {
+            speedLimit = wx;
+            if(toolOn.empty()) {
+                //Travel speed set again after a travel move starts the cut, which is the case when both speeds are equal
+                bool travel = settings.travelSpeed > 0 && abs(wx - settings.travelSpeed) <= 1e-5 * settings.travelSpeed;
+                toolEnabled = !travel || (!toolEnabled && travelMoves > 0);
+                travelMoves = 0;
+            }
+        } else if(toolOn.empty() && (m == 3 || m == 4 || m == 5)) {
+            synchronize();
+            toolEnabled = m != 5;
+        } else if(g == 90) {
+            relative = false;
+        } else if(g == 91) {
+            relative = true;
+        } else if(g == 28) {
+            synchronize();
+            x = y = 0;
+        } else if(g >= 0 && g <= 3) {
+            double toX = hasX ? (relative ? x + wx : wx) : x;
+            double toY = hasY ? (relative ? y + wy : wy) : y;
+            if(toX == x && toY == y && !(g >= 2 && (hasI || hasJ))) return;
+            if(toolEnabled) {
+                result.cutSegments++;
+            } else {
+                result.travelSegments++;
+                travelMoves++;
+            }
+            if(g <= 1 || (!hasI && !hasJ)) {
+                addMove(toX, toY);
+                return;
+            }
+
+            //Arc split into chords short enough to stay within tolerance
+            double cx = x + wi, cy = y + wj;
+            double radius = sqrt(wi * wi + wj * wj);
+            double startAngle = atan2(y - cy, x - cx);
+            double sweep = atan2(toY - cy, toX - cx) - startAngle;
+            if(g == 2 && sweep >= 0) sweep -= 2 * M_PI;
+            if(g == 3 && sweep <= 0) sweep += 2 * M_PI;
+            double step = radius > arc_tolerance ? 2 * acos(1 - arc_tolerance / radius) : M_PI;
+            int chords = max(1, static_cast<int>(ceil(abs(sweep) / step)));
+            for(int i = 1 ; i < chords ; i++) {
+                double angle = startAngle + sweep * i / chords;
+                addMove(cx + radius * cos(angle), cy + radius * sin(angle));
+            }
+            addMove(toX, toY);
+        }
+    }
+
+    void Estimator::addMove(double toX, double toY) {
+        double dx = toX - x, dy = toY - y;
+        double length = sqrt(dx * dx + dy * dy);
+        x = toX;
+        y = toY;
+        if(length == 0) return;
+
+        Block block {length, 0, 0, dx / length, dy / length, toolEnabled};
+        block.speed = speedLimit > 0 ? speedLimit : (feed > 0 ? feed : 1);
+        if(feed > 0) block.speed = min(block.speed, feed);
+        if(settings.maxSpeed > 0) block.speed = min(block.speed, settings.maxSpeed);
+        if(toolEnabled) result.cutDistance += length;
+        else result.travelDistance += length;
+
+        //Junction deviation: the corner is taken at a speed that keeps centripetal acceleration within limits
+        //on a circle deviating from the corner by the junction deviation
+        if(!blocks.empty()) {
+            const Block &previous = blocks.back();
+            double cosTheta = -(previous.dx * block.dx + previous.dy * block.dy);
+            double limit = min(previous.speed, block.speed);
+            if(cosTheta > 0.999999) {
+                block.maxEntry = 0;
+            } else if(cosTheta < -0.999999) {
+                block.maxEntry = limit;
+            } else {
+                double sinHalf = sqrt(0.5 * (1 - cosTheta));
+                block.maxEntry = min(limit, sqrt(settings.acceleration * settings.junctionDeviation * sinHalf / (1 - sinHalf)));
+            }
+        }
+        blocks.push_back(block);
+        if(static_cast<int>(blocks.size()) > settings.blocks) finishBlock();
+    }
+
+    void Estimator::finishBlock() {
+        double a = settings.acceleration;
+
+        //Going backwards from a stop at the end of the buffer
+        double exit = 0;
+        for(size_t i = blocks.size() - 1 ; i > 0 ; i--) {
+            exit = min(blocks[i].maxEntry, sqrt(exit * exit + 2 * a * blocks[i].length));
+        }
+
+        //Going forwards from the speed the machine already has
+        Block &block = blocks.front();
+        double entry = speed;
+        exit = min(exit, sqrt(entry * entry + 2 * a * block.length));
+        double top = block.speed;
+        double accelerating = (top * top - entry * entry) / (2 * a);
+        double decelerating = (top * top - exit * exit) / (2 * a);
+        double time;
+        if(accelerating + decelerating <= block.length) {
+            time = (top - entry) / a + (top - exit) / a + (block.length - accelerating - decelerating) / top;
+        } else { //Triangle profile, nominal speed is never reached
+            double peak = sqrt((2 * a * block.length + entry * entry + exit * exit) / 2);
+            time = max(0.0, (peak - entry) / a) + max(0.0, (peak - exit) / a);
+        }
+        if(block.cut) result.cutTime += time;
+        else result.travelTime += time;
+        speed = exit;
+        blocks.pop_front();
+    }
+
+    void Estimator::synchronize() {
+        while(!blocks.empty()) finishBlock();
+        speed = 0;
+    }
+
+    Result Estimator::finish() {
+        if(!line.empty()) {
+            parseLine(line.data(), line.data() + line.length());
+            line.clear();
+        }
+        synchronize();
+        return result;
+    }
+
+    TeeBuffer::TeeBuffer(streambuf *target, Estimator &estimator) : target(target), estimator(estimator) {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+
+    bool TeeBuffer::pass() {
+        streamsize length = pptr() - pbase();
+        STATS_COUNT(bytesWritten, length);
+        estimator.parse(pbase(), static_cast<size_t>(length));
+        setp(buffer, buffer + sizeof(buffer));
+        return target->sputn(buffer, length) == length;
+    }
+
+    int TeeBuffer::overflow(int c) {
+        if(!pass()) return EOF;
+        if(c != EOF) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return c == EOF ? 0 : c;
+    }
+
+    int TeeBuffer::sync() {
+        if(!pass()) return -1;
+        return target->pubsync();
+    }
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <deque>
+#include <streambuf>
+#include <string>
+
+namespace estimate {
+
+    using namespace std;
+
+    //Machine motion limits, as configured in the firmware
+    struct Settings {
+        double acceleration = 1000; //mm/s^2
+        double junctionDeviation = 0.01; //mm, limits speed through corners
+        double maxSpeed = 0; //mm/s, 0 if moves are only limited by M203 and F
+        int blocks = 16; //Moves the firmware plans ahead
+        string toolOnGcode; //Moves following these commands are cuts
+        string toolOffGcode;
+        double travelSpeed = 0; //Set by M203 before travel, tells travel from cuts if there is no tool on command
+    };
+
+    struct Result {
+        double cutTime = 0; //Seconds
+        double travelTime = 0;
+        double cutDistance = 0; //mm
+        double travelDistance = 0;
+        size_t cutSegments = 0; //Move commands
+        size_t travelSegments = 0;
+        double totalTime() const {return cutTime + travelTime;};
+    };
+
+    //Formats seconds as H:MM:SS
+    string formatTime(double seconds);
+
+    //One line summary of the job
+    string describe(const Result &result);
+
+    //Simulates a firmware planner over GCODE: moves accelerate and decelerate with constant acceleration,
+    //corners are taken at the junction deviation speed and the planner looks a fixed number of moves ahead.
+    //Arcs are split into chords, like the firmware does. Tool commands wait for the moves to finish.
+    //Without a tool on command, M3 and M4 start cuts and M5 ends them, and travel is recognized the way the
+    //writer emits it: speed set to the travel speed, one move, and speed set again before the cut.
+    class Estimator {
+    private:
+        struct Block {
+            double length;
+            double speed; //Nominal
+            double maxEntry; //Limited by the corner with the previous block
+            double dx, dy; //Unit direction
+            bool cut;
+        };
+
+        Settings settings;
+        Result result;
+        deque<Block> blocks;
+        double speed = 0; //At the end of the last finished block
+        string line; //Incomplete line
+        string toolOn, toolOff;
+        bool toolEnabled = false;
+        size_t travelMoves = 0; //Since travel speed was set, if there is no tool on command
+        bool relative = false;
+        double x = 0, y = 0;
+        double speedLimit = 0; //From M203, mm/s
+        double feed = 0; //From F, mm/s
+
+        void parseLine(const char *begin, const char *end);
+        void addMove(double toX, double toY);
+        void finishBlock(); //Plans and finishes the oldest block
+        void synchronize(); //Finishes all blocks, stopping the machine
+
+    public:
+        Estimator(const Settings &settings);
+        void parse(const char *text, size_t length); //Text may end in the middle of a line
+        Result finish();
+    };
+
+    //Passes text on to another stream buffer and estimates time of the GCODE going through it.
+    //Text is passed in blocks, the stream has to be flushed when done.
+    class TeeBuffer : public streambuf {
+    private:
+        streambuf *target;
+        Estimator &estimator;
+        char buffer[1 << 14];
+        bool pass(); //Passes buffered text
+    protected:
+        int overflow(int c);
+        int sync();
+    public:
+        TeeBuffer(streambuf *target, Estimator &estimator);
+    };
+
+}
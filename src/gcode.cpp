@@ -0,0 +1,713 @@
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <math.h>
+#include <string.h>
+
+#include "gcode.h"
+#include "scheduler.h"
+#include "queue.h"
+#include "utils.h"
+#include "hatch.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace gcode {
+
+    using namespace std;
+
+    //Machine coordinates of a document point. SVG Y axis points down, machine Y axis points up.
+    static double machineX(const svg::Point &p, const Settings &settings) {
+        return p.x + settings.offsetX;
+    }
+
+    static double machineY(const svg::Point &p, const Settings &settings) {
+        return settings.bedHeight - (p.y - settings.offsetY);
+    }
+
+    Writer::Writer(const Settings &settings) : settings(settings) {
+        //Resolution is rounded to at most six decimals, so every coordinate has a short exact representation
+        double resolution = min(1.0, max(0.000001, settings.resolution));
+        decimals = 0;
+        while(decimals < 6 && abs(resolution * pow(10, decimals) - round(resolution * pow(10, decimals))) > 1e-9) decimals++;
+        stepUnits = max(1LL, llround(resolution * pow(10, decimals)));
+        step = stepUnits / pow(10, decimals);
+    }
+
+    void Writer::setPosition(const svg::Point &p) {
+        x = llround(machineX(p, settings) / step);
+        y = llround(machineY(p, settings) / step);
+        positioned = true;
+    }
+
+    //Writes axis letter and coordinate with as few characters as possible, like X-.5 for -0.50
+    void Writer::writeCoordinate(ostream &out, char axis, long long steps) {
+        long long units = steps * stepUnits;
+        char digits[32];
+        int length = snprintf(digits, sizeof(digits), "%0*lld", decimals + 1, units < 0 ? -units : units); //At least one whole digit
+        int whole = length - decimals, fraction = decimals;
+        while(fraction > 0 && digits[whole + fraction - 1] == '0') fraction--;
+        char text[40];
+        int n = 0;
+        text[n++] = axis;
+        if(units < 0) text[n++] = '-';
+        if(!(whole == 1 && digits[0] == '0' && fraction > 0)) {
+            memcpy(text + n, digits, whole);
+            n += whole;
+        }
+        if(fraction > 0) {
+            text[n++] = '.';
+            memcpy(text + n, digits + whole, fraction);
+            n += fraction;
+        }
+        out.write(text, n);
+    }
+
+    //Absolute move from whole steps, written like the compact dialect but with every axis and spaces
+    void Writer::writeAbsolute(ostream &out, const char *command, long long toX, long long toY) {
+        out << command;
+        writeCoordinate(out, 'X', toX);
+        out << ' ';
+        writeCoordinate(out, 'Y', toY);
+        x = toX;
+        y = toY;
+        positioned = true;
+    }
+
+    //Axes of a compact or relative command that change, both of them in absolute coordinates before the position is known
+    void Writer::writeAxes(ostream &out, long long toX, long long toY) {
+        bool offset = settings.dialect == relative && positioned;
+        if(toX != x || !positioned) writeCoordinate(out, 'X', offset ? toX - x : toX);
+        if(toY != y || !positioned) writeCoordinate(out, 'Y', offset ? toY - y : toY);
+    }
+
+    //Called after a compact or relative command is written
+    void Writer::moved(ostream &out, long long toX, long long toY) {
+        if(!positioned && settings.dialect == relative) comment(out, "G91", "Relative positioning");
+        x = toX;
+        y = toY;
+        positioned = true;
+    }
+
+    void Writer::move(ostream &out, const svg::Point &p) {
+        if(settings.dialect == absolute && !settings.quantize) {
+            out << "G1 X" << machineX(p, settings) << " Y" << machineY(p, settings) << "\n";
+            return;
+        }
+        long long toX = llround(machineX(p, settings) / step), toY = llround(machineY(p, settings) / step);
+        if(settings.dialect == absolute) {
+            writeAbsolute(out, "G1 ", toX, toY);
+            out << '\n';
+            return;
+        }
+        if(positioned && toX == x && toY == y) return;
+        out << "G1";
+        writeAxes(out, toX, toY);
+        out << '\n';
+        moved(out, toX, toY);
+    }
+
+    void Writer::arc(ostream &out, const svg::Point &start, const svg::Point &end, const svg::Point &center, bool clockwise) {
+        if(settings.dialect == absolute && !settings.quantize) {
+            out << (clockwise ? "G2 X" : "G3 X") << machineX(end, settings) << " Y" << machineY(end, settings);
+            out << " I" << (center.x - start.x) << " J" << (start.y - center.y) << "\n";
+            return;
+        }
+        if(!positioned) move(out, start); //Center is relative to the tool position
+        //Center is rounded like the end points, so the controller sees the same radius at both ends
+        long long toX = llround(machineX(end, settings) / step), toY = llround(machineY(end, settings) / step);
+        long long i = llround(machineX(center, settings) / step) - x, j = llround(machineY(center, settings) / step) - y;
+        if(toX == x && toY == y) return; //Arcs are never full circles, so this one is too short to cut
+        if(i == 0 && j == 0) {
+            move(out, end);
+            return;
+        }
+        if(settings.dialect == absolute) {
+            writeAbsolute(out, clockwise ? "G2 " : "G3 ", toX, toY);
+            out << ' ';
+            writeCoordinate(out, 'I', i);
+            out << ' ';
+            writeCoordinate(out, 'J', j);
+            out << '\n';
+            return;
+        }
+        out << (clockwise ? "G2" : "G3");
+        writeAxes(out, toX, toY);
+        if(i != 0) writeCoordinate(out, 'I', i);
+        if(j != 0) writeCoordinate(out, 'J', j);
+        out << '\n';
+        moved(out, toX, toY);
+    }
+
+    void Writer::rasterMove(ostream &out, const svg::Point &p, double power) {
+        if(settings.dialect == absolute && !settings.quantize) {
+            out << "G1 X" << machineX(p, settings) << " Y" << machineY(p, settings);
+            out << " S" << power << "\n";
+            return;
+        }
+        long long toX = llround(machineX(p, settings) / step), toY = llround(machineY(p, settings) / step);
+        if(settings.dialect == absolute) {
+            writeAbsolute(out, "G1 ", toX, toY);
+            out << " S" << power << '\n';
+            return;
+        }
+        if(positioned && toX == x && toY == y) return;
+        out << "G1";
+        writeAxes(out, toX, toY);
+        out << 'S' << power << '\n';
+        moved(out, toX, toY);
+    }
+
+    void Writer::speed(ostream &out, double speed) {
+        if(settings.dialect == absolute) out << "M203 X" << speed << " Y" << speed << "\n";
+        else out << "M203X" << speed << 'Y' << speed << '\n';
+    }
+
+    void Writer::command(ostream &out, const string &gcode) {
+        if(!settings.stripComments) {
+            out << gcode << "\n";
+            return;
+        }
+        size_t begin = 0;
+        while(begin <= gcode.length()) {
+            size_t end = gcode.find('\n', begin);
+            if(end == string::npos) end = gcode.length();
+            size_t last = min(end, gcode.find(';', begin));
+            while(last > begin && (gcode[last - 1] == ' ' || gcode[last - 1] == '\t' || gcode[last - 1] == '\r')) last--;
+            if(last > begin) out << gcode.substr(begin, last - begin) << '\n';
+            begin = end + 1;
+        }
+    }
+
+    void Writer::comment(ostream &out, const string &command, const string &comment) {
+        if(settings.stripComments) out << command << '\n';
+        else out << command << " ; " << comment << "\n";
+    }
+
+    toolpath::Settings toolpathSettings(const Settings &settings) {
+        toolpath::Settings result;
+        result.joinTolerance = settings.joinTolerance;
+        result.travelSpeed = settings.travelSpeed;
+        result.workingSpeed = settings.workingSpeed;
+        return result;
+    }
+
+    const size_t estimate_comment_size = 200;
+
+    estimate::Settings estimateSettings(const Settings &settings) {
+        estimate::Settings result;
+        result.acceleration = settings.acceleration;
+        result.junctionDeviation = settings.junctionDeviation;
+        result.maxSpeed = settings.maxSpeed;
+        result.toolOnGcode = settings.toolOnGcode;
+        result.toolOffGcode = settings.toolOffGcode;
+        result.travelSpeed = settings.travelSpeed;
+        return result;
+    }
+
+    //Leaves an empty comment line for the estimate, if the output can be rewritten and comments are kept.
+    //Returns its position or -1.
+    static streampos reserveEstimate(ostream &out, const Settings &settings) {
+        if(settings.stripComments) return streampos(-1);
+        streampos position = out.tellp();
+        if(position != streampos(-1)) out << ";" << string(estimate_comment_size - 2, ' ') << "\n";
+        return position;
+    }
+
+    static void writeEstimate(ostream &out, streampos position, const estimate::Result &result) {
+        if(position == streampos(-1) || !out) return;
+        string comment = "; " + estimate::describe(result);
+        comment.resize(estimate_comment_size - 1, ' ');
+        streampos end = out.tellp();
+        out.seekp(position);
+        out << comment;
+        out.seekp(end);
+    }
+
+    static void writeHeader(ostream &out, Writer &writer) {
+        const Settings &settings = writer.getSettings();
+        writer.comment(out, "G21", "Metric system");
+        writer.comment(out, "G90", "Absolute positioning");
+        writer.comment(out, "G28", "Home all axes");
+        writer.command(out, settings.startGcode);
+        writer.command(out, settings.toolOffGcode); //Relative positioning is switched on by the writer after the first move
+    }
+
+    //End GCODE of the profile is written in absolute positioning
+    static void writeFooter(ostream &out, Writer &writer) {
+        const Settings &settings = writer.getSettings();
+        if(settings.dialect == relative) writer.comment(out, "G90", "Absolute positioning");
+        if(settings.stripComments) writer.command(out, settings.endGcode);
+        else out << settings.endGcode;
+    }
+
+    //Kept in range of int, so arrays too large to cut are rejected by arrayOffsets with the count as written
+    static int parseCount(const string &text) {
+        return static_cast<int>(min(max(parseDouble(text), 0.0), 1e9));
+    }
+
+    bool loadSettings(const string &path, Settings &settings) {
+        ifstream config(path, ios::binary);
+        if(!config.good()) return false;
+        vector<string> strings(1);
+        char c;
+        while(config.get(c)) {
+            if(c == '\036') strings.push_back(string());
+            else strings.back().push_back(c);
+        }
+        strings.pop_back(); //Every value is terminated with a separator
+
+        if(strings.size() < 10) return false;
+        Settings loaded;
+        try {
+            loaded.offsetX = parseDouble(strings[0]);
+            loaded.offsetY = parseDouble(strings[1]);
+            loaded.bedWidth = parseDouble(strings[2]);
+            loaded.bedHeight = parseDouble(strings[3]);
+            loaded.travelSpeed = parseDouble(strings[4]);
+            loaded.workingSpeed = parseDouble(strings[5]);
+            if(strings.size() > 12) {
+                loaded.rasterSpacing = parseDouble(strings[10]);
+                loaded.rasterPower = parseDouble(strings[11]);
+                loaded.rasterMode = static_cast<int>(parseDouble(strings[12]));
+            }
+            if(strings.size() > 14) {
+                loaded.hatchSpacing = parseDouble(strings[13]);
+                loaded.hatchAngle = parseDouble(strings[14]);
+            }
+            if(strings.size() > 15) loaded.duplicateTolerance = parseDouble(strings[15]);
+            if(strings.size() > 16) loaded.joinTolerance = parseDouble(strings[16]);
+            if(strings.size() > 19) {
+                loaded.acceleration = parseDouble(strings[17]);
+                loaded.junctionDeviation = parseDouble(strings[18]);
+                loaded.maxSpeed = parseDouble(strings[19]);
+            }
+            if(strings.size() > 22) {
+                loaded.dialect = static_cast<int>(parseDouble(strings[20]));
+                loaded.resolution = parseDouble(strings[21]);
+                loaded.stripComments = parseDouble(strings[22]) != 0;
+            }
+            if(strings.size() > 24) {
+                loaded.orderPaths = parseDouble(strings[23]) != 0;
+                loaded.simplifyTolerance = parseDouble(strings[24]);
+            }
+            if(strings.size() > 29) {
+                loaded.arrayRows = parseCount(strings[25]);
+                loaded.arrayColumns = parseCount(strings[26]);
+                loaded.arrayPitchX = parseDouble(strings[27]);
+                loaded.arrayPitchY = parseDouble(strings[28]);
+                loaded.arraySerpentine = parseDouble(strings[29]) != 0;
+            }
+            if(strings.size() > 30) loaded.quantize = parseDouble(strings[30]) != 0;
+        } catch(invalid_argument& e) {
+            return false;
+        }
+        loaded.startGcode = strings[6];
+        loaded.endGcode = strings[7];
+        loaded.toolOnGcode = strings[8];
+        loaded.toolOffGcode = strings[9];
+        settings = loaded;
+        return true;
+    }
+
+    bool saveSettings(const string &path, const Settings &settings) {
+        fstream config;
+        config.open(path, ios::out);
+        if(!config.good()) return false;
+        config << settings.offsetX << "\036";
+        config << settings.offsetY << "\036";
+        config << settings.bedWidth << "\036";
+        config << settings.bedHeight << "\036";
+        config << settings.travelSpeed << "\036";
+        config << settings.workingSpeed << "\036";
+        config << settings.startGcode << "\036";
+        config << settings.endGcode << "\036";
+        config << settings.toolOnGcode << "\036";
+        config << settings.toolOffGcode << "\036";
+        config << settings.rasterSpacing << "\036";
+        config << settings.rasterPower << "\036";
+        config << settings.rasterMode << "\036";
+        config << settings.hatchSpacing << "\036";
+        config << settings.hatchAngle << "\036";
+        config << settings.duplicateTolerance << "\036";
+        config << settings.joinTolerance << "\036";
+        config << settings.acceleration << "\036";
+        config << settings.junctionDeviation << "\036";
+        config << settings.maxSpeed << "\036";
+        config << settings.dialect << "\036";
+        config << settings.resolution << "\036";
+        config << settings.stripComments << "\036";
+        config << settings.orderPaths << "\036";
+        config << settings.simplifyTolerance << "\036";
+        config << settings.arrayRows << "\036";
+        config << settings.arrayColumns << "\036";
+        config << settings.arrayPitchX << "\036";
+        config << settings.arrayPitchY << "\036";
+        config << settings.arraySerpentine << "\036";
+        config << settings.quantize << "\036";
+        config.close();
+        return !config.fail();
+    }
+
+    static Settings normalize(const Settings &settings) {
+        Settings result = settings;
+        if(result.bedHeight < 10) result.bedHeight = 10;
+        if(result.dialect < absolute || result.dialect > relative) result.dialect = absolute;
+        return result;
+    }
+
+    vector<svg::Point> arrayOffsets(const Settings &settings) {
+        vector<svg::Point> offsets;
+        int rows = max(1, settings.arrayRows), columns = max(1, settings.arrayColumns);
+        string size = to_string(rows) + " x " + to_string(columns);
+        if(static_cast<long long>(rows) * columns > max_array_copies) {
+            throw invalid_argument("Array of " + size + " copies is larger than " + to_string(max_array_copies) + " copies");
+        }
+        if((columns - 1) * fabs(settings.arrayPitchX) > settings.bedWidth || (rows - 1) * fabs(settings.arrayPitchY) > settings.bedHeight) {
+            throw invalid_argument("Array of " + size + " copies doesn't fit on the bed");
+        }
+        for(int row = 0 ; row < rows ; row++) {
+            for(int i = 0 ; i < columns ; i++) {
+                int column = settings.arraySerpentine && row % 2 == 1 ? columns - 1 - i : i;
+                offsets.push_back({column * settings.arrayPitchX, -row * settings.arrayPitchY});
+            }
+        }
+        return offsets;
+    }
+
+    //Returns true and builds hatch lines if the path has to be filled
+    static bool hatchFill(svg::Path &path, const Settings &settings, svg::Path &hatching) {
+        if(settings.hatchSpacing <= 0 || !path.getFill().filled()) return false;
+        hatch::Settings hatchSettings;
+        hatchSettings.spacing = settings.hatchSpacing;
+        hatchSettings.angle = settings.hatchAngle;
+        hatching = hatch::hatchPath(path, hatchSettings);
+        return true;
+    }
+
+    static void addImages(toolpath::Toolpath &toolpath, const vector<svg::Image> &images, const Settings &settings) {
+        if(settings.rasterSpacing <= 0) return;
+        for(const svg::Image &image : images) toolpath::addImage(toolpath, image, settings.rasterSpacing, settings.rasterMode);
+    }
+
+    //Hatching of a path precedes its outline, in the same group
+    static void addPath(toolpath::Toolpath &toolpath, svg::Path &path, size_t group, const Settings &settings, svg::Path &hatching) {
+        if(hatchFill(path, settings, hatching)) toolpath::addPath(toolpath, hatching, group);
+        toolpath::addPath(toolpath, path, group);
+    }
+
+    const size_t piece_paths = 256;
+    const size_t range_cuts = 4096;
+
+    void buildToolpath(svg::Document &document, const Settings &settings, toolpath::Toolpath &toolpath) {
+        TRACE_SPAN("build toolpath", document.paths.size());
+        vector<svg::Path> &paths = document.paths;
+        toolpath.clear();
+        addImages(toolpath, document.images, settings);
+
+        //Paths are independent, so pieces of them are flattened by whichever worker is free and appended in order
+        vector<toolpath::Toolpath> pieces((paths.size() + piece_paths - 1) / piece_paths);
+        scheduler::parallelFor(0, pieces.size(), [&](size_t begin, size_t end) {
+            TRACE_SPAN("flatten", (end - begin) * piece_paths);
+            svg::Path hatching;
+            for(size_t p = begin ; p < end ; p++) {
+                for(size_t i = p * piece_paths ; i < min(paths.size(), (p + 1) * piece_paths) ; i++) {
+                    addPath(pieces[p], paths[i], i + 1, settings, hatching);
+                }
+                STATS_COUNT(pointsFlattened, pieces[p].points.size());
+            }
+        }, 1);
+        for(toolpath::Toolpath &piece : pieces) {
+            toolpath.append(piece);
+            piece = toolpath::Toolpath();
+        }
+    }
+
+    void createPasses(const Settings &settings, toolpath::PassManager &passes) {
+        if(settings.quantize) { //Grid of machine coordinates, see machineX and machineY
+            passes.add(new toolpath::QuantizePass(Writer(settings).getStep(), {-settings.offsetX, settings.bedHeight + settings.offsetY}));
+        }
+        if(settings.orderPaths) {
+            passes.add(new toolpath::JoinPass(settings.joinTolerance));
+            passes.add(new toolpath::OrderPass());
+        }
+        if(settings.simplifyTolerance > 0) passes.add(new toolpath::SimplifyPass(settings.simplifyTolerance));
+    }
+
+    estimate::Result exportPaths(svg::Document &document, const Settings &s, ostream &output) {
+        STATS_TIMER(exportGcode);
+        Settings settings = normalize(s);
+        vector<svg::Point> offsets = arrayOffsets(settings); //Checked before anything is written
+        streampos comment = reserveEstimate(output, settings);
+        estimate::Estimator estimator(estimateSettings(settings));
+        estimate::TeeBuffer tee(output.rdbuf(), estimator);
+        ostream out(&tee);
+        Writer headerWriter(settings);
+        writeHeader(out, headerWriter);
+        out.flush(); //Controller fed through the output homes while the toolpath is built
+
+        toolpath::Toolpath toolpath;
+        buildToolpath(document, settings, toolpath);
+        toolpath::PassManager passes;
+        createPasses(settings, passes);
+        passes.run(toolpath);
+
+        //Ranges of cuts are formatted in parallel, for every copy of an array. Every range starts from the state the
+        //cut before it leaves, the last cut of the previous copy for the first range of a copy, so the text is the
+        //same as if it was formatted in one go. Ranges are written as soon as those before them are, so a controller
+        //fed through the output starts on the first one while the others are formatted.
+        toolpath::Settings motion = toolpathSettings(settings);
+        size_t cuts = toolpath.cuts.size();
+        size_t ranges = max<size_t>(1, (cuts + range_cuts - 1) / range_cuts);
+        vector<string> texts(ranges * offsets.size());
+        vector<bool> formatted(texts.size(), false);
+        mutex formattedLock;
+        condition_variable formattedChanged;
+        exception_ptr error;
+        scheduler::ThreadPool &pool = scheduler::ThreadPool::shared();
+        scheduler::TaskGroup group(pool);
+        for(size_t t = 0 ; t < texts.size() ; t++) {
+            group.run([&, t]() {
+                TRACE_SPAN("format", range_cuts);
+                try {
+                    ostringstream text;
+                    Writer writer(settings);
+                    size_t copy = t / ranges, first = (t % ranges) * range_cuts, last = min(cuts, first + range_cuts);
+                    GcodeEmitter emitter(text, writer);
+                    bool continued = first == 0 && copy > 0; //From the end of the previous copy
+                    toolpath::State state = toolpath::stateBefore(toolpath, continued ? cuts : first);
+                    toolpath::OffsetEmitter shifted(emitter, offsets[continued ? copy - 1 : copy]);
+                    if(first > 0 || continued) writer.setPosition(shifted.shift(state.last));
+                    if(continued) shifted.setOffset(offsets[copy], state);
+                    toolpath::Emitter &target = copy > 0 ? static_cast<toolpath::Emitter&>(shifted) : emitter;
+                    toolpath::emit(toolpath, first, last, motion, state, target);
+                    if(t + 1 == texts.size()) toolpath::finish(state, target);
+                    texts[t] = text.str();
+                } catch(...) {
+                    lock_guard<mutex> guard(formattedLock);
+                    if(!error) error = current_exception();
+                }
+                lock_guard<mutex> guard(formattedLock);
+                formatted[t] = true;
+                formattedChanged.notify_all();
+            });
+        }
+
+        {
+            TRACE_SPAN("write", texts.size());
+            for(size_t t = 0 ; t < texts.size() && out ; t++) {
+                //Helps formatting while waiting, like TaskGroup::wait
+                bool ready = false, failed = false;
+                while(!ready && !failed) {
+                    if(pool.runPending()) continue;
+                    unique_lock<mutex> guard(formattedLock);
+                    formattedChanged.wait_for(guard, chrono::milliseconds(1), [&]() {return formatted[t] || error;});
+                    ready = formatted[t];
+                    failed = error != nullptr;
+                }
+                if(!ready) break;
+                out << texts[t];
+                string().swap(texts[t]);
+                if(t == 0) out.flush();
+            }
+            if(!out) group.cancel();
+        }
+        group.wait();
+        if(error) rethrow_exception(error);
+        toolpath = toolpath::Toolpath();
+
+        writeFooter(out, headerWriter);
+        {
+            TRACE_SPAN("flush");
+            out.flush();
+        }
+        if(!out) output.setstate(ios::badbit);
+        estimate::Result result = estimator.finish();
+        writeEstimate(output, comment, result);
+        return result;
+    }
+
+    svg::Path* StreamReader::next() {
+        svg::Path *path = new svg::Path();
+        try {
+            if(parser.next(*path)) return path;
+        } catch(...) {
+            delete path;
+            throw;
+        }
+        delete path;
+        return nullptr;
+    }
+
+    const size_t batch_points = 8192;
+    const size_t text_chunk_size = 1 << 16;
+    const size_t first_text_chunk_size = 1 << 10; //Written and flushed early, so a controller fed through the output starts right away
+    const size_t queue_capacity = 16;
+
+    estimate::Result exportPipelined(PathReader &reader, const Settings &s, ostream &output, const vector<svg::Image> &images) {
+        STATS_TIMER(exportGcode);
+        Settings settings = normalize(s);
+        vector<svg::Point> offsets = arrayOffsets(settings); //Checked before the stages start
+        SpscQueue<svg::Path*> pathQueue(queue_capacity * 4);
+        SpscQueue<toolpath::Toolpath> batchQueue(queue_capacity);
+        SpscQueue<string> textQueue(queue_capacity);
+
+        mutex errorLock;
+        exception_ptr error;
+        auto cancel = [&]() { //Stops every stage
+            pathQueue.cancel();
+            batchQueue.cancel();
+            textQueue.cancel();
+        };
+        auto fail = [&]() {
+            lock_guard<mutex> guard(errorLock);
+            if(!error) error = current_exception();
+            cancel();
+        };
+
+        //Reading (and parsing, if the reader does it) paths
+        thread readStage([&]() {
+            TRACE_THREAD("read");
+            TRACE_SPAN("read paths");
+            try {
+                for(svg::Path *path = reader.next() ; path ; path = reader.next()) {
+                    if(!pathQueue.push(move(path))) {
+                        reader.release(path);
+                        break;
+                    }
+                }
+                pathQueue.finish();
+            } catch(...) {
+                fail();
+            }
+        });
+
+        //Transforming and flattening paths into batches of toolpath, which passes run over
+        thread flattenStage([&]() {
+            TRACE_THREAD("flatten");
+            TRACE_SPAN("flatten");
+            try {
+                toolpath::PassManager passes;
+                createPasses(settings, passes);
+                toolpath::Toolpath batch;
+                svg::Path *path = nullptr;
+                svg::Path hatching;
+                size_t group = 1;
+                while(pathQueue.pop(path)) {
+                    try {
+                        addPath(batch, *path, group++, settings, hatching);
+                    } catch(...) {
+                        reader.release(path);
+                        throw;
+                    }
+                    reader.release(path);
+                    if(batch.points.size() >= batch_points) {
+                        STATS_COUNT(pointsFlattened, batch.points.size());
+                        passes.run(batch);
+                        if(!batchQueue.push(move(batch))) break;
+                        batch = toolpath::Toolpath();
+                    }
+                }
+                STATS_COUNT(pointsFlattened, batch.points.size());
+                if(!batch.cuts.empty()) {
+                    passes.run(batch);
+                    batchQueue.push(move(batch));
+                }
+                batchQueue.finish();
+            } catch(...) {
+                fail();
+            }
+        });
+
+        //Formatting text, which is the only stage that has to know the previous cut
+        thread formatStage([&]() {
+            TRACE_THREAD("format");
+            try {
+                ostringstream text;
+                Writer writer(settings);
+                GcodeEmitter emitter(text, writer);
+                toolpath::Settings motion = toolpathSettings(settings);
+                toolpath::State state;
+                vector<toolpath::Toolpath> kept; //Batches emitted again for the other copies of an array
+                toolpath::Toolpath batch;
+                addImages(batch, images, settings);
+                toolpath::emit(batch, 0, batch.cuts.size(), motion, state, emitter);
+                if(offsets.size() > 1) kept.push_back(move(batch));
+                bool cancelled = false;
+                size_t chunkSize = first_text_chunk_size;
+                while(batchQueue.pop(batch)) {
+                    TRACE_SPAN("format batch", batch.cuts.size());
+                    toolpath::emit(batch, 0, batch.cuts.size(), motion, state, emitter);
+                    if(offsets.size() > 1) kept.push_back(move(batch));
+                    if(static_cast<size_t>(text.tellp()) >= chunkSize) {
+                        if(!textQueue.push(text.str())) {
+                            cancelled = true;
+                            break;
+                        }
+                        text.str(string());
+                        chunkSize = text_chunk_size;
+                    }
+                }
+                toolpath::OffsetEmitter shifted(emitter, offsets[0]);
+                for(size_t copy = 1 ; copy < offsets.size() && !cancelled ; copy++) {
+                    TRACE_SPAN("format copy", kept.size());
+                    shifted.setOffset(offsets[copy], state);
+                    for(size_t i = 0 ; i < kept.size() && !cancelled ; i++) {
+                        toolpath::emit(kept[i], 0, kept[i].cuts.size(), motion, state, shifted);
+                        if(static_cast<size_t>(text.tellp()) >= chunkSize) {
+                            cancelled = !textQueue.push(text.str());
+                            text.str(string());
+                            chunkSize = text_chunk_size;
+                        }
+                    }
+                }
+                if(offsets.size() > 1) toolpath::finish(state, shifted);
+                else toolpath::finish(state, emitter);
+                writeFooter(text, writer);
+                textQueue.push(text.str());
+                textQueue.finish();
+            } catch(...) {
+                fail();
+            }
+        });
+
+        //Writing and estimating on the calling thread
+        estimate::Estimator estimator(estimateSettings(settings));
+        streampos comment;
+        try {
+            comment = reserveEstimate(output, settings);
+            estimate::TeeBuffer tee(output.rdbuf(), estimator);
+            ostream out(&tee);
+            Writer headerWriter(settings);
+            writeHeader(out, headerWriter);
+            out.flush();
+            string text;
+            for(bool first = true ; out && textQueue.pop(text) ; first = false) {
+                TRACE_SPAN("write", text.size());
+                out << text;
+                if(first) out.flush();
+            }
+            if(!out) cancel(); //Nothing more can be written, so the document isn't read any further
+            TRACE_SPAN("flush");
+            out.flush();
+            if(!out) output.setstate(ios::badbit);
+        } catch(...) {
+            fail();
+        }
+
+        readStage.join();
+        flattenStage.join();
+        formatStage.join();
+
+        //Paths left in the queue when a stage failed or was cancelled
+        svg::Path *path;
+        while(pathQueue.pop(path)) reader.release(path);
+        if(error) rethrow_exception(error);
+        estimate::Result result = estimator.finish();
+        writeEstimate(output, comment, result);
+        return result;
+    }
+
+}
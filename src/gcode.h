@@ -0,0 +1,165 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "svg.h"
+#include "estimate.h"
+#include "toolpath.h"
+
+namespace gcode {
+
+    using namespace std;
+
+    //How coordinates are written. Compact and relative dialects round them to the resolution, leave out axes
+    //that don't change and spaces, which makes moves about half as long.
+    enum Dialect {absolute = 0, compact = 1, relative = 2};
+
+    //Machine profile used while generating GCODE
+    struct Settings {
+        double offsetX = 0;
+        double offsetY = 0;
+        double bedWidth = 220;
+        double bedHeight = 220;
+        double travelSpeed = 800;
+        double workingSpeed = 400;
+        string startGcode;
+        string endGcode;
+        string toolOnGcode;
+        string toolOffGcode;
+        double rasterSpacing = 0.1; //Distance between engraved lines, 0 disables engraving of images
+        double rasterPower = 255; //Value of S parameter for black pixels
+        int rasterMode = 1; //Threshold, dither or grayscale, see raster::Mode
+        double hatchSpacing = 0; //Distance between lines filling closed shapes, 0 cuts outlines only
+        double hatchAngle = 45; //Degrees
+        double duplicateTolerance = 0.01; //Segments closer than that are cut once, 0 keeps duplicates
+        double joinTolerance = 0.07; //Largest gap cut through without turning the tool off, also used to join paths
+        double acceleration = 1000; //mm/s^2, used only to estimate job time
+        double junctionDeviation = 0.01; //mm
+        double maxSpeed = 0; //mm/s, 0 if the firmware doesn't limit speed below M203
+        int dialect = absolute; //See gcode::Dialect
+        double resolution = 0.01; //mm, step coordinates of compact and relative dialects are rounded to
+        bool stripComments = false; //Leaves out comments, including those in GCODE of the profile
+        bool orderPaths = false; //Cuts paths in order of the nearest start instead of document order
+        double simplifyTolerance = 0; //mm, largest deviation of simplified curves, 0 keeps every sampled point
+        int arrayRows = 1; //Copies of the drawing cut in a grid, stepping right and up the bed
+        int arrayColumns = 1;
+        double arrayPitchX = 0; //mm between columns
+        double arrayPitchY = 0; //mm between rows
+        bool arraySerpentine = false; //Every other row is cut right to left, so travel between rows is short
+        bool quantize = false; //Rounds the toolpath to the resolution before passes, absolute coordinates are written from whole steps
+    };
+
+    //Machine profile is stored in a file of values separated with record separator characters.
+    //Values added later are optional, so older files can still be loaded.
+    bool loadSettings(const string &path, Settings &settings);
+    bool saveSettings(const string &path, const Settings &settings);
+
+    //Writes commands in the dialect of the settings. Points are in document coordinates. Compact and relative
+    //dialects need the position of the tool, which is kept in steps of the resolution so rounding doesn't add up.
+    //Start GCODE of the profile may leave the tool anywhere, so the first move is written with both axes in
+    //absolute positioning, and relative positioning is switched on after it.
+    class Writer {
+    private:
+        const Settings &settings;
+        long long x = 0, y = 0; //Tool position in steps, machine coordinates
+        bool positioned = false; //Position is known, set by the first move or by setPosition
+        double step; //Resolution, a multiple of 10^-decimals
+        long long stepUnits; //Resolution in units of 10^-decimals
+        int decimals;
+
+        void writeCoordinate(ostream &out, char axis, long long steps);
+        void writeAbsolute(ostream &out, const char *command, long long toX, long long toY);
+        void writeAxes(ostream &out, long long toX, long long toY);
+        void moved(ostream &out, long long toX, long long toY);
+    public:
+        Writer(const Settings &settings);
+        const Settings& getSettings() const {return settings;};
+        double getStep() const {return step;};
+        void setPosition(const svg::Point &p); //Tool is known to be at the point
+        void move(ostream &out, const svg::Point &p);
+        void arc(ostream &out, const svg::Point &start, const svg::Point &end, const svg::Point &center, bool clockwise);
+        void rasterMove(ostream &out, const svg::Point &p, double power); //Move with laser power set by S
+        void speed(ostream &out, double speed); //Maximum speed of both axes
+        void command(ostream &out, const string &gcode); //GCODE of the profile, followed by a line break
+        void comment(ostream &out, const string &command, const string &comment); //Command followed by a comment, unless comments are stripped
+    };
+
+    //Serializes a toolpath as GCODE through a writer
+    class GcodeEmitter : public toolpath::Emitter {
+    private:
+        ostream &out;
+        Writer &writer;
+    public:
+        GcodeEmitter(ostream &out, Writer &writer) : out(out), writer(writer) {};
+        void toolOn() {writer.command(out, writer.getSettings().toolOnGcode);};
+        void toolOff() {writer.command(out, writer.getSettings().toolOffGcode);};
+        void speed(double speed) {writer.speed(out, speed);};
+        void travel(const svg::Point &to) {writer.move(out, to);};
+        void line(const svg::Point &to) {writer.move(out, to);};
+        void arc(const svg::Point &start, const svg::Point &to, const svg::Point &center, bool clockwise) {writer.arc(out, start, to, center, clockwise);};
+        void raster(const svg::Point &to, double power) {writer.rasterMove(out, to, power * writer.getSettings().rasterPower);};
+    };
+
+    //Join tolerance and speeds of the profile
+    toolpath::Settings toolpathSettings(const Settings &settings);
+
+    //Builds toolpath of a document: engraving of images, then every path preceded by its hatching.
+    //Paths are flattened in parallel. Cuts of images are in group 0, those of path i in group i + 1.
+    void buildToolpath(svg::Document &document, const Settings &settings, toolpath::Toolpath &toolpath);
+
+    //Adds passes enabled in the profile
+    void createPasses(const Settings &settings, toolpath::PassManager &passes);
+
+    const int max_array_copies = 10000; //Mistyped counts are rejected instead of writing a huge file
+
+    //Offsets of the copies of an array in the order they are cut, in document coordinates. The first copy stays
+    //in place. Rows step up the bed, which is towards smaller Y in the document. Throws if the array has more than
+    //max_array_copies copies or its pitch steps past the bed.
+    vector<svg::Point> arrayOffsets(const Settings &settings);
+
+    //Motion limits of the machine, for estimating job time
+    estimate::Settings estimateSettings(const Settings &settings);
+
+    //Writes complete GCODE file, images first. The toolpath is built, passed through passes of the profile and
+    //emitted in ranges of cuts in parallel, so the output is identical to a serial run. Filled paths are hatched
+    //before their outline is cut. Copies of an array emit the same toolpath again through an offset.
+    //Returns estimated job time, which is also written at the top of the file if the output can be rewritten.
+    estimate::Result exportPaths(svg::Document &document, const Settings &settings, ostream &out);
+
+    //Supplies paths to the export pipeline one at a time
+    class PathReader {
+    public:
+        virtual ~PathReader() {};
+        virtual svg::Path* next() = 0; //Returns nullptr when there are no more paths
+        virtual void release(svg::Path*) {}; //Called when the pipeline no longer needs the path
+    };
+
+    //Reads paths from a vector owned by the caller
+    class VectorReader : public PathReader {
+    private:
+        vector<svg::Path> &paths;
+        size_t index = 0;
+    public:
+        VectorReader(vector<svg::Path> &paths) : paths(paths) {};
+        svg::Path* next() {return index < paths.size() ? &paths[index++] : nullptr;};
+    };
+
+    //Parses paths from a stream while the pipeline is exporting the ones read before
+    class StreamReader : public PathReader {
+    private:
+        svg::StreamParser parser;
+    public:
+        StreamReader(istream &in) : parser(in) {};
+        svg::Path* next();
+        void release(svg::Path *path) {delete path;};
+    };
+
+    //Writes complete GCODE file in stages running on separate threads: reading paths, building batches of toolpath
+    //and running passes over them, formatting text and writing it. Stages are connected with bounded queues, so
+    //formatting overlaps writing and memory use does not depend on document size. Passes see one batch at a time,
+    //so without them the output is identical to exportPaths. Arrays keep the batches for the copies after the
+    //first, so their memory use grows with the toolpath.
+    estimate::Result exportPipelined(PathReader &reader, const Settings &settings, ostream &out, const vector<svg::Image> &images = vector<svg::Image>());
+
+}
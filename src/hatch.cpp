@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <math.h>
+
+#include "hatch.h"
+#include "toolpath.h"
+
+namespace hatch {
+
+    using namespace std;
+
+    const double contour_gap = 1e-6;
+
+    vector<vector<svg::Point>> contours(svg::Path &path) {
+        vector<vector<svg::Point>> result;
+        svg::Transformation transformation = path.getTransformation();
+        svg::Point last;
+        for(svg::PathElement *element : path) {
+            svg::Line *line = dynamic_cast<svg::Line*>(element);
+            svg::Point start = (line ? line->getP1() : element->getPoint(0)) * transformation;
+            if(result.empty() || abs(start.x - last.x) > contour_gap || abs(start.y - last.y) > contour_gap) {
+                result.push_back(vector<svg::Point> {start});
+            }
+            vector<svg::Point> &contour = result.back();
+            if(line) {
+                contour.push_back(line->getP2() * transformation);
+            } else { //Sampled like the outline, so fill and cut agree
+                svg::Point end = element->getPoint(1) * transformation;
+                size_t steps = toolpath::curveSteps(element, transformation, start, end);
+                for(size_t i = 1 ; i < steps ; i++) contour.push_back(element->getPoint(static_cast<double>(i) / steps) * transformation);
+                contour.push_back(end);
+            }
+            last = contour.back();
+        }
+        return result;
+    }
+
+    //Non-horizontal edge of a polygon, in coordinates where hatch lines are horizontal
+    struct Edge {
+        double yMin;
+        double yMax;
+        double x; //At yMin
+        double slope; //Change of x per unit of y
+        int winding; //Direction, for the nonzero rule
+    };
+
+    vector<Segment> scan(const vector<vector<svg::Point>> &polygons, bool evenOdd, const Settings &settings) {
+        vector<Segment> result;
+        if(settings.spacing <= 0) return result;
+        double s = sin(settings.angle * M_PI / 180), c = cos(settings.angle * M_PI / 180);
+
+        //Rotating the polygons, so that hatch lines become scanlines
+        vector<Edge> edges;
+        for(const vector<svg::Point> &polygon : polygons) {
+            for(size_t i = 0 ; i < polygon.size() ; i++) {
+                const svg::Point &p = polygon[i], &q = polygon[(i + 1) % polygon.size()];
+                svg::Point a {p.x * c + p.y * s, p.y * c - p.x * s};
+                svg::Point b {q.x * c + q.y * s, q.y * c - q.x * s};
+                if(a.y == b.y) continue;
+                int winding = a.y < b.y ? 1 : -1;
+                if(a.y > b.y) swap(a, b);
+                edges.push_back(Edge {a.y, b.y, a.x, (b.x - a.x) / (b.y - a.y), winding});
+            }
+        }
+        if(edges.empty()) return result;
+        sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {return a.yMin < b.yMin;});
+
+        //Scanlines lie halfway between multiples of spacing. Edges cover [yMin, yMax), so vertices are counted once.
+        vector<size_t> active;
+        vector<pair<double, int>> crossings;
+        vector<Segment> line;
+        size_t next = 0;
+        bool forward = true;
+        double spacing = settings.spacing;
+        for(long k = static_cast<long>(ceil(edges[0].yMin / spacing - 0.5)) ; ; k++) {
+            if(active.empty()) {
+                if(next == edges.size()) break;
+                k = max(k, static_cast<long>(ceil(edges[next].yMin / spacing - 0.5))); //Skipping empty space
+            }
+            double y = (k + 0.5) * spacing;
+            while(next < edges.size() && edges[next].yMin <= y) {
+                if(edges[next].yMax > y) active.push_back(next);
+                next++;
+            }
+            active.erase(remove_if(active.begin(), active.end(), [&](size_t i) {return edges[i].yMax <= y;}), active.end());
+
+            crossings.clear();
+            for(size_t i : active) crossings.push_back(make_pair(edges[i].x + (y - edges[i].yMin) * edges[i].slope, edges[i].winding));
+            sort(crossings.begin(), crossings.end());
+
+            line.clear();
+            int winding = 0;
+            double begin = 0;
+            for(pair<double, int> &crossing : crossings) {
+                bool wasInside = winding != 0;
+                winding = evenOdd ? (winding + 1) % 2 : winding + crossing.second;
+                bool inside = winding != 0;
+                if(inside && !wasInside) {
+                    begin = crossing.first;
+                } else if(wasInside && !inside && crossing.first > begin) {
+                    line.push_back(Segment {svg::Point {begin, y}, svg::Point {crossing.first, y}});
+                }
+            }
+            if(line.empty()) continue;
+
+            //Every other line is cut backwards
+            if(!forward) {
+                reverse(line.begin(), line.end());
+                for(Segment &segment : line) swap(segment.start, segment.end);
+            }
+            forward = !forward;
+            for(Segment &segment : line) {
+                svg::Point &a = segment.start, &b = segment.end;
+                result.push_back(Segment {svg::Point {a.x * c - a.y * s, a.x * s + a.y * c}, svg::Point {b.x * c - b.y * s, b.x * s + b.y * c}});
+            }
+        }
+        return result;
+    }
+
+    svg::Path hatchPath(svg::Path &path, const Settings &settings) {
+        shared_ptr<svg::Geometry> geometry = make_shared<svg::Geometry>();
+        for(Segment &segment : scan(contours(path), path.getFill().isEvenOdd(), settings)) {
+            geometry->push_back(new svg::Line(segment.start, segment.end));
+        }
+        svg::Fill fill;
+        fill.paint = 0; //Hatch lines are not filled again
+        return svg::Path(geometry, svg::Transformation(), fill);
+    }
+
+}
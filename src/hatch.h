@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include "svg.h"
+
+namespace hatch {
+
+    using namespace std;
+
+    struct Settings {
+        double spacing = 0.5; //Distance between hatch lines
+        double angle = 45; //Direction of hatch lines in degrees, counted from the X axis
+    };
+
+    struct Segment {
+        svg::Point start;
+        svg::Point end;
+    };
+
+    //Flattens a path into polygons in document coordinates, with curves sampled like the cut outline. Subpaths are
+    //closed implicitly, as when SVG fills them.
+    vector<vector<svg::Point>> contours(svg::Path &path);
+
+    //Finds parts of hatch lines lying inside of the polygons. Edges are swept with an active edge table,
+    //so time depends on the number of edges and lines rather than on their product. Lines are returned
+    //in serpentine order, every one starting close to where the previous one ended.
+    vector<Segment> scan(const vector<vector<svg::Point>> &polygons, bool evenOdd, const Settings &settings);
+
+    //Builds path of hatch lines filling a path, according to its fill rule. Coordinates are in the document,
+    //so the returned path has no transformation.
+    svg::Path hatchPath(svg::Path &path, const Settings &settings);
+
+}
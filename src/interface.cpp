@@ -1,17 +1,28 @@
 #include <math.h>
+#include <chrono>
 #include <fstream>
 #include <string>
 
 #include "interface.h"
 #include "resources.h"
 #include "utils.h"
+#include "scheduler.h"
+#include "optimize.h"
+#include "cache.h"
+#include "stats.h"
 
 using namespace std;
 
 const string Interface::windowName = "LaserWorks";
+const int Interface::reloadDelay = 200;
 
 Interface::Interface() {
-    this->paths = NULL;
+    this->document = NULL;
+    this->gcodeFile = NULL;
+    this->watcher = NULL;
+    this->batchThread = NULL;
+    this->batchTotal = 0;
+    this->gcodeView.scale = 0;
 
     int argc = 0;
     char **argv = NULL;
@@ -21,6 +32,7 @@ Interface::Interface() {
     
     builder->get_widget("root", this->window);
     builder->get_widget("drawing_area", this->drawingArea);
+    builder->get_widget("status_label", this->statusLabel);
     builder->get_widget("load_svg_button", this->loadSvgButton);
     builder->get_widget("export_gcode_button", this->exportGcodeButton);
     builder->get_widget("tree_view", this->propertiesTreeView);
@@ -30,6 +42,8 @@ Interface::Interface() {
     builder->get_widget("tool_off_gcode_text_view", this->toolOffGcodeTextView);
     builder->get_widget("load_svg_menu", this->loadSvgMenuItem);
     builder->get_widget("export_gcode_menu", this->exportGcodeMenuItem);
+    builder->get_widget("batch_export_menu", this->batchExportMenuItem);
+    builder->get_widget("open_gcode_menu", this->openGcodeMenuItem);
     builder->get_widget("exit_menu", this->exitMenuItem);
     builder->get_widget("about_menu", this->aboutMenuItem);
 
@@ -41,6 +55,11 @@ Interface::Interface() {
                 .connect(sigc::mem_fun(*this, &Interface::loadSvgButtonClicked));
     this->exportGcodeMenuItem->signal_activate()
                 .connect(sigc::mem_fun(*this, &Interface::exportGcodeButtonClicked));
+    this->batchExportMenuItem->signal_activate()
+                .connect(sigc::mem_fun(*this, &Interface::batchExportMenuClicked));
+    this->batchDispatcher.connect(sigc::mem_fun(*this, &Interface::batchProgress));
+    this->openGcodeMenuItem->signal_activate()
+                .connect(sigc::mem_fun(*this, &Interface::openGcodeMenuClicked));
     this->exitMenuItem->signal_activate()
                 .connect(sigc::mem_fun(*this->window, &Gtk::Window::close));
     this->drawingArea->signal_draw().connect(sigc::mem_fun(*this, &Interface::draw));
@@ -51,17 +70,9 @@ Interface::Interface() {
     this->refPropertiesListStore->signal_row_changed().connect(sigc::mem_fun(*this, &Interface::requestDraw));
 
     this->propertiesTreeView->append_column("Property", this->propertiesModel.m_col_property);
-    this->propertiesTreeView->append_column_numeric_editable("Value", this->propertiesModel.m_col_value, "%.0f");
-
-    if(!loadConfig()) {
-        //Default values
-        this->rowOffsetX = this->addProperty("Offset X (mm)", 0);
-        this->rowOffsetY = this->addProperty("Offset Y (mm)", 0);
-        this->rowBedWidth = this->addProperty("Bed width (mm)", 220);
-        this->rowBedHeight = this->addProperty("Bed height (mm)", 220);
-        this->rowTravelSpeed = this->addProperty("Travel speed (mm/s)", 800);
-        this->rowWorkingSpeed = this->addProperty("Working speed (mm/s)", 400);
-    }
+    this->propertiesTreeView->append_column_numeric_editable("Value", this->propertiesModel.m_col_value, "%g");
+
+    this->loadConfig();
 
     //Loading CSS
     auto css = Gtk::CssProvider::create();
@@ -84,8 +95,17 @@ Interface::Interface() {
 }
 
 Interface::~Interface() {
+    if(this->batchThread) { //Files already being converted are finished, so no partial output is left
+        this->batchToken.cancel();
+        this->batchThread->join();
+        delete this->batchThread;
+    }
+    this->watchConnection.disconnect();
+    this->reloadConnection.disconnect();
+    delete this->watcher;
     delete this->window;
-    delete this->paths;
+    delete this->document;
+    delete this->gcodeFile;
 }
 
 void Interface::run() {
@@ -107,7 +127,8 @@ void Interface::loadSvgButtonClicked() {
     if(result == Gtk::RESPONSE_OK) {
         string path = dialog.get_filename();
         try {
-            delete this->paths;
+            delete this->document;
+            this->document = NULL;
 
             int index = path.rfind('/');
             if(index == -1) index = path.rfind('\\');
@@ -115,9 +136,16 @@ void Interface::loadSvgButtonClicked() {
             string name = path.substr(index + 1);
             this->window->set_title(Interface::windowName + " - " + name);
 
-            this->paths = svg::loadPaths(path);
+            stats::reset();
+            this->document = cache::loadDocument(path);
+            this->statusLabel->set_text(stats::summary());
+            delete this->gcodeFile;
+            this->gcodeFile = NULL;
+            this->watchFile(path);
 
         } catch(exception const &e) { //Catching all exceptions and showing error to user
+            this->watchConnection.disconnect();
+            this->reloadConnection.disconnect();
             Gtk::MessageDialog messageDialog(*this->window, "Loading SVG file failed.", false, Gtk::MESSAGE_ERROR, Gtk::BUTTONS_OK);
             messageDialog.set_secondary_text(string(e.what()));
             messageDialog.set_icon(this->icon);
@@ -127,9 +155,42 @@ void Interface::loadSvgButtonClicked() {
     }
 }
 
-bool has_suffix(const std::string &str, const std::string &suffix) {
-    return str.size() >= suffix.size() &&
-           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+void Interface::watchFile(const string &path) {
+    this->watchConnection.disconnect();
+    this->reloadConnection.disconnect();
+    delete this->watcher;
+    this->watcher = NULL;
+    this->documentPath = path;
+    try {
+        this->watcher = new watch::FileWatcher(path);
+        this->watchConnection = Glib::signal_io().connect(sigc::mem_fun(*this, &Interface::fileChanged),
+                                                           this->watcher->getDescriptor(), Glib::IO_IN);
+    } catch(exception const &e) { //Document can still be used, it just isn't reloaded
+        this->statusLabel->set_text(string(e.what()));
+    }
+}
+
+bool Interface::fileChanged(Glib::IOCondition condition) {
+    if(this->watcher->changed()) {
+        //Saving may take several writes and renames, the file is reloaded once they settle
+        this->reloadConnection.disconnect();
+        this->reloadConnection = Glib::signal_timeout().connect(sigc::mem_fun(*this, &Interface::reloadDocument), Interface::reloadDelay);
+    }
+    return true;
+}
+
+bool Interface::reloadDocument() {
+    try {
+        stats::reset();
+        svg::Document *reloaded = cache::loadDocument(this->documentPath, this->document);
+        delete this->document;
+        this->document = reloaded;
+        this->statusLabel->set_text("Reloaded. " + stats::summary());
+        this->drawingArea->queue_draw();
+    } catch(exception const &e) { //Previous document stays until the file is saved correctly
+        this->statusLabel->set_text("Reloading failed: " + string(e.what()));
+    }
+    return false;
 }
 
 void Interface::exportGcodeButtonClicked() {
@@ -143,60 +204,33 @@ void Interface::exportGcodeButtonClicked() {
 
     int result = dialog.run();
     if(result == Gtk::RESPONSE_OK) {
-        const double step_size = 0.01;
-        const double acceptable_gap = 0.07;
-
         string path = dialog.get_filename();
-        string startGcode = this->startGcodeTextView->get_buffer()->get_text();
-        string endGcode = this->endGcodeTextView->get_buffer()->get_text();
-        string toolOnGcode = this->toolOnGcodeTextView->get_buffer()->get_text();
-        string toolOffGcode = this->toolOffGcodeTextView->get_buffer()->get_text();
+        gcode::Settings settings = this->getSettings();
         
         if(!has_suffix(path, ".gcode")) path += ".gcode";
         
         fstream file;
         file.open(path, ios::out);
-        file <<  "G21 ; Metric system\n";
-        file <<  "G90 ; Absolute positioning\n";
-        file <<  "G28 ; Home all axes\n";
-        file << startGcode << "\n";
-        file << toolOffGcode << "\n";
-        double offsetX = this->getRowValue(this->rowOffsetX);
-        double offsetY = this->getRowValue(this->rowOffsetY);
-        double bed_height = this->getRowValue(this->rowBedHeight);
-        double travelSpeed = this->getRowValue(this->rowTravelSpeed);
-        double workingSpeed = this->getRowValue(this->rowWorkingSpeed);
-        if(bed_height < 10) bed_height = 10;
-
-        bool toolEnabled = false;
-        svg::Point lastPoint = {0, 0};
-        for(svg::Path path : *this->paths) {
-            svg::Transformation transformation = path.getTransformation();
-            for(svg::PathElement *element : path) {
-                svg::Point start = element->getPoint(0) * transformation;
-                if(abs(lastPoint.x - start.x) > acceptable_gap || abs(lastPoint.y - start.y) > acceptable_gap) {
-                    if(toolEnabled) {
-                        file << toolOffGcode << "\n";
-                        toolEnabled = false;
-                    }
-                    file << "M203 X" << travelSpeed << " Y" << travelSpeed << "\n";
-                    file << "G1 X" << (start.x + offsetX) << " Y" << (bed_height - (start.y - offsetY)) << "\n";
-                }
-                if(!toolEnabled) {
-                    file << toolOnGcode << "\n";
-                    toolEnabled = true;
-                }
-                file << "M203 X" << workingSpeed << " Y" << workingSpeed << "\n";
-                for(double d = 0 ; d < 1 + step_size ; d += step_size) {
-                    svg::Point p = element->getPoint(d) * transformation;
-                    file << "G1 X" << (p.x + offsetX) << " Y" << (bed_height - (p.y - offsetY)) << "\n";
-                }
-                lastPoint = element->getPoint(1) * transformation;
-            }
+        svg::Document empty;
+        svg::Document &document = this->document ? *this->document : empty;
+        vector<svg::Path> paths = document.paths; //Geometries are shared, so the copy is cheap and the loaded document stays intact
+        optimize::Report report;
+        estimate::Result estimate;
+        gcode::VectorReader reader(paths);
+        stats::reset();
+        try {
+            report = optimize::removeDuplicates(paths, settings.duplicateTolerance, settings.hatchSpacing > 0);
+            optimize::joinPaths(paths, settings.joinTolerance, settings.hatchSpacing > 0);
+            estimate = gcode::exportPipelined(reader, settings, file, document.images);
+        } catch(exception const &e) {
+            file.close();
+            Gtk::MessageDialog messageDialog(*this->window, "Exporting GCODE file failed.", false, Gtk::MESSAGE_ERROR, Gtk::BUTTONS_OK);
+            messageDialog.set_icon(this->icon);
+            messageDialog.set_secondary_text(string(e.what()));
+            messageDialog.set_title("Error");
+            messageDialog.run();
+            return;
         }
-
-
-        file << endGcode;
         file.close();
         if(!file) {
             Gtk::MessageDialog messageDialog(*this->window, "Exporting GCODE file failed.", false, Gtk::MESSAGE_ERROR, Gtk::BUTTONS_OK);
@@ -204,11 +238,165 @@ void Interface::exportGcodeButtonClicked() {
             messageDialog.set_secondary_text("Output error");
             messageDialog.set_title("Error");
             messageDialog.run();
+        } else {
+            this->statusLabel->set_text(stats::summary());
+            string summary = estimate::describe(estimate) + ".";
+            if(report.removed > 0) {
+                summary += "\n" + to_string(report.removed) + " duplicate segments removed, cut is " + to_string(static_cast<int>(round(report.savedLength))) + " mm shorter.";
+            }
+            Gtk::MessageDialog messageDialog(*this->window, "GCODE file exported.", false, Gtk::MESSAGE_INFO, Gtk::BUTTONS_OK);
+            messageDialog.set_icon(this->icon);
+            messageDialog.set_secondary_text(summary);
+            messageDialog.set_title("Export");
+            messageDialog.run();
         }
     }
 
 }
 
+void Interface::batchExportMenuClicked() {
+    Gtk::FileChooserDialog dialog("Choose SVG files to export.", Gtk::FILE_CHOOSER_ACTION_OPEN);
+    dialog.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    dialog.add_button("_Open", Gtk::RESPONSE_OK);
+    dialog.set_select_multiple(true);
+    auto filter = Gtk::FileFilter::create();
+    filter->set_name("SVG files");
+    filter->add_pattern("*.svg");
+    dialog.add_filter(filter);
+    if(dialog.run() != Gtk::RESPONSE_OK) return;
+    vector<string> inputs = dialog.get_filenames();
+    dialog.hide();
+
+    Gtk::FileChooserDialog folderDialog("Choose a folder for GCODE files.", Gtk::FILE_CHOOSER_ACTION_SELECT_FOLDER);
+    folderDialog.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    folderDialog.add_button("_Select", Gtk::RESPONSE_OK);
+    if(folderDialog.run() != Gtk::RESPONSE_OK) return;
+    string directory = folderDialog.get_filename();
+
+    vector<batch::Job> jobs;
+    try {
+        jobs = batch::createJobs(inputs, directory);
+    } catch(exception const &e) {
+        Gtk::MessageDialog messageDialog(*this->window, "Batch export failed.", false, Gtk::MESSAGE_ERROR, Gtk::BUTTONS_OK);
+        messageDialog.set_secondary_text(string(e.what()));
+        messageDialog.set_icon(this->icon);
+        messageDialog.set_title("Error");
+        messageDialog.run();
+        return;
+    }
+
+    //One batch runs at a time, the menu item is enabled again when it is done
+    this->batchExportMenuItem->set_sensitive(false);
+    this->batchResults.clear();
+    this->batchSummary.clear();
+    this->batchTotal = jobs.size();
+    this->batchToken = scheduler::CancellationToken();
+    this->statusLabel->set_text("Exporting " + to_string(jobs.size()) + " files.");
+    gcode::Settings settings = this->getSettings();
+    this->batchThread = new thread([this, jobs, settings]() {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<batch::Result> results = batch::run(jobs, settings, 0, true, [this](const batch::Result &result) {
+            {
+                lock_guard<mutex> guard(this->batchLock);
+                this->batchResults.push_back(result);
+            }
+            this->batchDispatcher.emit();
+        }, this->batchToken);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        {
+            lock_guard<mutex> guard(this->batchLock);
+            this->batchSummary = batch::summary(results, elapsed);
+        }
+        this->batchDispatcher.emit();
+    });
+}
+
+//Runs on the main loop whenever the batch thread finished a file or the whole batch
+void Interface::batchProgress() {
+    string summary;
+    vector<batch::Result> results;
+    {
+        lock_guard<mutex> guard(this->batchLock);
+        summary = this->batchSummary;
+        results = this->batchResults;
+    }
+    if(summary.empty()) {
+        if(!results.empty()) {
+            this->statusLabel->set_text("Exported " + to_string(results.size()) + " of " + to_string(this->batchTotal) + " files. " + batch::describe(results.back()));
+        }
+        return;
+    }
+    if(!this->batchThread) return; //Summary was shown already
+    this->batchThread->join();
+    delete this->batchThread;
+    this->batchThread = NULL;
+    this->batchExportMenuItem->set_sensitive(true);
+    this->statusLabel->set_text(summary);
+
+    string failures;
+    for(const batch::Result &result : results) {
+        if(!result.converted) failures += "\n" + batch::describe(result);
+    }
+    Gtk::MessageDialog messageDialog(*this->window, "Batch export finished.", false, failures.empty() ? Gtk::MESSAGE_INFO : Gtk::MESSAGE_WARNING, Gtk::BUTTONS_OK);
+    messageDialog.set_icon(this->icon);
+    messageDialog.set_secondary_text(summary + "." + failures);
+    messageDialog.set_title("Batch Export");
+    messageDialog.run();
+}
+
+void Interface::openGcodeMenuClicked() {
+    Gtk::FileChooserDialog dialog("Choose a GCODE file.", Gtk::FILE_CHOOSER_ACTION_OPEN);
+    dialog.add_button("_Cancel", Gtk::RESPONSE_CANCEL);
+    dialog.add_button("_Open", Gtk::RESPONSE_OK);
+    auto filter = Gtk::FileFilter::create();
+    filter->set_name("GCODE files");
+    filter->add_pattern("*.gcode");
+    filter->add_pattern("*.nc");
+    dialog.add_filter(filter);
+
+    if(dialog.run() != Gtk::RESPONSE_OK) return;
+    string path = dialog.get_filename();
+    gcode::Settings settings = this->getSettings();
+    try {
+        viewer::GcodeFile *file = new viewer::GcodeFile(path, settings.toolOnGcode, settings.toolOffGcode);
+        delete this->gcodeFile;
+        this->gcodeFile = file;
+        this->gcodeView.scale = 0;
+        this->statusLabel->set_text(viewer::describe(file->getSummary()));
+        this->drawingArea->queue_draw();
+    } catch(exception const &e) {
+        Gtk::MessageDialog messageDialog(*this->window, "Opening GCODE file failed.", false, Gtk::MESSAGE_ERROR, Gtk::BUTTONS_OK);
+        messageDialog.set_secondary_text(string(e.what()));
+        messageDialog.set_icon(this->icon);
+        messageDialog.set_title("Error");
+        messageDialog.run();
+    }
+}
+
+//Draws the loaded GCODE file, cut moves over travel
+void Interface::drawGcode(const Cairo::RefPtr<Cairo::Context> &ctx, const viewer::View &view) {
+    if(view.scale != this->gcodeView.scale || view.originX != this->gcodeView.originX || view.originY != this->gcodeView.originY
+       || view.width != this->gcodeView.width || view.height != this->gcodeView.height) {
+        this->gcodeFile->render(view, this->gcodeCuts, this->gcodeTravels);
+        this->gcodeView = view;
+    }
+    auto stroke = [&ctx](const viewer::Polylines &lines) {
+        for(size_t i = 0 ; i < lines.starts.size() ; i++) {
+            size_t first = lines.starts[i];
+            size_t last = i + 1 < lines.starts.size() ? lines.starts[i + 1] : lines.points.size() / 2;
+            ctx->move_to(lines.points[first * 2], lines.points[first * 2 + 1]);
+            for(size_t j = first + 1 ; j < last ; j++) ctx->line_to(lines.points[j * 2], lines.points[j * 2 + 1]);
+        }
+        ctx->stroke();
+    };
+    ctx->set_line_width(0.5);
+    ctx->set_source_rgb(0.2, 0.5, 0.9);
+    stroke(this->gcodeTravels);
+    ctx->set_line_width(1.0);
+    ctx->set_source_rgb(0.7, 0.1, 0.1);
+    stroke(this->gcodeCuts);
+}
+
 bool Interface::draw(const Cairo::RefPtr<Cairo::Context> &ctx) {
     Gtk::Allocation allocation = this->drawingArea->get_allocation();
     const int width = allocation.get_width();
@@ -283,45 +471,78 @@ bool Interface::draw(const Cairo::RefPtr<Cairo::Context> &ctx) {
     //Draw paths
     ctx->set_line_width(1.0);
     ctx->set_source_rgb(0.7, 0.1, 0.1);
-    if(this->paths) {
-        for(int i = 0 ; i < this->paths->size() ; i++) {
-            svg::Path path = this->paths->at(i);
-
-            svg::Transformation t = svg::Translation(bedX + offset_x * bed_scale, bedY - offset_y * bed_scale) * svg::Scale(bed_scale, bed_scale) * path.getTransformation();
-            for(int j = 0 ; j < path.size() ; j++) {
-                svg::PathElement *element = path.at(j);
-                svg::CubicBezier *cb = dynamic_cast<svg::CubicBezier*>(element);
-                svg::QuadraticBezier *qb = dynamic_cast<svg::QuadraticBezier*>(element);
-                svg::Line *l = dynamic_cast<svg::Line*>(element);
-                if(cb) {
-                    svg::Point p1, p2, p3 ,p4;
-                    p1 = cb->getP1() * t;
-                    p2 = cb->getP2() * t;
-                    p3 = cb->getP3() * t;
-                    p4 = cb->getP4() * t;
-                    ctx->move_to(p1.x, p1.y);
-                    ctx->curve_to(p2.x, p2.y, p3.x, p3.y, p4.x, p4.y);
-                } else if(qb) {
-                    svg::Point p1, p2, p3;
-                    p1 = qb->getP1() * t;
-                    p2 = qb->getP2() * t;
-                    p3 = qb->getP3() * t;
-                    ctx->move_to(p1.x, p1.y);
-                    ctx->curve_to(
-                        p1.x + 2.0/3.0 * (p2.x - p1.x), p1.y + 2.0/3.0 * (p2.y - p1.y),
-                        p3.x + 2.0/3.0 * (p2.x - p3.x), p3.y + 2.0/3.0 * (p2.y - p3.y),
-                        p3.x, p3.y
-                    );
-                } else if(l) {
-                    svg::Point p1, p2;
-                    p1 = l->getP1() * t;
-                    p2 = l->getP2() * t;
-                    ctx->move_to(p1.x, p1.y);
-                    ctx->line_to(p2.x, p2.y);
+    if(this->gcodeFile) {
+        //Machine coordinates already include offsets, Y axis points up
+        viewer::View view {bedX, bedY + bed_height * bed_scale, bed_scale, width, height};
+        this->drawGcode(ctx, view);
+    } else if(this->document) {
+        //Transforming control points is done in parallel, Cairo calls have to stay on this thread
+        struct Segment {
+            bool line;
+            svg::Point p[4];
+        };
+        vector<svg::Path> &paths = this->document->paths;
+        vector<vector<Segment>> segments(paths.size());
+        svg::Transformation view = svg::Translation(bedX + offset_x * bed_scale, bedY - offset_y * bed_scale) * svg::Scale(bed_scale, bed_scale);
+        scheduler::parallelFor(0, paths.size(), [&](size_t begin, size_t end) {
+            for(size_t i = begin ; i < end ; i++) {
+                svg::Path &path = paths.at(i);
+                svg::Transformation t = view * path.getTransformation();
+                segments[i].reserve(path.size());
+                for(int j = 0 ; j < path.size() ; j++) {
+                    svg::PathElement *element = path.at(j);
+                    svg::CubicBezier *cb = dynamic_cast<svg::CubicBezier*>(element);
+                    svg::QuadraticBezier *qb = dynamic_cast<svg::QuadraticBezier*>(element);
+                    svg::Line *l = dynamic_cast<svg::Line*>(element);
+                    svg::Arc *a = dynamic_cast<svg::Arc*>(element);
+                    if(cb) {
+                        segments[i].push_back(Segment {false, {cb->getP1() * t, cb->getP2() * t, cb->getP3() * t, cb->getP4() * t}});
+                    } else if(qb) {
+                        svg::Point p1, p2, p3;
+                        p1 = qb->getP1() * t;
+                        p2 = qb->getP2() * t;
+                        p3 = qb->getP3() * t;
+                        segments[i].push_back(Segment {false, {
+                            p1,
+                            svg::Point {p1.x + 2.0/3.0 * (p2.x - p1.x), p1.y + 2.0/3.0 * (p2.y - p1.y)},
+                            svg::Point {p3.x + 2.0/3.0 * (p2.x - p3.x), p3.y + 2.0/3.0 * (p2.y - p3.y)},
+                            p3
+                        }});
+                    } else if(l) {
+                        segments[i].push_back(Segment {true, {l->getP1() * t, l->getP2() * t}});
+                    } else if(a) {
+                        for(svg::CubicBezier &bezier : a->toBeziers()) {
+                            segments[i].push_back(Segment {false, {bezier.getP1() * t, bezier.getP2() * t, bezier.getP3() * t, bezier.getP4() * t}});
+                        }
+                    }
+                }
+            }
+        });
+
+        for(vector<Segment> &path : segments) {
+            for(Segment &segment : path) {
+                ctx->move_to(segment.p[0].x, segment.p[0].y);
+                if(segment.line) {
+                    ctx->line_to(segment.p[1].x, segment.p[1].y);
+                } else {
+                    ctx->curve_to(segment.p[1].x, segment.p[1].y, segment.p[2].x, segment.p[2].y, segment.p[3].x, segment.p[3].y);
                 }
             }
             ctx->stroke();
         }
+
+        //Images are shown as their outlines
+        ctx->set_source_rgb(0.1, 0.1, 0.1);
+        for(svg::Image &image : this->document->images) {
+            svg::Transformation t = view * image.transformation;
+            svg::Point corners[4] = {
+                svg::Point {image.x, image.y} * t, svg::Point {image.x + image.width, image.y} * t,
+                svg::Point {image.x + image.width, image.y + image.height} * t, svg::Point {image.x, image.y + image.height} * t
+            };
+            ctx->move_to(corners[3].x, corners[3].y);
+            for(svg::Point &corner : corners) ctx->line_to(corner.x, corner.y);
+            ctx->stroke();
+        }
         
     }
 
@@ -347,67 +568,83 @@ double Interface::getRowValue(Gtk::TreeModel::iterator row) {
     return row->get_value(this->propertiesModel.m_col_value);
 }
 
+gcode::Settings Interface::getSettings() {
+    gcode::Settings settings;
+    settings.offsetX = this->getRowValue(this->rowOffsetX);
+    settings.offsetY = this->getRowValue(this->rowOffsetY);
+    settings.bedWidth = this->getRowValue(this->rowBedWidth);
+    settings.bedHeight = this->getRowValue(this->rowBedHeight);
+    settings.travelSpeed = this->getRowValue(this->rowTravelSpeed);
+    settings.workingSpeed = this->getRowValue(this->rowWorkingSpeed);
+    settings.rasterSpacing = this->getRowValue(this->rowRasterSpacing);
+    settings.rasterPower = this->getRowValue(this->rowRasterPower);
+    settings.rasterMode = this->getRowValue(this->rowRasterMode);
+    settings.hatchSpacing = this->getRowValue(this->rowHatchSpacing);
+    settings.hatchAngle = this->getRowValue(this->rowHatchAngle);
+    settings.duplicateTolerance = this->getRowValue(this->rowDuplicateTolerance);
+    settings.joinTolerance = this->getRowValue(this->rowJoinTolerance);
+    settings.acceleration = this->getRowValue(this->rowAcceleration);
+    settings.junctionDeviation = this->getRowValue(this->rowJunctionDeviation);
+    settings.maxSpeed = this->getRowValue(this->rowMaxSpeed);
+    settings.dialect = this->getRowValue(this->rowDialect);
+    settings.resolution = this->getRowValue(this->rowResolution);
+    settings.stripComments = this->getRowValue(this->rowStripComments) != 0;
+    settings.orderPaths = this->getRowValue(this->rowOrderPaths) != 0;
+    settings.simplifyTolerance = this->getRowValue(this->rowSimplifyTolerance);
+    settings.arrayRows = this->getRowValue(this->rowArrayRows);
+    settings.arrayColumns = this->getRowValue(this->rowArrayColumns);
+    settings.arrayPitchX = this->getRowValue(this->rowArrayPitchX);
+    settings.arrayPitchY = this->getRowValue(this->rowArrayPitchY);
+    settings.arraySerpentine = this->getRowValue(this->rowArraySerpentine) != 0;
+    settings.quantize = this->getRowValue(this->rowQuantize) != 0;
+    settings.startGcode = this->startGcodeTextView->get_buffer()->get_text();
+    settings.endGcode = this->endGcodeTextView->get_buffer()->get_text();
+    settings.toolOnGcode = this->toolOnGcodeTextView->get_buffer()->get_text();
+    settings.toolOffGcode = this->toolOffGcodeTextView->get_buffer()->get_text();
+    return settings;
+}
+
 void Interface::requestDraw(const Gtk::ListStore::Path&, const Gtk::ListStore::iterator&) {
     this->drawingArea->queue_draw();
 }
 
 void Interface::saveConfig() {
-    fstream config;
-    config.open("config.lwc", ios::out);
-    if(config.good()) {
-        config << this->getRowValue(this->rowOffsetX) << "\036";
-        config << this->getRowValue(this->rowOffsetY) << "\036";
-        config << this->getRowValue(this->rowBedWidth) << "\036";
-        config << this->getRowValue(this->rowBedHeight) << "\036";
-        config << this->getRowValue(this->rowTravelSpeed) << "\036";
-        config << this->getRowValue(this->rowWorkingSpeed) << "\036";
-        config << this->startGcodeTextView->get_buffer()->get_text() << "\036";
-        config << this->endGcodeTextView->get_buffer()->get_text() << "\036";
-        config << this->toolOnGcodeTextView->get_buffer()->get_text() << "\036";
-        config << this->toolOffGcodeTextView->get_buffer()->get_text() << "\036";
-    }
+    gcode::saveSettings("config.lwc", this->getSettings());
 }
 
 bool Interface::loadConfig() {
-    ifstream config;
-    config.open("config.lwc", ios::binary);
-    unsigned int length = config.tellg();
-    config.seekg(0, ios::end);
-    length = static_cast<unsigned int>(config.tellg()) - length;
-    config.seekg(0, ios::beg);
-    char *cstr = new char[length];
-    config.read(cstr, length);
-    config.close();
-
-    vector<string> strings;
-    int j = 0;
-    for(int i = 0 ; i < length ; i++) {
-        if(j == strings.size()) {
-            strings.push_back(string());
-        }
-        if(cstr[i] == '\036') {
-            j++;
-        } else {
-            strings[j].push_back(cstr[i]);
-        }
-    }
-    delete[] cstr;
-
-    if(strings.size() == 10) {
-        try {
-            this->rowOffsetX = this->addProperty("Offset X (mm)", parseDouble(strings[0]));
-            this->rowOffsetY = this->addProperty("Offset Y (mm)", parseDouble(strings[1]));
-            this->rowBedWidth = this->addProperty("Bed width (mm)", parseDouble(strings[2]));
-            this->rowBedHeight = this->addProperty("Bed height (mm)", parseDouble(strings[3]));
-            this->rowTravelSpeed = this->addProperty("Travel speed (mm/s)", parseDouble(strings[4]));
-            this->rowWorkingSpeed = this->addProperty("Working speed (mm/s)", parseDouble(strings[5]));
-            this->startGcodeTextView->get_buffer()->set_text(strings[6]);
-            this->endGcodeTextView->get_buffer()->set_text(strings[7]);
-            this->toolOnGcodeTextView->get_buffer()->set_text(strings[8]);
-            this->toolOffGcodeTextView->get_buffer()->set_text(strings[9]);
-            return true;
-        } catch(invalid_argument& e) {
-            return false;
-        }
-    } else return false;
-}
\ No newline at end of file
+    gcode::Settings settings; //Default values are used if there is no valid config file
+    bool loaded = gcode::loadSettings("config.lwc", settings);
+    this->rowOffsetX = this->addProperty("Offset X (mm)", settings.offsetX);
+    this->rowOffsetY = this->addProperty("Offset Y (mm)", settings.offsetY);
+    this->rowBedWidth = this->addProperty("Bed width (mm)", settings.bedWidth);
+    this->rowBedHeight = this->addProperty("Bed height (mm)", settings.bedHeight);
+    this->rowTravelSpeed = this->addProperty("Travel speed (mm/s)", settings.travelSpeed);
+    this->rowWorkingSpeed = this->addProperty("Working speed (mm/s)", settings.workingSpeed);
+    this->rowRasterSpacing = this->addProperty("Raster line spacing (mm)", settings.rasterSpacing);
+    this->rowRasterPower = this->addProperty("Raster max power (S)", settings.rasterPower);
+    this->rowRasterMode = this->addProperty("Raster mode (0 threshold, 1 dither, 2 gray)", settings.rasterMode);
+    this->rowHatchSpacing = this->addProperty("Fill hatch spacing (mm)", settings.hatchSpacing);
+    this->rowHatchAngle = this->addProperty("Fill hatch angle (deg)", settings.hatchAngle);
+    this->rowDuplicateTolerance = this->addProperty("Duplicate line tolerance (mm)", settings.duplicateTolerance);
+    this->rowJoinTolerance = this->addProperty("Join tolerance (mm)", settings.joinTolerance);
+    this->rowAcceleration = this->addProperty("Acceleration (mm/s2)", settings.acceleration);
+    this->rowJunctionDeviation = this->addProperty("Junction deviation (mm)", settings.junctionDeviation);
+    this->rowMaxSpeed = this->addProperty("Max speed (mm/s, 0 for none)", settings.maxSpeed);
+    this->rowDialect = this->addProperty("GCODE dialect (0 absolute, 1 compact, 2 relative)", settings.dialect);
+    this->rowResolution = this->addProperty("Coordinate resolution (mm)", settings.resolution);
+    this->rowStripComments = this->addProperty("Strip comments (0 or 1)", settings.stripComments);
+    this->rowOrderPaths = this->addProperty("Order paths by nearest start (0 or 1)", settings.orderPaths);
+    this->rowSimplifyTolerance = this->addProperty("Simplify tolerance (mm)", settings.simplifyTolerance);
+    this->rowArrayRows = this->addProperty("Array rows", settings.arrayRows);
+    this->rowArrayColumns = this->addProperty("Array columns", settings.arrayColumns);
+    this->rowArrayPitchX = this->addProperty("Array column pitch (mm)", settings.arrayPitchX);
+    this->rowArrayPitchY = this->addProperty("Array row pitch (mm)", settings.arrayPitchY);
+    this->rowArraySerpentine = this->addProperty("Array serpentine order (0 or 1)", settings.arraySerpentine);
+    this->rowQuantize = this->addProperty("Round toolpath to resolution (0 or 1)", settings.quantize);
+    this->startGcodeTextView->get_buffer()->set_text(settings.startGcode);
+    this->endGcodeTextView->get_buffer()->set_text(settings.endGcode);
+    this->toolOnGcodeTextView->get_buffer()->set_text(settings.toolOnGcode);
+    this->toolOffGcodeTextView->get_buffer()->set_text(settings.toolOffGcode);
+    return loaded;
+}
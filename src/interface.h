@@ -1,8 +1,13 @@
 #pragma once
 
 #include <gtkmm.h>
+#include <mutex>
 #include <thread>
+#include "batch.h"
 #include "svg.h"
+#include "gcode.h"
+#include "viewer.h"
+#include "watch.h"
 
 
 class Interface {
@@ -13,9 +18,34 @@ private:
     Gtk::Button *loadSvgButton, *exportGcodeButton;
     Gtk::TextView *startGcodeTextView, *endGcodeTextView, *toolOnGcodeTextView, *toolOffGcodeTextView;
     Gtk::DrawingArea *drawingArea;
-    Gtk::MenuItem *loadSvgMenuItem, *exportGcodeMenuItem, *exitMenuItem, *aboutMenuItem;
+    Gtk::Label *statusLabel;
+    Gtk::MenuItem *loadSvgMenuItem, *exportGcodeMenuItem, *batchExportMenuItem, *openGcodeMenuItem, *exitMenuItem, *aboutMenuItem;
 
-    std::vector<svg::Path> *paths;
+    svg::Document *document;
+    viewer::GcodeFile *gcodeFile; //Shown instead of the document when set
+
+    //Loaded file is watched and reloaded when it is saved again, parsing only shapes that changed
+    std::string documentPath;
+    watch::FileWatcher *watcher;
+    sigc::connection watchConnection, reloadConnection;
+    void watchFile(const std::string &path);
+    bool fileChanged(Glib::IOCondition condition);
+    bool reloadDocument();
+
+    //Batch export converts files on its own thread and reports every finished file through the dispatcher
+    std::thread *batchThread;
+    Glib::Dispatcher batchDispatcher;
+    std::mutex batchLock;
+    std::vector<batch::Result> batchResults; //Finished files, guarded by the lock
+    std::string batchSummary; //Set when all files are done
+    size_t batchTotal;
+    scheduler::CancellationToken batchToken;
+    void batchProgress();
+
+    //Toolpath drawn last time, reused while the view doesn't change
+    viewer::View gcodeView;
+    viewer::Polylines gcodeCuts, gcodeTravels;
+    void drawGcode(const Cairo::RefPtr<Cairo::Context> &ctx, const viewer::View &view);
 
     class PropertiesModel : public Gtk::TreeModel::ColumnRecord {
     public:
@@ -32,13 +62,22 @@ private:
 
     Gtk::TreeModel::iterator addProperty(Glib::ustring property, double value);
     double getRowValue(Gtk::TreeModel::iterator);
+    gcode::Settings getSettings();
     Gtk::TreeModel::iterator rowOffsetX, rowOffsetY, rowBedWidth, rowBedHeight, rowTravelSpeed, rowWorkingSpeed;
+    Gtk::TreeModel::iterator rowRasterSpacing, rowRasterPower, rowRasterMode;
+    Gtk::TreeModel::iterator rowHatchSpacing, rowHatchAngle, rowDuplicateTolerance, rowJoinTolerance;
+    Gtk::TreeModel::iterator rowAcceleration, rowJunctionDeviation, rowMaxSpeed;
+    Gtk::TreeModel::iterator rowDialect, rowResolution, rowStripComments;
+    Gtk::TreeModel::iterator rowOrderPaths, rowSimplifyTolerance;
+    Gtk::TreeModel::iterator rowArrayRows, rowArrayColumns, rowArrayPitchX, rowArrayPitchY, rowArraySerpentine;
+    Gtk::TreeModel::iterator rowQuantize;
 
     Glib::RefPtr<Gdk::Pixbuf> icon;
 
 
 public:
     static const std::string windowName;
+    static const int reloadDelay; //ms without changes of the file before it is reloaded
 
     Interface();
     ~Interface();
@@ -47,6 +86,8 @@ public:
     void run();
     void loadSvgButtonClicked();
     void exportGcodeButtonClicked();
+    void batchExportMenuClicked();
+    void openGcodeMenuClicked();
     void requestDraw(const Gtk::ListStore::Path&, const Gtk::ListStore::iterator&);
     void saveConfig();
     bool loadConfig();
@@ -1,11 +1,14 @@
 #include <gtkmm.h>
 
 #include "interface.h"
+#include "cli.h"
 #include <fstream>
 
 using namespace std;
 
 int main(int argc, char **argv) {
+    if(argc > 1) return cli::run(argc, argv); //Any argument means command line conversion
+
     Gtk::Main::init_gtkmm_internals();
 
     Interface interface;
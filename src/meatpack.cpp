@@ -0,0 +1,180 @@
+#include <string.h>
+
+#include "meatpack.h"
+
+namespace meatpack {
+
+    using namespace std;
+
+    const unsigned char escape = 0xF; //Character follows whole
+    const char characters[2][15] = {
+        {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', ' ', '\n', 'G', 'X'},
+        {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '.', 'E', '\n', 'G', 'X'} //No spaces
+    };
+
+    //Four bit codes of all characters, escape if a character can't be packed
+    struct CodeTable {
+        unsigned char codes[2][256];
+        CodeTable() {
+            memset(codes, escape, sizeof(codes));
+            for(int table = 0 ; table < 2 ; table++) {
+                for(int i = 0 ; i < 15 ; i++) codes[table][static_cast<unsigned char>(characters[table][i])] = i;
+            }
+        }
+    };
+    static const CodeTable table;
+
+    string command(Command command) {
+        string result(2, static_cast<char>(signal_byte));
+        result.push_back(static_cast<char>(command));
+        return result;
+    }
+
+    void packLine(const char *line, size_t length, bool noSpaces, string &out) {
+        const unsigned char *codes = table.codes[noSpaces ? 1 : 0];
+        bool dropSpaces = noSpaces && length > 0 && (line[0] == 'G' || line[0] == 'g');
+        char pending = 0;
+        bool hasPending = false;
+        for(size_t i = 0 ; i < length ; i++) {
+            char c = line[i];
+            if(c == ' ' && dropSpaces) continue;
+            if(!hasPending) {
+                if(c == '\n') { //Second half of the byte is ignored
+                    out.push_back(static_cast<char>(codes['\n'] | codes['\n'] << 4));
+                    continue;
+                }
+                pending = c;
+                hasPending = true;
+                continue;
+            }
+            unsigned char first = codes[static_cast<unsigned char>(pending)], second = codes[static_cast<unsigned char>(c)];
+            out.push_back(static_cast<char>(first | second << 4));
+            if(first == escape) out.push_back(pending);
+            if(second == escape) out.push_back(c);
+            hasPending = false;
+        }
+        if(hasPending) { //Padded with a line break, if the line has none
+            unsigned char first = codes[static_cast<unsigned char>(pending)];
+            out.push_back(static_cast<char>(first | codes['\n'] << 4));
+            if(first == escape) out.push_back(pending);
+        }
+    }
+
+    EncodeBuffer::EncodeBuffer(streambuf *target, bool noSpaces) : target(target), noSpaces(noSpaces) {
+        setp(buffer, buffer + sizeof(buffer));
+        packed = meatpack::command(enablePacking);
+        if(noSpaces) packed += meatpack::command(enableNoSpaces);
+    }
+
+    EncodeBuffer::~EncodeBuffer() {
+        finish();
+    }
+
+    bool EncodeBuffer::pass(bool last) {
+        const char *text = pbase(), *end = pptr();
+        while(text < end) {
+            const char *newline = static_cast<const char*>(memchr(text, '\n', end - text));
+            if(!newline) {
+                line.append(text, end);
+                break;
+            }
+            if(line.empty()) {
+                packLine(text, newline + 1 - text, noSpaces, packed);
+            } else {
+                line.append(text, newline + 1);
+                packLine(line.data(), line.length(), noSpaces, packed);
+                line.clear();
+            }
+            text = newline + 1;
+        }
+        setp(buffer, buffer + sizeof(buffer));
+        if(last && !line.empty()) { //Controller runs a line when it ends
+            line.push_back('\n');
+            packLine(line.data(), line.length(), noSpaces, packed);
+            line.clear();
+        }
+        if(last) packed += meatpack::command(disablePacking);
+        bool written = target->sputn(packed.data(), packed.length()) == static_cast<streamsize>(packed.length());
+        packed.clear();
+        return written;
+    }
+
+    int EncodeBuffer::overflow(int c) {
+        if(finished || !pass(false)) return EOF;
+        if(c != EOF) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return c == EOF ? 0 : c;
+    }
+
+    int EncodeBuffer::sync() {
+        if(finished || !pass(false)) return -1;
+        return target->pubsync();
+    }
+
+    bool EncodeBuffer::finish() {
+        if(finished) return true;
+        finished = true;
+        bool written = pass(true);
+        return target->pubsync() == 0 && written;
+    }
+
+    void Decoder::unpack(unsigned char c, string &out) {
+        if(!active) {
+            out.push_back(static_cast<char>(c));
+            return;
+        }
+        if(literals > 0) {
+            out.push_back(static_cast<char>(c));
+            if(second) {
+                out.push_back(second);
+                second = 0;
+            }
+            literals--;
+            return;
+        }
+        const char *chars = characters[noSpaces ? 1 : 0];
+        unsigned char first = c & 0xF, next = c >> 4;
+        if(first == escape) {
+            literals++;
+            if(next == escape) literals++;
+            else second = chars[next];
+            return;
+        }
+        out.push_back(chars[first]);
+        if(chars[first] == '\n') return; //Next character starts a new line in a new byte
+        if(next == escape) literals++;
+        else out.push_back(chars[next]);
+    }
+
+    void Decoder::decode(const char *data, size_t length, string &out) {
+        for(size_t i = 0 ; i < length ; i++) {
+            unsigned char c = static_cast<unsigned char>(data[i]);
+            if(c == signal_byte) {
+                if(signals > 0) {
+                    commandNext = true;
+                    signals = 0;
+                } else {
+                    signals++;
+                }
+            } else if(commandNext) {
+                commandNext = false;
+                switch(c) {
+                    case enablePacking: active = true; break;
+                    case disablePacking: active = false; break;
+                    case resetAll: active = noSpaces = false; break;
+                    case enableNoSpaces: noSpaces = true; break;
+                    case disableNoSpaces: noSpaces = false; break;
+                }
+            } else {
+                if(signals > 0) { //Single signal byte was data
+                    unpack(signal_byte, out);
+                    signals = 0;
+                }
+                unpack(c, out);
+            }
+        }
+    }
+
+}
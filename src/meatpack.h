@@ -0,0 +1,62 @@
+#pragma once
+
+#include <streambuf>
+#include <string>
+
+//MeatPack packing of GCODE, as understood by Marlin firmware. The most common characters (digits, '.', ' ', '\n',
+//'G' and 'X') take four bits, so two of them fit in a byte. Other characters are sent whole after the byte
+//that holds their escape code. Packing is switched on and off with commands following two signal bytes.
+namespace meatpack {
+
+    using namespace std;
+
+    const unsigned char signal_byte = 0xFF;
+
+    enum Command : unsigned char {
+        enablePacking = 0xFB, disablePacking = 0xFA, resetAll = 0xF9, queryConfig = 0xF8,
+        enableNoSpaces = 0xF7, disableNoSpaces = 0xF6 //Code of ' ' is used for 'E', spaces have to be left out
+    };
+
+    //Signal bytes followed by the command
+    string command(Command command);
+
+    //Packs a line, which has to end with '\n' unless it is the last one. Marlin ignores the second character of a byte
+    //after '\n', so every line starts in a new byte. With noSpaces, spaces of G commands are left out.
+    void packLine(const char *line, size_t length, bool noSpaces, string &out);
+
+    //Packs text on its way to another stream buffer. Lines are packed when complete, the last one when finished,
+    //with a line break added if it has none.
+    class EncodeBuffer : public streambuf {
+    private:
+        streambuf *target;
+        bool noSpaces;
+        bool finished = false;
+        string line; //Incomplete line
+        string packed;
+        char buffer[1 << 14];
+        bool pass(bool last); //Packs buffered text
+    protected:
+        int overflow(int c);
+        int sync();
+    public:
+        EncodeBuffer(streambuf *target, bool noSpaces = false); //Enables packing at the start of the output
+        ~EncodeBuffer();
+        bool finish(); //Packs the rest and disables packing, so the controller reads plain text again
+    };
+
+    //Unpacks a byte stream the way the firmware does, including commands
+    class Decoder {
+    private:
+        bool active = false;
+        bool noSpaces = false;
+        int signals = 0; //Signal bytes in a row
+        bool commandNext = false;
+        int literals = 0; //Whole characters still to be read
+        char second = 0; //Packed character following a whole one
+        void unpack(unsigned char c, string &out);
+    public:
+        void decode(const char *data, size_t length, string &out);
+        bool isActive() const {return active;};
+    };
+
+}
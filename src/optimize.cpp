@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <math.h>
+
+#include "optimize.h"
+#include "scheduler.h"
+#include "stats.h"
+
+namespace optimize {
+
+    using namespace std;
+
+    const int curve_samples = 8; //Curves are compared and measured at t = i / curve_samples
+
+    //Element in document coordinates
+    struct Item {
+        size_t path;
+        size_t element;
+        bool line;
+        vector<svg::Point> points; //Ends of a line or samples of a curve
+        double length;
+    };
+
+    static double distance(const svg::Point &a, const svg::Point &b) {
+        return sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y));
+    }
+
+    const long long max_angle_buckets = 1024; //Direction buckets of lines covering half of a turn
+    const long long max_spread_buckets = 8; //Lines spreading over more direction buckets on either side go to one for any direction
+
+    //Spatial hash of cells touched by elements. Lines are also bucketed by direction, so a cell crossed by many
+    //lines in different directions doesn't make every one of them a candidate. Short lines could lie on lines of
+    //almost any direction, they are kept in a bucket of their own that every query looks at. Hash collisions only
+    //add candidates.
+    class Grid {
+    private:
+        double size;
+        double angleStep; //Width of a direction bucket in radians
+        long long angles; //Number of buckets covering half of a turn
+        unordered_map<long long, vector<size_t>> cells;
+
+        long long key(long long x, long long y, long long angle) const {return (x * 73856093) ^ (y * 19349663) ^ (angle * 83492791);};
+
+        //Visits cells along a polyline, close enough together that no cell crossed by it is skipped
+        template<typename F>
+        void walk(const vector<svg::Point> &points, F visit) const {
+            for(size_t i = 0 ; i + 1 < points.size() ; i++) {
+                const svg::Point &a = points[i], &b = points[i + 1];
+                int steps = static_cast<int>(ceil(distance(a, b) / (size / 2))) + 1;
+                for(int s = 0 ; s <= steps ; s++) {
+                    double t = static_cast<double>(s) / steps;
+                    visit(static_cast<long long>(floor((a.x + (b.x - a.x) * t) / size)), static_cast<long long>(floor((a.y + (b.y - a.y) * t) / size)));
+                }
+            }
+        }
+
+        //Direction of a line as an angle in [0, PI), lines don't have a side
+        double angle(const vector<svg::Point> &points) const {
+            double result = atan2(points[1].y - points[0].y, points[1].x - points[0].x);
+            return result < 0 ? result + M_PI : result;
+        }
+
+    public:
+        Grid(double size, double angleStep) : size(size) {
+            angles = max(1LL, static_cast<long long>(ceil(M_PI / angleStep)));
+            this->angleStep = M_PI / angles;
+        };
+
+        //Lines are added to every bucket of directions within spread of their own, or to the bucket for any
+        //direction if that would be too many of them
+        void insert(const vector<svg::Point> &points, bool line, double spread, size_t index) {
+            bool directed = line && spread <= max_spread_buckets * angleStep;
+            long long low = 0, high = 0;
+            if(directed) {
+                double a = angle(points);
+                low = static_cast<long long>(floor((a - spread) / angleStep));
+                high = min(low + angles - 1, static_cast<long long>(floor((a + spread) / angleStep)));
+            }
+            walk(line ? points : vector<svg::Point> {points.front(), points.front()}, [&](long long x, long long y) {
+                for(long long bucket = low ; bucket <= high ; bucket++) {
+                    vector<size_t> &cell = cells[key(x, y, directed ? (bucket % angles + angles) % angles : -1)];
+                    if(cell.empty() || cell.back() != index) cell.push_back(index);
+                }
+            });
+        }
+
+        //Calls found for elements in cells around a line, or around the given point of a curve.
+        //Elements may be reported more than once.
+        template<typename F>
+        void query(const vector<svg::Point> &points, bool line, F found) const {
+            long long bucket = line ? static_cast<long long>(floor(angle(points) / angleStep)) % angles : -1;
+            walk(line ? points : vector<svg::Point> {points.front(), points.front()}, [&](long long x, long long y) {
+                for(long long dx = -1 ; dx <= 1 ; dx++) {
+                    for(long long dy = -1 ; dy <= 1 ; dy++) {
+                        auto cell = cells.find(key(x + dx, y + dy, bucket));
+                        if(cell != cells.end()) for(size_t index : cell->second) found(index);
+                        if(!line) continue;
+                        cell = cells.find(key(x + dx, y + dy, -1));
+                        if(cell != cells.end()) for(size_t index : cell->second) found(index);
+                    }
+                }
+            });
+        }
+    };
+
+    Report removeDuplicates(vector<svg::Path> &paths, double tolerance, bool keepFilled) {
+        STATS_TIMER(removeDuplicates);
+        Report report;
+        if(tolerance <= 0) return report;
+
+        //Transforming elements in parallel
+        vector<vector<Item>> perPath(paths.size());
+        scheduler::parallelFor(0, paths.size(), [&](size_t begin, size_t end) {
+            for(size_t i = begin ; i < end ; i++) {
+                svg::Transformation transformation = paths[i].getTransformation();
+                for(size_t j = 0 ; j < paths[i].size() ; j++) {
+                    svg::PathElement *element = paths[i][j];
+                    svg::Line *line = dynamic_cast<svg::Line*>(element);
+                    Item item {i, j, line != nullptr, {}, 0};
+                    if(line) {
+                        item.points = {line->getP1() * transformation, line->getP2() * transformation};
+                    } else {
+                        for(int s = 0 ; s <= curve_samples ; s++) item.points.push_back(element->getPoint(static_cast<double>(s) / curve_samples) * transformation);
+                    }
+                    for(size_t s = 0 ; s + 1 < item.points.size() ; s++) item.length += distance(item.points[s], item.points[s + 1]);
+                    perPath[i].push_back(item);
+                }
+            }
+        });
+        vector<Item> items;
+        for(vector<Item> &path : perPath) items.insert(items.end(), path.begin(), path.end());
+        vector<vector<Item>>().swap(perPath);
+        if(items.empty()) return report;
+
+        //Lines are hashed in cells about as large as an average line, and in direction buckets narrow enough
+        //to separate average lines that don't lie on each other. Curves only need to match at their start point.
+        double total = 0;
+        size_t lines = 0;
+        for(Item &item : items) {
+            if(!item.line) continue;
+            total += item.length;
+            lines++;
+        }
+        double average = lines ? total / lines : tolerance;
+        Grid lineGrid(max(average, tolerance * 4), min(0.05, max(M_PI / max_angle_buckets, 2 * tolerance / average)));
+        Grid curveGrid(tolerance * 4, M_PI);
+
+        //Parts of every line that remain, as distances from its start
+        vector<vector<pair<double, double>>> remaining(items.size());
+        vector<bool> changed(items.size(), false);
+        vector<size_t> seen(items.size(), items.size());
+        vector<pair<double, double>> covered;
+        for(size_t i = 0 ; i < items.size() ; i++) {
+            Item &item = items[i];
+            bool fixed = item.length <= tolerance || (keepFilled && paths[item.path].getFill().filled());
+            if(!fixed && item.line) {
+                //Lines lying on this one within tolerance cover intervals of it
+                const svg::Point &a = item.points[0], &b = item.points[1];
+                svg::Point direction {(b.x - a.x) / item.length, (b.y - a.y) / item.length};
+                covered.clear();
+                lineGrid.query(item.points, true, [&](size_t j) {
+                    if(seen[j] == i) return;
+                    seen[j] = i;
+                    const svg::Point &p = items[j].points[0], &q = items[j].points[1];
+                    double crossP = (p.x - a.x) * direction.y - (p.y - a.y) * direction.x;
+                    double crossQ = (q.x - a.x) * direction.y - (q.y - a.y) * direction.x;
+                    if(abs(crossP) > tolerance || abs(crossQ) > tolerance) return;
+                    double t1 = (p.x - a.x) * direction.x + (p.y - a.y) * direction.y;
+                    double t2 = (q.x - a.x) * direction.x + (q.y - a.y) * direction.y;
+                    double low = max(0.0, min(t1, t2)), high = min(item.length, max(t1, t2));
+                    if(high > low) covered.push_back(make_pair(low, high));
+                });
+                if(!covered.empty()) {
+                    sort(covered.begin(), covered.end());
+                    double position = 0;
+                    for(pair<double, double> &interval : covered) {
+                        if(interval.first - position > tolerance) remaining[i].push_back(make_pair(position, interval.first));
+                        position = max(position, interval.second);
+                    }
+                    if(item.length - position > tolerance) remaining[i].push_back(make_pair(position, item.length));
+                    double kept = 0;
+                    for(pair<double, double> &piece : remaining[i]) kept += piece.second - piece.first;
+                    if(item.length - kept > tolerance) {
+                        changed[i] = true;
+                        report.removed++;
+                        report.savedLength += item.length - kept;
+                    }
+                }
+            } else if(!fixed) {
+                //Curves are removed only if all samples match, in either direction
+                size_t n = item.points.size();
+                auto match = [&](size_t j) {
+                    if(changed[i] || seen[j] == i) return;
+                    seen[j] = i;
+                    bool same = true, reversed = true;
+                    for(size_t s = 0 ; s < n ; s++) {
+                        same = same && distance(item.points[s], items[j].points[s]) <= tolerance;
+                        reversed = reversed && distance(item.points[s], items[j].points[n - 1 - s]) <= tolerance;
+                    }
+                    if(same || reversed) {
+                        changed[i] = true;
+                        report.removed++;
+                        report.savedLength += item.length;
+                    }
+                };
+                curveGrid.query(item.points, false, match);
+                curveGrid.query(vector<svg::Point> {item.points.back()}, false, match);
+            }
+
+            //Lines within tolerance of a line differ in direction by at most the angle they can tilt by
+            if(item.line) {
+                if(item.length > 0) lineGrid.insert(item.points, true, asin(min(1.0, 2 * tolerance / item.length)), i);
+            } else {
+                curveGrid.insert(item.points, false, 0, i);
+            }
+        }
+        if(report.removed == 0) return report;
+
+        //Rebuilding geometries of changed paths. Shortened lines are moved back into path coordinates.
+        size_t first = 0;
+        while(first < items.size()) {
+            size_t last = first;
+            bool pathChanged = false;
+            for(; last < items.size() && items[last].path == items[first].path ; last++) {
+                if(changed[last]) pathChanged = true;
+            }
+            if(pathChanged) {
+                svg::Path &path = paths[items[first].path];
+                svg::Transformation inverse = path.getTransformation().inverse();
+                shared_ptr<svg::Geometry> geometry = make_shared<svg::Geometry>();
+                for(size_t i = first ; i < last ; i++) {
+                    Item &item = items[i];
+                    if(!changed[i]) {
+                        geometry->push_back(path[item.element]->clone());
+                    } else if(item.line) {
+                        const svg::Point &a = item.points[0], &b = item.points[1];
+                        for(pair<double, double> &piece : remaining[i]) {
+                            double t1 = piece.first / item.length, t2 = piece.second / item.length;
+                            svg::Point p {a.x + (b.x - a.x) * t1, a.y + (b.y - a.y) * t1};
+                            svg::Point q {a.x + (b.x - a.x) * t2, a.y + (b.y - a.y) * t2};
+                            geometry->push_back(new svg::Line(p * inverse, q * inverse));
+                        }
+                    }
+                }
+                path = svg::Path(geometry, path.getTransformation(), path.getFill());
+            }
+            first = last;
+        }
+        return report;
+    }
+
+    //Continuous elements of a path, from first to last - 1
+    struct Run {
+        size_t path;
+        size_t first;
+        size_t last;
+        svg::Point start;
+        svg::Point end;
+        bool fixed; //Left out of chains
+    };
+
+    static bool close(const svg::Point &a, const svg::Point &b, double tolerance) {
+        return abs(a.x - b.x) <= tolerance && abs(a.y - b.y) <= tolerance;
+    }
+
+    static svg::Point endPoint(svg::PathElement *element, bool start, const svg::Transformation &t) {
+        svg::Line *line = dynamic_cast<svg::Line*>(element);
+        if(line) return (start ? line->getP1() : line->getP2()) * t;
+        return element->getPoint(start ? 0 : 1) * t;
+    }
+
+    size_t joinPaths(vector<svg::Path> &paths, double tolerance, bool keepFilled) {
+        STATS_TIMER(joinPaths);
+        if(tolerance <= 0) return 0;
+
+        //Splitting paths where elements don't meet
+        vector<vector<Run>> perPath(paths.size());
+        scheduler::parallelFor(0, paths.size(), [&](size_t begin, size_t end) {
+            for(size_t i = begin ; i < end ; i++) {
+                svg::Path &path = paths[i];
+                if(path.empty()) continue;
+                svg::Transformation t = path.getTransformation();
+                bool fixed = keepFilled && path.getFill().filled();
+                for(size_t j = 0 ; j < path.size() ; j++) {
+                    svg::Point start = endPoint(path[j], true, t);
+                    if(j == 0 || (!fixed && !close(perPath[i].back().end, start, tolerance))) {
+                        perPath[i].push_back(Run {i, j, j, start, start, fixed});
+                    }
+                    perPath[i].back().last = j + 1;
+                    perPath[i].back().end = endPoint(path[j], false, t);
+                }
+            }
+        });
+        vector<Run> runs;
+        for(vector<Run> &path : perPath) runs.insert(runs.end(), path.begin(), path.end());
+        vector<vector<Run>>().swap(perPath);
+
+        //Both ends of every run, as run * 2 for the start and run * 2 + 1 for the end. Every cell is a list of ends
+        //in order of runs, and ends of used runs are unlinked, so ends meeting at one point aren't scanned again
+        //for every chain.
+        double size = tolerance * 2;
+        auto key = [size](const svg::Point &p, long long dx, long long dy) {
+            return (static_cast<long long>(floor(p.x / size)) + dx) * 73856093 ^ (static_cast<long long>(floor(p.y / size)) + dy) * 19349663;
+        };
+        size_t none = runs.size() * 2;
+        auto point = [&](size_t end) -> const svg::Point& {return end % 2 ? runs[end / 2].end : runs[end / 2].start;};
+        unordered_map<long long, size_t> cells; //First end of every cell
+        vector<size_t> next(none, none), previous(none, none);
+        for(size_t end = none ; end-- > 0 ;) {
+            if(runs[end / 2].fixed) continue;
+            auto cell = cells.insert(make_pair(key(point(end), 0, 0), none)).first;
+            if(cell->second != none) previous[cell->second] = end;
+            next[end] = cell->second;
+            cell->second = end;
+        }
+        vector<bool> used(runs.size(), false);
+        auto use = [&](size_t index) {
+            used[index] = true;
+            if(runs[index].fixed) return;
+            for(size_t end = index * 2 ; end <= index * 2 + 1 ; end++) {
+                if(previous[end] != none) next[previous[end]] = next[end];
+                else cells[key(point(end), 0, 0)] = next[end];
+                if(next[end] != none) previous[next[end]] = previous[end];
+            }
+        };
+        auto find = [&](const svg::Point &p) {
+            size_t best = none;
+            for(long long dx = -1 ; dx <= 1 ; dx++) {
+                for(long long dy = -1 ; dy <= 1 ; dy++) {
+                    auto cell = cells.find(key(p, dx, dy));
+                    if(cell == cells.end()) continue;
+                    for(size_t end = cell->second ; end < best ; end = next[end]) {
+                        if(close(p, point(end), tolerance)) best = end;
+                    }
+                }
+            }
+            return best;
+        };
+
+        //Growing chains from runs in document order, first forwards and then backwards. Earlier runs are preferred.
+        vector<deque<pair<size_t, bool>>> chains; //Runs and whether they are reversed
+        size_t joins = 0;
+        for(size_t i = 0 ; i < runs.size() ; i++) {
+            if(used[i]) continue;
+            use(i);
+            deque<pair<size_t, bool>> chain {make_pair(i, false)};
+            if(!runs[i].fixed) {
+                svg::Point end = runs[i].end, start = runs[i].start;
+                for(size_t found = find(end) ; found < none ; found = find(end)) {
+                    use(found / 2);
+                    bool reversed = found % 2 == 1;
+                    chain.push_back(make_pair(found / 2, reversed));
+                    end = reversed ? runs[found / 2].start : runs[found / 2].end;
+                }
+                for(size_t found = find(start) ; found < none ; found = find(start)) {
+                    use(found / 2);
+                    bool reversed = found % 2 == 0;
+                    chain.push_front(make_pair(found / 2, reversed));
+                    start = reversed ? runs[found / 2].end : runs[found / 2].start;
+                }
+            }
+            joins += chain.size() - 1;
+            chains.push_back(move(chain));
+        }
+        if(joins == 0) return 0;
+
+        //Paths that stayed whole are kept, so their geometry is still shared
+        vector<svg::Path> result;
+        result.reserve(chains.size());
+        for(deque<pair<size_t, bool>> &chain : chains) {
+            const Run &first = runs[chain.front().first];
+            if(chain.size() == 1 && !chain.front().second && first.first == 0 && first.last == paths[first.path].size()) {
+                result.push_back(paths[first.path]);
+                continue;
+            }
+            shared_ptr<svg::Geometry> geometry = make_shared<svg::Geometry>();
+            for(pair<size_t, bool> &part : chain) {
+                const Run &run = runs[part.first];
+                svg::Path &path = paths[run.path];
+                svg::Transformation t = path.getTransformation();
+                for(size_t j = 0 ; j < run.last - run.first ; j++) {
+                    svg::PathElement *element = path[part.second ? run.last - 1 - j : run.first + j]->transformed(t);
+                    if(part.second) {
+                        svg::PathElement *reversed = element->reversed();
+                        delete element;
+                        element = reversed;
+                    }
+                    geometry->push_back(element);
+                }
+            }
+            result.push_back(svg::Path(geometry, svg::Transformation(), paths[first.path].getFill()));
+        }
+        paths.swap(result);
+        return joins;
+    }
+
+}
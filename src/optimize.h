@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include "svg.h"
+
+namespace optimize {
+
+    using namespace std;
+
+    //Outcome of removing duplicates
+    struct Report {
+        size_t removed = 0; //Elements removed or shortened
+        double savedLength = 0; //Cut length removed, in document units
+    };
+
+    //Removes lines lying on lines that come earlier in the document, within tolerance, and curves identical to earlier ones.
+    //Partly covered lines are shortened or split. Candidates are found through a spatial hash, so time grows
+    //almost linearly with the number of elements. Paths with removed elements get their own copy of the geometry.
+    //Filled paths are left complete if keepFilled is set, because hatching needs closed outlines.
+    Report removeDuplicates(vector<svg::Path> &paths, double tolerance, bool keepFilled);
+
+    //Chains paths and their continuous parts whose ends meet within tolerance, so they are cut without turning
+    //the tool off. Chains grow at both ends and parts are reversed when needed. Ends are found through a hash grid,
+    //so time grows almost linearly with the number of parts. Joined parts become a new path in document coordinates,
+    //other paths are kept as they are. Returns the number of joins made.
+    size_t joinPaths(vector<svg::Path> &paths, double tolerance, bool keepFilled);
+
+}
@@ -0,0 +1,88 @@
+#include <math.h>
+#include <sstream>
+
+#include "preview.h"
+
+namespace preview {
+
+    using namespace std;
+
+    static string format(const svg::Point &p) {
+        ostringstream text;
+        text << p.x << ' ' << p.y;
+        return text.str();
+    }
+
+    SvgEmitter::SvgEmitter(ostream &out) : out(out) {
+        minX = minY = INFINITY;
+        maxX = maxY = -INFINITY;
+    }
+
+    void SvgEmitter::include(const svg::Point &p) {
+        minX = min(minX, p.x);
+        minY = min(minY, p.y);
+        maxX = max(maxX, p.x);
+        maxY = max(maxY, p.y);
+    }
+
+    void SvgEmitter::continuePath(string &path) {
+        if(open != &path) path += "M" + format(position);
+        open = &path;
+        include(position);
+    }
+
+    void SvgEmitter::travel(const svg::Point &to) {
+        travels += "M" + format(position) + "L" + format(to);
+        include(position);
+        include(to);
+        position = to;
+        open = nullptr;
+    }
+
+    void SvgEmitter::line(const svg::Point &to) {
+        continuePath(cuts);
+        cuts += "L" + format(to);
+        include(to);
+        position = to;
+    }
+
+    void SvgEmitter::arc(const svg::Point &start, const svg::Point &to, const svg::Point &center, bool clockwise) {
+        continuePath(cuts);
+        //Clockwise on the machine is the positive direction of the document, with Y axis pointing down
+        double radius = hypot(start.x - center.x, start.y - center.y);
+        double sweep = atan2(to.y - center.y, to.x - center.x) - atan2(start.y - center.y, start.x - center.x);
+        sweep = fmod(sweep + 4 * M_PI, 2 * M_PI);
+        if(!clockwise) sweep = 2 * M_PI - sweep;
+        ostringstream text;
+        text << "A" << radius << ' ' << radius << " 0 " << (sweep > M_PI ? 1 : 0) << ' ' << (clockwise ? 1 : 0) << ' ' << format(to);
+        cuts += text.str();
+        //Bounds of the whole circle are close enough for a preview
+        include({center.x - radius, center.y - radius});
+        include({center.x + radius, center.y + radius});
+        position = to;
+    }
+
+    void SvgEmitter::raster(const svg::Point &to, double power) {
+        if(power > 0) {
+            continuePath(engraving);
+            engraving += "L" + format(to);
+            include(to);
+        } else {
+            open = nullptr;
+        }
+        position = to;
+    }
+
+    void SvgEmitter::close() {
+        if(minX > maxX) minX = minY = maxX = maxY = 0;
+        double margin = max(1.0, max(maxX - minX, maxY - minY) * 0.02);
+        out << "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"" << minX - margin << ' ' << minY - margin << ' '
+            << maxX - minX + 2 * margin << ' ' << maxY - minY + 2 * margin << "\">\n";
+        double width = margin / 10;
+        if(!engraving.empty()) out << "<path fill=\"none\" stroke=\"black\" stroke-width=\"" << width << "\" d=\"" << engraving << "\"/>\n";
+        if(!travels.empty()) out << "<path fill=\"none\" stroke=\"blue\" stroke-width=\"" << width / 2 << "\" d=\"" << travels << "\"/>\n";
+        if(!cuts.empty()) out << "<path fill=\"none\" stroke=\"red\" stroke-width=\"" << width << "\" d=\"" << cuts << "\"/>\n";
+        out << "</svg>\n";
+    }
+
+}
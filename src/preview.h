@@ -0,0 +1,35 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include "toolpath.h"
+
+//SVG drawing of a toolpath in document coordinates, cuts in red and travel in blue, for checking passes
+//without a machine
+namespace preview {
+
+    using namespace std;
+
+    class SvgEmitter : public toolpath::Emitter {
+    private:
+        ostream &out;
+        string cuts, travels, engraving;
+        svg::Point position = {0, 0};
+        string *open = nullptr; //Path whose last subpath ends at the position and can be continued
+        double minX, minY, maxX, maxY;
+
+        void include(const svg::Point &p);
+        void continuePath(string &path);
+    public:
+        SvgEmitter(ostream &out);
+        void toolOn() {};
+        void toolOff() {open = nullptr;};
+        void speed(double) {};
+        void travel(const svg::Point &to);
+        void line(const svg::Point &to);
+        void arc(const svg::Point &start, const svg::Point &to, const svg::Point &center, bool clockwise);
+        void raster(const svg::Point &to, double power);
+        void close(); //Writes the drawing
+    };
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Bounded lock-free queue connecting exactly one producer thread with one consumer thread. A side that can't go on
+//yields for a while and then sleeps until the other side wakes it, so a stalled stage doesn't keep a core busy.
+template<typename T>
+class SpscQueue {
+private:
+    std::vector<T> buffer;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head {0}; //Next slot to read, owned by the consumer
+    alignas(64) std::atomic<size_t> tail {0}; //Next slot to write, owned by the producer
+    alignas(64) std::atomic<bool> finished {false};
+    std::atomic<bool> cancelled {false};
+    static const int spin_limit = 64; //Yields before sleeping
+    std::mutex lock;
+    std::condition_variable changed;
+    std::atomic<int> sleeping {0};
+
+    //Returns once ready does
+    template<typename F>
+    void wait(F ready) {
+        for(int i = 0 ; i < spin_limit ; i++) {
+            if(ready()) return;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        sleeping.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        changed.wait(guard, ready);
+        sleeping.fetch_sub(1);
+    }
+
+    //Called after every change the other side could be waiting for
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(sleeping.load(std::memory_order_relaxed) == 0) return;
+        std::lock_guard<std::mutex> guard(lock);
+        changed.notify_all();
+    }
+
+public:
+    //Capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while(size < capacity) size <<= 1;
+        buffer.resize(size);
+        mask = size - 1;
+    }
+
+    //Blocks while the queue is full. Returns false if the queue was cancelled.
+    bool push(T &&item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        auto full = [&]() {return t - head.load(std::memory_order_acquire) > mask;};
+        wait([&]() {return !full() || cancelled.load(std::memory_order_relaxed);});
+        if(cancelled.load(std::memory_order_relaxed) || full()) return false;
+        buffer[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    //Blocks while the queue is empty. Returns false once the producer has finished and everything was read,
+    //or if the queue was cancelled and is empty. Items pushed before cancelling can still be read.
+    bool pop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        auto empty = [&]() {return h == tail.load(std::memory_order_acquire);};
+        wait([&]() {return !empty() || cancelled.load(std::memory_order_relaxed) || finished.load(std::memory_order_acquire);});
+        if(empty()) return false;
+        item = std::move(buffer[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    //Called by the producer after the last push
+    void finish() {
+        finished.store(true, std::memory_order_release);
+        wake();
+    }
+
+    //Wakes both sides up and makes further pushes fail, and pops once the queue is empty. Used when one of the
+    //stages fails, items left in the queue can then be read to release them.
+    void cancel() {
+        cancelled.store(true);
+        wake();
+    }
+};
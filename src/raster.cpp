@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <math.h>
+
+#include "raster.h"
+#include "scheduler.h"
+
+namespace raster {
+
+    using namespace std;
+
+    Bitmap resample(const Bitmap &bitmap, const svg::Image &image, double spacing, svg::Point &origin) {
+        //Where pixels end up in the image box
+        double px = image.x, py = image.y, pw = image.width, ph = image.height;
+        if(image.preserveAspectRatio) {
+            double scale = min(image.width / bitmap.width, image.height / bitmap.height);
+            pw = bitmap.width * scale;
+            ph = bitmap.height * scale;
+            px += (image.width - pw) / 2;
+            py += (image.height - ph) / 2;
+        }
+        svg::Transformation toDocument = image.transformation * svg::Translation(px, py) * svg::Scale(pw / bitmap.width, ph / bitmap.height);
+        svg::Transformation toPixels = toDocument.inverse();
+
+        //Grid covers bounding box of the transformed image
+        svg::Point corners[4] = {{0, 0}, {(double) bitmap.width, 0}, {0, (double) bitmap.height}, {(double) bitmap.width, (double) bitmap.height}};
+        svg::Point low = corners[0] * toDocument, high = low;
+        for(svg::Point &corner : corners) {
+            svg::Point p = corner * toDocument;
+            low.x = min(low.x, p.x);
+            low.y = min(low.y, p.y);
+            high.x = max(high.x, p.x);
+            high.y = max(high.y, p.y);
+        }
+        origin = low;
+        Bitmap darkness;
+        darkness.width = max(1, static_cast<int>(ceil((high.x - low.x) / spacing)));
+        darkness.height = max(1, static_cast<int>(ceil((high.y - low.y) / spacing)));
+        darkness.pixels.assign(static_cast<size_t>(darkness.width) * darkness.height, 0);
+
+        //Number of pixels covered by a single cell decides between averaging and interpolation
+        svg::Point zero = svg::Point {0, 0} * toPixels;
+        svg::Point dx = svg::Point {spacing, 0} * toPixels - zero;
+        svg::Point dy = svg::Point {0, spacing} * toPixels - zero;
+        double footprint = max(sqrt(dx.x * dx.x + dx.y * dx.y), sqrt(dy.x * dy.x + dy.y * dy.y));
+
+        scheduler::parallelFor(0, darkness.height, [&](size_t begin, size_t end) {
+            for(size_t row = begin ; row < end ; row++) {
+                for(int column = 0 ; column < darkness.width ; column++) {
+                    svg::Point center {origin.x + (column + 0.5) * spacing, origin.y + (row + 0.5) * spacing};
+                    svg::Point p = center * toPixels;
+                    if(p.x < 0 || p.y < 0 || p.x >= bitmap.width || p.y >= bitmap.height) continue;
+                    float luminance;
+                    if(footprint > 1) {
+                        int x1 = max(0, static_cast<int>(p.x - footprint / 2)), x2 = min(bitmap.width, static_cast<int>(ceil(p.x + footprint / 2)));
+                        int y1 = max(0, static_cast<int>(p.y - footprint / 2)), y2 = min(bitmap.height, static_cast<int>(ceil(p.y + footprint / 2)));
+                        double sum = 0;
+                        for(int y = y1 ; y < y2 ; y++) {
+                            for(int x = x1 ; x < x2 ; x++) sum += bitmap.pixels[static_cast<size_t>(y) * bitmap.width + x];
+                        }
+                        luminance = sum / max(1, (x2 - x1) * (y2 - y1));
+                    } else {
+                        double u = max(0.0, p.x - 0.5), v = max(0.0, p.y - 0.5);
+                        int x1 = min(static_cast<int>(u), bitmap.width - 1), y1 = min(static_cast<int>(v), bitmap.height - 1);
+                        int x2 = min(x1 + 1, bitmap.width - 1), y2 = min(y1 + 1, bitmap.height - 1);
+                        double fx = u - x1, fy = v - y1;
+                        const vector<float> &pixels = bitmap.pixels;
+                        size_t w = bitmap.width;
+                        luminance = (pixels[y1 * w + x1] * (1 - fx) + pixels[y1 * w + x2] * fx) * (1 - fy)
+                                  + (pixels[y2 * w + x1] * (1 - fx) + pixels[y2 * w + x2] * fx) * fy;
+                    }
+                    darkness.at(column, row) = 1 - luminance;
+                }
+            }
+        });
+        return darkness;
+    }
+
+    void quantize(Bitmap &darkness, Mode mode) {
+        if(mode == threshold) {
+            for(float &d : darkness.pixels) d = d >= 0.5f ? 1 : 0;
+        } else if(mode == grayscale) {
+            for(float &d : darkness.pixels) d = round(d * 255) / 255;
+        } else {
+            //Floyd-Steinberg error diffusion, in serpentine order to avoid directional artifacts
+            for(int y = 0 ; y < darkness.height ; y++) {
+                bool forward = y % 2 == 0;
+                int direction = forward ? 1 : -1;
+                for(int i = 0 ; i < darkness.width ; i++) {
+                    int x = forward ? i : darkness.width - 1 - i;
+                    float old = darkness.at(x, y);
+                    float value = old >= 0.5f ? 1 : 0;
+                    float error = old - value;
+                    darkness.at(x, y) = value;
+                    if(x + direction >= 0 && x + direction < darkness.width) darkness.at(x + direction, y) += error * 7 / 16;
+                    if(y + 1 < darkness.height) {
+                        if(x - direction >= 0 && x - direction < darkness.width) darkness.at(x - direction, y + 1) += error * 3 / 16;
+                        darkness.at(x, y + 1) += error * 5 / 16;
+                        if(x + direction >= 0 && x + direction < darkness.width) darkness.at(x + direction, y + 1) += error * 1 / 16;
+                    }
+                }
+            }
+        }
+    }
+
+    vector<Stroke> scan(Bitmap &darkness, svg::Point origin, const Settings &settings) {
+        vector<Stroke> strokes;
+        svg::Point position;
+        bool forward = true;
+        double spacing = settings.spacing;
+        for(int row = 0 ; row < darkness.height ; row++) {
+            int first = 0, last = darkness.width - 1;
+            while(first <= last && darkness.at(first, row) <= 0) first++;
+            while(last >= first && darkness.at(last, row) <= 0) last--;
+            if(first > last) continue; //Blank row
+
+            double y = origin.y + (row + 0.5) * spacing;
+            svg::Point start {origin.x + (forward ? first : last + 1) * spacing, y};
+            double distance = sqrt(pow(start.x - position.x, 2) + pow(start.y - position.y, 2));
+            if(strokes.empty() || distance > settings.skipDistance) {
+                strokes.push_back(Stroke {start, {}});
+            } else {
+                strokes.back().moves.push_back(Move {start, 0});
+            }
+
+            //Neighbouring cells of the same power become a single move
+            int count = last - first + 1;
+            for(int i = 0 ; i < count ;) {
+                int column = forward ? first + i : last - i;
+                float power = darkness.at(column, row);
+                int length = 1;
+                while(i + length < count && darkness.at(forward ? column + length : column - length, row) == power) length++;
+                double x = origin.x + (forward ? column + length : column - length + 1) * spacing;
+                if(power <= 0 && length * spacing > settings.skipDistance) {
+                    strokes.push_back(Stroke {svg::Point {x, y}, {}});
+                } else {
+                    strokes.back().moves.push_back(Move {svg::Point {x, y}, max(0.0f, min(1.0f, power))});
+                }
+                i += length;
+            }
+            position = strokes.back().moves.empty() ? strokes.back().start : strokes.back().moves.back().to;
+            forward = !forward;
+        }
+        return strokes;
+    }
+
+    vector<Stroke> engrave(const svg::Image &image, const Settings &settings) {
+        Bitmap bitmap = loadBitmap(image.href);
+        if(bitmap.width == 0 || bitmap.height == 0) return vector<Stroke>();
+        svg::Point origin;
+        Bitmap darkness = resample(bitmap, image, settings.spacing, origin);
+        quantize(darkness, settings.mode);
+        return scan(darkness, origin, settings);
+    }
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "svg.h"
+
+namespace raster {
+
+    using namespace std;
+
+    //Grayscale bitmap, 0 is black and 1 is white
+    struct Bitmap {
+        int width = 0;
+        int height = 0;
+        vector<float> pixels;
+        float& at(int x, int y) {return pixels[y * width + x];};
+    };
+
+    enum Mode {threshold = 0, dither = 1, grayscale = 2};
+
+    struct Settings {
+        double spacing = 0.1; //Distance between lines and between dots in a line
+        Mode mode = dither;
+        double skipDistance = 5; //White gaps longer than that are travelled with the tool off
+    };
+
+    //Move with constant laser power, from 0 to 1
+    struct Move {
+        svg::Point to;
+        double power;
+    };
+
+    //Moves done without turning the tool off, starting at a given point
+    struct Stroke {
+        svg::Point start;
+        vector<Move> moves;
+    };
+
+    //Decodes embedded or linked PNG/JPEG file. Throws if the image can't be read.
+    Bitmap loadBitmap(const string &href);
+
+    //Samples the image on a grid of cells in document coordinates. Returns darkness of every cell,
+    //origin is the top left corner of the grid.
+    Bitmap resample(const Bitmap &bitmap, const svg::Image &image, double spacing, svg::Point &origin);
+
+    //Reduces darkness to the levels that are engraved: on/off for threshold and dithering, 256 levels for grayscale
+    void quantize(Bitmap &darkness, Mode mode);
+
+    //Converts cells into bidirectional scan lines. Blank rows are skipped and white margins trimmed,
+    //so engraving time depends on the inked area rather than the size of the image.
+    vector<Stroke> scan(Bitmap &darkness, svg::Point origin, const Settings &settings);
+
+    //Decodes, resamples, quantizes and scans an image
+    vector<Stroke> engrave(const svg::Image &image, const Settings &settings);
+
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include <string>
+
+namespace res {
+
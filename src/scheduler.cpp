@@ -0,0 +1,204 @@
+#include <algorithm>
+
+#include "scheduler.h"
+#include "trace.h"
+
+namespace scheduler {
+
+    using namespace std;
+
+    //Pool and index of the worker running on the current thread
+    static thread_local const ThreadPool *workerPool = nullptr;
+    static thread_local int workerIndex = -1;
+
+    CancellationToken::CancellationToken() : flag(make_shared<atomic<bool>>(false)) {}
+
+    void CancellationToken::cancel() const {
+        flag->store(true);
+    }
+
+    bool CancellationToken::isCancelled() const {
+        return flag->load();
+    }
+
+    size_t Statistics::totalExecuted() const {
+        size_t sum = external;
+        for(size_t n : executed) sum += n;
+        return sum;
+    }
+
+    size_t Statistics::totalStolen() const {
+        size_t sum = 0;
+        for(size_t n : stolen) sum += n;
+        return sum;
+    }
+
+    ThreadPool::ThreadPool(unsigned int threads) {
+        if(threads == 0) threads = 1;
+        for(unsigned int i = 0 ; i < threads ; i++) workers.push_back(unique_ptr<Worker>(new Worker()));
+        for(unsigned int i = 0 ; i < threads ; i++) workers[i]->handle = thread(&ThreadPool::workerLoop, this, i);
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            lock_guard<mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for(auto &worker : workers) worker->handle.join();
+    }
+
+    ThreadPool& ThreadPool::shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    int ThreadPool::currentWorker() const {
+        return workerPool == this ? workerIndex : -1;
+    }
+
+    void ThreadPool::submit(function<void()> task) {
+        int index = currentWorker();
+        Worker &worker = *workers[index >= 0 ? index : nextWorker++ % workers.size()];
+        {
+            lock_guard<mutex> guard(worker.lock);
+            worker.tasks.push_back(move(task));
+        }
+        queued++;
+        {
+            lock_guard<mutex> guard(sleepLock);
+        }
+        wakeUp.notify_one();
+    }
+
+    //Takes the newest task of the given worker or, if it has none, the oldest task of another one
+    bool ThreadPool::popTask(size_t index, function<void()> &task, bool &stolen) {
+        if(queued == 0) return false;
+        {
+            Worker &own = *workers[index];
+            lock_guard<mutex> guard(own.lock);
+            if(!own.tasks.empty()) {
+                task = move(own.tasks.back());
+                own.tasks.pop_back();
+                queued--;
+                stolen = false;
+                return true;
+            }
+        }
+        for(size_t i = 1 ; i < workers.size() ; i++) {
+            Worker &victim = *workers[(index + i) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if(!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued--;
+                stolen = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::workerLoop(size_t index) {
+        workerPool = this;
+        workerIndex = index;
+        TRACE_THREAD("worker " + to_string(index));
+        Worker &worker = *workers[index];
+        function<void()> task;
+        bool stolen;
+        while(true) {
+            if(popTask(index, task, stolen)) {
+                task();
+                task = nullptr;
+                worker.executed++;
+                if(stolen) worker.stolen++;
+            } else {
+                unique_lock<mutex> guard(sleepLock);
+                if(stopping && queued == 0) return;
+                wakeUp.wait(guard, [this]() {return stopping || queued > 0;});
+            }
+        }
+    }
+
+    bool ThreadPool::runPending() {
+        int index = currentWorker();
+        function<void()> task;
+        bool stolen;
+        if(!popTask(index >= 0 ? index : nextWorker % workers.size(), task, stolen)) return false;
+        task();
+        if(index >= 0) {
+            workers[index]->executed++;
+            if(stolen) workers[index]->stolen++;
+        } else {
+            external++;
+        }
+        return true;
+    }
+
+    Statistics ThreadPool::getStatistics() const {
+        Statistics statistics;
+        for(auto &worker : workers) {
+            statistics.executed.push_back(worker->executed);
+            statistics.stolen.push_back(worker->stolen);
+        }
+        statistics.external = external;
+        return statistics;
+    }
+
+    TaskGroup::TaskGroup(ThreadPool &pool, CancellationToken token) : pool(pool), token(token) {}
+
+    TaskGroup::~TaskGroup() {
+        try {
+            wait();
+        } catch(...) {}
+    }
+
+    void TaskGroup::run(function<void()> task) {
+        pending++;
+        pool.submit([this, task]() {
+            if(!token.isCancelled()) {
+                try {
+                    task();
+                } catch(...) {
+                    lock_guard<mutex> guard(lock);
+                    if(!error) error = current_exception();
+                    token.cancel();
+                }
+            }
+            lock_guard<mutex> guard(lock);
+            if(--pending == 0) finished.notify_all();
+        });
+    }
+
+    void TaskGroup::wait() {
+        while(pending > 0) {
+            if(!pool.runPending()) {
+                unique_lock<mutex> guard(lock);
+                finished.wait_for(guard, chrono::milliseconds(1), [this]() {return pending == 0;});
+            }
+        }
+        lock_guard<mutex> guard(lock);
+        if(error) {
+            exception_ptr e = error;
+            error = nullptr;
+            rethrow_exception(e);
+        }
+    }
+
+    void parallelFor(size_t begin, size_t end, const function<void(size_t, size_t)> &body, size_t grain, ThreadPool &pool, CancellationToken token) {
+        if(begin >= end) return;
+        size_t count = end - begin;
+        if(grain == 0) grain = max<size_t>(1, count / (pool.size() * 8));
+        if(count <= grain) {
+            if(!token.isCancelled()) body(begin, end);
+            return;
+        }
+        TaskGroup group(pool, token);
+        for(size_t i = begin ; i < end ; i += grain) {
+            size_t chunkEnd = min(end, i + grain);
+            group.run([&body, i, chunkEnd]() {body(i, chunkEnd);});
+        }
+        group.wait();
+    }
+
+}
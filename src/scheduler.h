@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace scheduler {
+
+    using namespace std;
+
+    //Shared flag used to stop work that is no longer needed. Copies refer to the same flag.
+    class CancellationToken {
+    private:
+        shared_ptr<atomic<bool>> flag;
+    public:
+        CancellationToken();
+        void cancel() const;
+        bool isCancelled() const;
+    };
+
+    //Tasks executed and stolen by every worker, to check how well the load is balanced
+    struct Statistics {
+        vector<size_t> executed;
+        vector<size_t> stolen;
+        size_t external = 0; //Tasks executed by threads waiting for their task groups
+        size_t totalExecuted() const;
+        size_t totalStolen() const;
+    };
+
+    //Work-stealing thread pool. Every worker has its own deque; it takes its newest task first
+    //and, when the deque is empty, steals the oldest task of another worker.
+    class ThreadPool {
+    private:
+        struct Worker {
+            mutex lock;
+            deque<function<void()>> tasks;
+            atomic<size_t> executed {0};
+            atomic<size_t> stolen {0};
+            thread handle;
+        };
+
+        vector<unique_ptr<Worker>> workers;
+        mutex sleepLock;
+        condition_variable wakeUp;
+        atomic<size_t> queued {0};
+        atomic<size_t> nextWorker {0};
+        atomic<size_t> external {0};
+        bool stopping = false;
+
+        int currentWorker() const;
+        bool popTask(size_t worker, function<void()> &task, bool &stolen);
+        void workerLoop(size_t index);
+
+    public:
+        ThreadPool(unsigned int threads = thread::hardware_concurrency());
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        void submit(function<void()> task);
+        bool runPending(); //Runs one queued task on the calling thread. Returns false if there was none.
+        size_t size() const {return workers.size();};
+        Statistics getStatistics() const;
+
+        static ThreadPool& shared(); //Pool sized to the hardware, used by the parser, exporter and renderer
+    };
+
+    //Set of tasks that can be waited for together. The first exception thrown by a task
+    //cancels the group and is rethrown by wait().
+    class TaskGroup {
+    private:
+        ThreadPool &pool;
+        CancellationToken token;
+        atomic<size_t> pending {0};
+        mutex lock;
+        condition_variable finished;
+        exception_ptr error;
+    public:
+        TaskGroup(ThreadPool &pool = ThreadPool::shared(), CancellationToken token = CancellationToken());
+        ~TaskGroup();
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        void run(function<void()> task);
+        void wait(); //Helps executing queued tasks while waiting
+        void cancel() {token.cancel();};
+        const CancellationToken& getToken() const {return token;};
+    };
+
+    //Calls body(begin, end) for chunks of the range in parallel. Grain of 0 picks chunk size automatically.
+    void parallelFor(size_t begin, size_t end, const function<void(size_t, size_t)> &body, size_t grain = 0,
+                     ThreadPool &pool = ThreadPool::shared(), CancellationToken token = CancellationToken());
+
+}
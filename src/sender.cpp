@@ -0,0 +1,295 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <stdexcept>
+
+#include "estimate.h"
+#include "meatpack.h"
+#include "sender.h"
+#include "serial.h"
+
+namespace sender {
+
+    using namespace std;
+
+    string describe(const Metrics &metrics, bool average) {
+        double linesPerSecond = metrics.linesPerSecond, bytesPerSecond = metrics.bytesPerSecond;
+        if(average && metrics.elapsed > 0) {
+            linesPerSecond = metrics.lines / metrics.elapsed;
+            bytesPerSecond = metrics.bytes / metrics.elapsed;
+        }
+        char text[256];
+        snprintf(text, sizeof(text), "Sent %zu lines, %.1f kB in %s, %.0f lines/s, %.2f kB/s",
+            metrics.lines, metrics.bytes / 1000.0, estimate::formatTime(metrics.elapsed).c_str(), linesPerSecond, bytesPerSecond / 1000.0);
+        string result = text;
+        if(metrics.lines > metrics.acknowledged) result += ", " + to_string(metrics.lines - metrics.acknowledged) + " waiting";
+        if(metrics.errors > 0) result += ", " + to_string(metrics.errors) + " errors, last: " + metrics.lastError;
+        return result;
+    }
+
+    //Constant of a standard baud rate, false for other rates, which are set through serial::setCustomBaudRate
+    static bool baudConstant(int baudRate, speed_t &speed) {
+        switch(baudRate) {
+            case 9600: speed = B9600; return true;
+            case 19200: speed = B19200; return true;
+            case 38400: speed = B38400; return true;
+            case 57600: speed = B57600; return true;
+            case 115200: speed = B115200; return true;
+            case 230400: speed = B230400; return true;
+            case 460800: speed = B460800; return true;
+            case 500000: speed = B500000; return true;
+            case 921600: speed = B921600; return true;
+            case 1000000: speed = B1000000; return true;
+        }
+        return false;
+    }
+
+    static bool startsWith(const string &text, const char *prefix) {
+        return text.compare(0, strlen(prefix), prefix) == 0;
+    }
+
+    SendBuffer::SendBuffer(const string &device, const Settings &settings, function<void(const Metrics&)> progress) : settings(settings), progress(progress) {
+        if(settings.meatpack && settings.protocol != marlin) throw invalid_argument("MeatPack is only understood by Marlin");
+        if(settings.protocol == grbl && settings.bufferSize == 0) throw invalid_argument("Receive buffer size must be positive");
+        if(settings.protocol == marlin && settings.window == 0) throw invalid_argument("Window must be at least one line");
+        if(settings.baudRate <= 0) throw invalid_argument("Baud rate must be positive");
+        speed_t speed = B38400;
+        bool standardRate = baudConstant(settings.baudRate, speed);
+        fd = open(device.c_str(), O_RDWR | O_NOCTTY);
+        if(fd < 0) throw runtime_error("Unable to open " + device + ": " + strerror(errno));
+        termios options;
+        if(tcgetattr(fd, &options) != 0) {
+            close(fd);
+            throw runtime_error(device + " is not a serial port");
+        }
+        cfmakeraw(&options);
+        options.c_cflag |= CLOCAL | CREAD;
+        cfsetispeed(&options, speed);
+        cfsetospeed(&options, speed);
+        if(tcsetattr(fd, TCSANOW, &options) != 0) {
+            close(fd);
+            throw runtime_error("Unable to configure " + device + ": " + strerror(errno));
+        }
+        if(!standardRate && !serial::setCustomBaudRate(fd, settings.baudRate)) {
+            string error = strerror(errno);
+            close(fd);
+            throw runtime_error("Unable to set baud rate " + to_string(settings.baudRate) + " on " + device + ": " + error);
+        }
+        tcflush(fd, TCIOFLUSH);
+        setp(buffer, buffer + sizeof(buffer));
+        try {
+            waitForGreeting();
+            if(settings.meatpack) {
+                string command = meatpack::command(meatpack::enablePacking);
+                writeAll(command.data(), command.length());
+            }
+        } catch(...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    SendBuffer::~SendBuffer() {
+        if(fd >= 0) close(fd);
+    }
+
+    void SendBuffer::writeAll(const char *data, size_t length) {
+        while(length > 0) {
+            ssize_t written = write(fd, data, length);
+            if(written < 0) {
+                if(errno == EINTR) continue;
+                throw runtime_error(string("Writing to the controller failed: ") + strerror(errno));
+            }
+            data += written;
+            length -= written;
+        }
+    }
+
+    bool SendBuffer::receive(int timeout) {
+        pollfd descriptor = {fd, POLLIN, 0};
+        int ready = poll(&descriptor, 1, timeout);
+        if(ready < 0 && errno != EINTR) throw runtime_error(string("Reading from the controller failed: ") + strerror(errno));
+        if(ready <= 0) return false;
+        if(!(descriptor.revents & POLLIN)) throw runtime_error("Controller disconnected");
+        char data[4096];
+        ssize_t length = read(fd, data, sizeof(data));
+        if(length < 0 && (errno == EINTR || errno == EAGAIN)) return false;
+        if(length <= 0) throw runtime_error("Controller disconnected");
+        for(ssize_t i = 0 ; i < length ; i++) {
+            if(data[i] == '\n') {
+                if(!received.empty() && received.back() == '\r') received.pop_back();
+                if(!received.empty()) handleResponse(received);
+                received.clear();
+            } else {
+                received.push_back(data[i]);
+            }
+        }
+        return true;
+    }
+
+    void SendBuffer::handleResponse(const string &response) {
+        bool acknowledged = startsWith(response, "ok");
+        if(settings.protocol == grbl) {
+            if(startsWith(response, "ALARM")) throw runtime_error("Controller stopped with " + response);
+            if(startsWith(response, "error")) { //Replaces ok of the failed line
+                metrics.errors++;
+                metrics.lastError = response;
+                acknowledged = true;
+            }
+        } else if(startsWith(response, "Error") || startsWith(response, "!!")) { //Followed by ok
+            metrics.errors++;
+            metrics.lastError = response;
+        }
+        if(acknowledged && !pending.empty()) {
+            pendingBytes -= pending.front();
+            pending.pop_front();
+            metrics.acknowledged++;
+        }
+    }
+
+    //Boards reset when the port is opened and drop what they receive until they greet
+    void SendBuffer::waitForGreeting() {
+        clock::time_point deadline = clock::now() + chrono::milliseconds(static_cast<long long>(settings.startupTimeout * 1000));
+        size_t end = 0;
+        while(true) {
+            size_t newline = received.find('\n', end);
+            while(newline == string::npos) {
+                long long remaining = chrono::duration_cast<chrono::milliseconds>(deadline - clock::now()).count();
+                if(remaining <= 0) {
+                    received.clear();
+                    return;
+                }
+                char data[256];
+                pollfd descriptor = {fd, POLLIN, 0};
+                if(poll(&descriptor, 1, static_cast<int>(remaining)) <= 0) continue;
+                if(!(descriptor.revents & POLLIN)) throw runtime_error("Controller disconnected");
+                ssize_t length = read(fd, data, sizeof(data));
+                if(length == 0 || (length < 0 && errno != EINTR)) throw runtime_error("Controller disconnected");
+                if(length > 0) received.append(data, length);
+                newline = received.find('\n', end);
+            }
+            string response = received.substr(end, newline - end);
+            end = newline + 1;
+            if(startsWith(response, "Grbl") || startsWith(response, "start")) {
+                received.erase(0, end);
+                return;
+            }
+        }
+    }
+
+    void SendBuffer::send(const char *begin, const char *end) {
+        const char *comment = static_cast<const char*>(memchr(begin, ';', end - begin));
+        if(comment) end = comment;
+        while(begin < end && isspace(static_cast<unsigned char>(*begin))) begin++;
+        while(end > begin && isspace(static_cast<unsigned char>(end[-1]))) end--;
+        if(begin == end) return;
+
+        packed.assign(begin, end);
+        packed.push_back('\n');
+        if(settings.meatpack) {
+            string text;
+            text.swap(packed);
+            meatpack::packLine(text.data(), text.length(), false, packed);
+        }
+        size_t size = packed.length();
+        while(!pending.empty() && (settings.protocol == grbl ? pendingBytes + size > settings.bufferSize : pending.size() >= settings.window)) {
+            receive(100);
+            report(false);
+        }
+        if(metrics.lines == 0) started = reported = clock::now();
+        writeAll(packed.data(), size);
+        pending.push_back(size);
+        pendingBytes += size;
+        metrics.lines++;
+        metrics.bytes += size;
+        while(receive(0)) {}
+        report(false);
+    }
+
+    void SendBuffer::report(bool force) {
+        clock::time_point now = clock::now();
+        if(metrics.lines == 0 || (!force && now - reported < chrono::milliseconds(500))) return;
+        double interval = chrono::duration<double>(now - reported).count();
+        metrics.elapsed = chrono::duration<double>(now - started).count();
+        if(interval > 0) {
+            metrics.linesPerSecond = (metrics.lines - reportedLines) / interval;
+            metrics.bytesPerSecond = (metrics.bytes - reportedBytes) / interval;
+        }
+        reported = now;
+        reportedLines = metrics.lines;
+        reportedBytes = metrics.bytes;
+        if(progress) progress(metrics);
+    }
+
+    bool SendBuffer::pass(bool last) {
+        const char *text = pbase(), *end = pptr();
+        setp(buffer, buffer + sizeof(buffer));
+        if(!error.empty()) return false;
+        try {
+            while(text < end) {
+                const char *newline = static_cast<const char*>(memchr(text, '\n', end - text));
+                if(!newline) {
+                    line.append(text, end);
+                    break;
+                }
+                if(line.empty()) {
+                    send(text, newline);
+                } else {
+                    line.append(text, newline);
+                    send(line.data(), line.data() + line.length());
+                    line.clear();
+                }
+                text = newline + 1;
+            }
+            if(last && !line.empty()) {
+                send(line.data(), line.data() + line.length());
+                line.clear();
+            }
+        } catch(exception const &e) {
+            error = e.what();
+        }
+        return error.empty();
+    }
+
+    int SendBuffer::overflow(int c) {
+        if(finished || !pass(false)) return EOF;
+        if(c != EOF) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return c == EOF ? 0 : c;
+    }
+
+    int SendBuffer::sync() {
+        return !finished && pass(false) ? 0 : -1;
+    }
+
+    Metrics SendBuffer::finish() {
+        if(!finished) {
+            finished = true;
+            if(pass(true)) {
+                try {
+                    while(!pending.empty()) {
+                        receive(100);
+                        report(false);
+                    }
+                    if(settings.meatpack) {
+                        string command = meatpack::command(meatpack::disablePacking);
+                        writeAll(command.data(), command.length());
+                    }
+                } catch(exception const &e) {
+                    error = e.what();
+                }
+            }
+            if(metrics.lines > 0) metrics.elapsed = chrono::duration<double>(clock::now() - started).count();
+        }
+        if(!error.empty()) throw runtime_error(error);
+        return metrics;
+    }
+
+}
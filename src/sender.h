@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <streambuf>
+#include <string>
+
+//Streaming GCODE straight to a controller over a serial port or pseudo terminal, while it is being generated
+namespace sender {
+
+    using namespace std;
+
+    enum Protocol {grbl = 0, marlin = 1};
+
+    struct Settings {
+        Protocol protocol = grbl;
+        int baudRate = 115200;
+        size_t bufferSize = 128; //Bytes of the GRBL receive buffer, kept full by counting characters
+        size_t window = 4; //Lines Marlin may hold before acknowledging them
+        bool meatpack = false; //Marlin only
+        double startupTimeout = 3; //Seconds to wait for the greeting of a controller reset by opening the port
+    };
+
+    struct Metrics {
+        size_t lines = 0; //Sent
+        size_t acknowledged = 0;
+        size_t bytes = 0; //Sent over the port, after packing
+        size_t errors = 0;
+        string lastError;
+        double elapsed = 0; //Seconds since the first line
+        double linesPerSecond = 0; //Over the last second or so
+        double bytesPerSecond = 0;
+    };
+
+    //One line summary of the transfer. With average set, rates are computed over the whole transfer.
+    string describe(const Metrics &metrics, bool average = false);
+
+    //Sends lines of text as they are written. Comments and empty lines are left out, since Marlin doesn't acknowledge
+    //them. With GRBL, lines are sent while their characters fit in the receive buffer, counting those not acknowledged
+    //yet. With Marlin, up to the window of lines is sent ahead of "ok" responses.
+    //Writing blocks while the controller is busy, which holds back generation. Errors of the port are reported by finish.
+    class SendBuffer : public streambuf {
+    private:
+        typedef chrono::steady_clock clock;
+
+        int fd = -1;
+        Settings settings;
+        function<void(const Metrics&)> progress;
+        Metrics metrics;
+        deque<size_t> pending; //Sizes of lines waiting for acknowledgement
+        size_t pendingBytes = 0;
+        string line; //Incomplete line
+        string received; //Incomplete response
+        string packed;
+        string error; //Failure of the port, ends sending
+        clock::time_point started, reported;
+        size_t reportedLines = 0, reportedBytes = 0;
+        bool finished = false;
+        char buffer[1 << 14];
+
+        void writeAll(const char *data, size_t length);
+        bool receive(int timeout); //Handles responses arriving within timeout milliseconds, false if there were none
+        void handleResponse(const string &response);
+        void waitForGreeting();
+        void send(const char *begin, const char *end); //One line without the line break
+        void report(bool force);
+        bool pass(bool last); //Sends complete lines and, if last, the incomplete one
+
+    protected:
+        int overflow(int c);
+        int sync();
+
+    public:
+        //Opens the port, throws if it can't be used. Progress is reported about twice a second.
+        SendBuffer(const string &device, const Settings &settings, function<void(const Metrics&)> progress = nullptr);
+        ~SendBuffer();
+        SendBuffer(const SendBuffer&) = delete;
+        SendBuffer& operator=(const SendBuffer&) = delete;
+
+        //Sends the rest and waits until every line is acknowledged. Throws if sending failed.
+        Metrics finish();
+    };
+
+}
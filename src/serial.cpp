@@ -0,0 +1,29 @@
+#include <errno.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <asm/termbits.h>
+#endif
+
+#include "serial.h"
+
+namespace serial {
+
+#if defined(__linux__) && defined(BOTHER)
+    bool setCustomBaudRate(int fd, int baudRate) {
+        termios2 options;
+        if(ioctl(fd, TCGETS2, &options) != 0) return false;
+        //Input and output rates are both taken from the speed fields
+        options.c_cflag &= ~(CBAUD | CBAUD << IBSHIFT);
+        options.c_cflag |= BOTHER | BOTHER << IBSHIFT;
+        options.c_ispeed = baudRate;
+        options.c_ospeed = baudRate;
+        return ioctl(fd, TCSETS2, &options) == 0;
+    }
+#else
+    bool setCustomBaudRate(int, int) {
+        errno = ENOTSUP;
+        return false;
+    }
+#endif
+
+}
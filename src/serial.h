@@ -0,0 +1,11 @@
+#pragma once
+
+//Serial port settings not covered by termios. Kept apart from sender.cpp because the kernel headers they need
+//define termios differently than <termios.h>.
+namespace serial {
+
+    //Sets any baud rate on an open serial port, including rates without a B* constant like 250000. Returns false
+    //and sets errno if the port refuses it or the system can't set custom rates.
+    bool setCustomBaudRate(int fd, int baudRate);
+
+}
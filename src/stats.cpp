@@ -0,0 +1,171 @@
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include "stats.h"
+#include "trace.h"
+
+namespace stats {
+
+    using namespace std;
+
+    struct StageRecord {
+        atomic<uint64_t> nanoseconds {0};
+        atomic<uint64_t> calls {0};
+        atomic<uint64_t> allocations {0};
+        atomic<size_t> peakMemory {0};
+    };
+
+    static const char *stage_names[stage_count] = {"read cache", "read file", "parse XML", "parse tree", "parse geometry", "write cache", "remove duplicates", "join paths", "export GCODE"};
+    static const char *counter_names[counter_count] = {"lines", "cubic beziers", "quadratic beziers", "arcs", "paths", "images", "points flattened", "bytes written", "reused geometries"};
+
+    static StageRecord stageRecords[stage_count];
+    static atomic<uint64_t> counters[counter_count];
+    static atomic<uint64_t> allocationCount {0};
+
+    //Passes are named at run time, so they are kept in order of first run
+    struct PassRecord {
+        string name;
+        uint64_t nanoseconds = 0;
+        uint64_t calls = 0;
+    };
+    static mutex passMutex;
+    static vector<PassRecord> passRecords;
+
+#ifdef LASERWORKS_STATS
+    bool enabled() {return true;}
+#else
+    bool enabled() {return false;}
+#endif
+
+    void reset() {
+        for(StageRecord &record : stageRecords) {
+            record.nanoseconds = 0;
+            record.calls = 0;
+            record.allocations = 0;
+            record.peakMemory = 0;
+        }
+        for(atomic<uint64_t> &counter : counters) counter = 0;
+        lock_guard<mutex> lock(passMutex);
+        passRecords.clear();
+    }
+
+    void add(Counter counter, uint64_t value) {
+        counters[counter].fetch_add(value, memory_order_relaxed);
+    }
+
+    void record(Stage stage, uint64_t nanoseconds, uint64_t allocations) {
+        StageRecord &record = stageRecords[stage];
+        record.nanoseconds += nanoseconds;
+        record.calls++;
+        record.allocations += allocations;
+        size_t memory = peakMemory();
+        size_t previous = record.peakMemory.load();
+        while(memory > previous && !record.peakMemory.compare_exchange_weak(previous, memory));
+    }
+
+    void recordPass(const string &name, uint64_t nanoseconds) {
+        if(!enabled()) return;
+        lock_guard<mutex> lock(passMutex);
+        for(PassRecord &record : passRecords) {
+            if(record.name == name) {
+                record.nanoseconds += nanoseconds;
+                record.calls++;
+                return;
+            }
+        }
+        PassRecord record;
+        record.name = name;
+        record.nanoseconds = nanoseconds;
+        record.calls = 1;
+        passRecords.push_back(record);
+    }
+
+    uint64_t allocations() {
+        return allocationCount.load(memory_order_relaxed);
+    }
+
+    size_t peakMemory() {
+        struct rusage usage;
+        if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+        return static_cast<size_t>(usage.ru_maxrss);
+    }
+
+    string report() {
+        if(!enabled()) return "Statistics are not available, the program was built without LASERWORKS_STATS.\n";
+        string result;
+        char line[256];
+        //Resident size can't be measured per stage, and stages of the pipeline overlap, so it is the largest one
+        //of the process by the end of the stage
+        snprintf(line, sizeof(line), "%-18s %10s %6s %12s %16s\n", "Stage", "Time (ms)", "Calls", "Allocations", "Peak so far (MB)");
+        result += line;
+        for(int i = 0 ; i < stage_count ; i++) {
+            StageRecord &record = stageRecords[i];
+            if(record.calls == 0) continue;
+            snprintf(line, sizeof(line), "%-18s %10.1f %6llu %12llu %16.1f\n", stage_names[i], record.nanoseconds / 1e6,
+                static_cast<unsigned long long>(record.calls), static_cast<unsigned long long>(record.allocations), record.peakMemory / 1024.0);
+            result += line;
+        }
+        {
+            lock_guard<mutex> lock(passMutex);
+            for(PassRecord &record : passRecords) {
+                snprintf(line, sizeof(line), "  %-16s %10.1f %6llu\n", record.name.c_str(), record.nanoseconds / 1e6,
+                    static_cast<unsigned long long>(record.calls));
+                result += line;
+            }
+        }
+        for(int i = 0 ; i < counter_count ; i++) {
+            snprintf(line, sizeof(line), "%-18s %llu\n", counter_names[i], static_cast<unsigned long long>(counters[i].load()));
+            result += line;
+        }
+        return result;
+    }
+
+    string summary() {
+        if(!enabled()) return string();
+        string result;
+        char part[128];
+        for(int i = 0 ; i < stage_count ; i++) {
+            if(stageRecords[i].calls == 0) continue;
+            snprintf(part, sizeof(part), "%s%s %.0f ms", result.empty() ? "" : ", ", stage_names[i], stageRecords[i].nanoseconds / 1e6);
+            result += part;
+        }
+        uint64_t elements = counters[lines] + counters[cubicBeziers] + counters[quadraticBeziers] + counters[arcs];
+        snprintf(part, sizeof(part), " | %llu elements, %llu points, %.1f MB written, peak memory %.0f MB",
+            static_cast<unsigned long long>(elements), static_cast<unsigned long long>(counters[pointsFlattened].load()),
+            counters[bytesWritten] / 1048576.0, peakMemory() / 1024.0);
+        result += part;
+        return result;
+    }
+
+    ScopedTimer::ScopedTimer(Stage stage) : stage(stage), start(chrono::steady_clock::now()), startAllocations(allocations()) {}
+
+    ScopedTimer::~ScopedTimer() {
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        record(stage, chrono::duration_cast<chrono::nanoseconds>(end - start).count(), allocations() - startAllocations);
+        trace::record(stage_names[stage], start, end);
+    }
+
+}
+
+#ifdef LASERWORKS_STATS
+//Counting allocations of the whole program. Arrays and nothrow variants go through these by default.
+void* operator new(size_t size) {
+    stats::allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void *pointer = malloc(size ? size : 1);
+    if(!pointer) throw std::bad_alloc();
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    free(pointer);
+}
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+//Timing and counters of conversions. Built only with LASERWORKS_STATS defined, otherwise the macros
+//below expand to nothing and instrumented code costs nothing.
+namespace stats {
+
+    using namespace std;
+
+    enum Stage {readCache, readFile, parseXml, parseTree, parseGeometry, writeCache, removeDuplicates, joinPaths, exportGcode, stage_count};
+    enum Counter {lines, cubicBeziers, quadraticBeziers, arcs, paths, images, pointsFlattened, bytesWritten, reusedGeometries, counter_count};
+
+    bool enabled();
+    void reset();
+    void add(Counter counter, uint64_t value);
+    void record(Stage stage, uint64_t nanoseconds, uint64_t allocations);
+    void recordPass(const string &name, uint64_t nanoseconds); //Toolpath pass, reported under export
+    uint64_t allocations(); //Calls of operator new since the program started
+    size_t peakMemory(); //Largest resident size of the process so far, in kB
+
+    string report(); //Table of stages and counters
+    string summary(); //Single line for a status bar
+
+    //Adds time and allocations between construction and destruction to a stage, and a span to the trace
+    class ScopedTimer {
+    private:
+        Stage stage;
+        chrono::steady_clock::time_point start;
+        uint64_t startAllocations;
+    public:
+        ScopedTimer(Stage stage);
+        ~ScopedTimer();
+    };
+
+}
+
+#ifdef LASERWORKS_STATS
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+#define STATS_TIMER(stage) stats::ScopedTimer STATS_CONCAT(statsTimer, __LINE__)(stats::stage)
+#define STATS_COUNT(counter, value) stats::add(stats::counter, value)
+#else
+#define STATS_TIMER(stage)
+#define STATS_COUNT(counter, value)
+#endif
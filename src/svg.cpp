@@ -8,8 +8,11 @@
 
 #include "svg.h"
 #include "utils.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "trace.h"
 
-#define PI 3.14159265
+#define PI 3.14159265358979323846
 
 namespace svg {
 
@@ -127,30 +130,226 @@ namespace svg {
         return result;
     }
 
-    //Parses SVG nodes recursively. Applies transformation matrices to paths.
-    vector<Path>* parseNode(xml_node<> *node, const Transformation t = Transformation()) {
-        vector<Path>* result = new vector<Path>();
+    //Parses SVG nodes recursively. Collects path instances together with their transformation matrices.
+    void parseNode(xml_node<> *node, const Transformation &t, const Fill &fill, ParseContext &context, vector<PathInstance> &instances) {
+#ifdef LASERWORKS_STATS
+        xml_attribute<> *id = trace::active() ? node->first_attribute("id") : nullptr;
+        TRACE_SPAN("parseNode", id ? id->value() : node->name());
+#endif
         for(xml_node<> *n = node->first_node() ; n ; n = n->next_sibling()) {
-            char* name = n->name();
-            Transformation t2;
-            xml_attribute<> *attr = n->first_attribute("transform");
-            if(attr) {
-                t2 = parseTransformation(string(attr->value()));
+            parseElement(n, t, fill, context, instances, false);
+        }
+    }
+
+    //Parses a single element. Symbols are drawn only when referenced by use elements, definitions never directly.
+    void parseElement(xml_node<> *n, const Transformation &t, const Fill &fill, ParseContext &context, vector<PathInstance> &instances, bool referenced) {
+        char* name = n->name();
+        Transformation t2;
+        xml_attribute<> *attr = n->first_attribute("transform");
+        if(attr) {
+            t2 = parseTransformation(string(attr->value()));
+        }
+        t2 = t * t2;
+        Fill fill2 = parseFill([n](const char *name, string &value) {
+            xml_attribute<> *attr = n->first_attribute(name);
+            if(attr) value = attr->value();
+            return attr != nullptr;
+        }).inherit(fill);
+        if(strcmp(name, "g") == 0 || (referenced && strcmp(name, "symbol") == 0)) {
+            parseNode(n, t2, fill2, context, instances);
+        } else if(isShape(name) && (strcmp(name, "path") != 0 || n->first_attribute("d"))) {
+            auto found = context.geometryIndices.find(n);
+            size_t index;
+            if(found == context.geometryIndices.end()) {
+                index = context.geometries.size();
+                context.geometries.push_back(n);
+                context.geometryIndices[n] = index;
+            } else {
+                index = found->second;
             }
-            t2 = t * t2;
-            if(strcmp(name, "g") == 0) {
-                vector<Path>* paths = parseNode(n, t2);
-                result->insert(result->end(), paths->begin(), paths->end());
-                delete paths;
-            } else if(strcmp(name, "path") == 0) {
-                xml_attribute<> *attr = n->first_attribute("d");
-                if(attr) {
-                    string str(attr->value());
-                    result->push_back(Path(str, t2));
-                }
+            if(strcmp(name, "line") == 0) fill2.paint = 0; //Lines have no inside
+            instances.push_back(PathInstance {index, t2, fill2});
+        } else if(strcmp(name, "image") == 0) { //Collected with the definition when referenced
+            xml_attribute<> *href = n->first_attribute("href");
+            if(!href) href = n->first_attribute("xlink:href");
+            if(!href) return;
+            Image image;
+            image.href = href->value();
+            if(image.href.compare(0, 5, "data:") != 0) {
+                if(image.href.compare(0, 7, "file://") == 0) image.href = image.href.substr(7);
+                if(image.href[0] != '/') image.href = context.directory + image.href;
+            }
+            xml_attribute<> *attr;
+            if((attr = n->first_attribute("x"))) image.x = atof(attr->value());
+            if((attr = n->first_attribute("y"))) image.y = atof(attr->value());
+            if((attr = n->first_attribute("width"))) image.width = atof(attr->value());
+            if((attr = n->first_attribute("height"))) image.height = atof(attr->value());
+            if((attr = n->first_attribute("preserveAspectRatio"))) image.preserveAspectRatio = strncmp(attr->value(), "none", 4) != 0;
+            image.transformation = t2;
+            if(image.width > 0 && image.height > 0) context.images.push_back(image);
+        } else if(strcmp(name, "use") == 0) {
+            xml_attribute<> *href = n->first_attribute("href");
+            if(!href) href = n->first_attribute("xlink:href");
+            if(!href || href->value()[0] != '#') return;
+            auto target = context.ids.find(string(href->value() + 1));
+            if(target == context.ids.end() || context.resolving.count(target->second)) return;
+
+            //Referenced element is parsed once and reused by every other use element
+            auto definition = context.definitions.find(target->second);
+            if(definition == context.definitions.end()) {
+                vector<PathInstance> referencedInstances;
+                vector<Image> images; //Images of the document so far, while those of the definition are collected
+                swap(images, context.images);
+                context.resolving.insert(target->second);
+                parseElement(target->second, Transformation(), Fill(), context, referencedInstances, true);
+                context.resolving.erase(target->second);
+                swap(images, context.images);
+                context.definitionImages[target->second] = images;
+                definition = context.definitions.insert(make_pair(target->second, referencedInstances)).first;
+            }
+
+            xml_attribute<> *x = n->first_attribute("x");
+            xml_attribute<> *y = n->first_attribute("y");
+            Transformation t3 = t2 * Translation(x ? atof(x->value()) : 0, y ? atof(y->value()) : 0);
+            for(const PathInstance &instance : definition->second) {
+                instances.push_back(PathInstance {instance.geometry, t3 * instance.transformation, instance.fill.inherit(fill2)});
+            }
+            for(Image image : context.definitionImages[target->second]) { //Engraved where the use element puts them
+                image.transformation = t3 * image.transformation;
+                context.images.push_back(image);
             }
         }
-        return result;
+    }
+
+    bool isShape(const char *name) {
+        static const char *shapes[] = {"path", "rect", "circle", "ellipse", "line", "polyline", "polygon"};
+        for(const char *shape : shapes) {
+            if(strcmp(name, shape) == 0) return true;
+        }
+        return false;
+    }
+
+    //Reads numeric attribute. Units are ignored, just like in the rest of the document.
+    static double getNumber(const AttributeGetter &attribute, const char *name, double fallback = 0) {
+        string value;
+        if(!attribute(name, value) || value.empty()) return fallback;
+        return atof(value.c_str());
+    }
+
+    shared_ptr<Geometry> createGeometry(const char *name, const AttributeGetter &attribute) {
+        string value;
+        if(strcmp(name, "path") == 0) {
+            if(!attribute("d", value)) return nullptr;
+            return make_shared<Geometry>(value);
+        }
+
+        shared_ptr<Geometry> geometry = make_shared<Geometry>();
+        if(strcmp(name, "rect") == 0) { //Four lines, rounded corners are quarter arcs
+            double x = getNumber(attribute, "x");
+            double y = getNumber(attribute, "y");
+            double w = getNumber(attribute, "width");
+            double h = getNumber(attribute, "height");
+            double rx = getNumber(attribute, "rx", -1);
+            double ry = getNumber(attribute, "ry", -1);
+            if(rx < 0) rx = ry;
+            if(ry < 0) ry = rx;
+            if(rx < 0) rx = ry = 0;
+            rx = min(rx, w / 2);
+            ry = min(ry, h / 2);
+            if(w <= 0 || h <= 0) return geometry;
+            Point corners[4] = {{x + w - rx, y + ry}, {x + w - rx, y + h - ry}, {x + rx, y + h - ry}, {x + rx, y + ry}};
+            Point lines[4][2] = {
+                {{x + rx, y}, {x + w - rx, y}},
+                {{x + w, y + ry}, {x + w, y + h - ry}},
+                {{x + w - rx, y + h}, {x + rx, y + h}},
+                {{x, y + h - ry}, {x, y + ry}}
+            };
+            for(int i = 0 ; i < 4 ; i++) {
+                if(lines[i][0].x != lines[i][1].x || lines[i][0].y != lines[i][1].y) geometry->push_back(new Line(lines[i][0], lines[i][1]));
+                if(rx > 0 && ry > 0) geometry->push_back(new Arc(corners[i], rx, ry, 0, (i - 1) * PI / 2, PI / 2));
+            }
+        } else if(strcmp(name, "circle") == 0 || strcmp(name, "ellipse") == 0) { //Two half arcs
+            Point c {getNumber(attribute, "cx"), getNumber(attribute, "cy")};
+            double rx, ry;
+            if(name[0] == 'c') {
+                rx = ry = getNumber(attribute, "r");
+            } else {
+                rx = getNumber(attribute, "rx");
+                ry = getNumber(attribute, "ry");
+            }
+            if(rx <= 0 || ry <= 0) return geometry;
+            geometry->push_back(new Arc(c, rx, ry, 0, 0, PI));
+            geometry->push_back(new Arc(c, rx, ry, 0, PI, PI));
+        } else if(strcmp(name, "line") == 0) {
+            Point p1 {getNumber(attribute, "x1"), getNumber(attribute, "y1")};
+            Point p2 {getNumber(attribute, "x2"), getNumber(attribute, "y2")};
+            geometry->push_back(new Line(p1, p2));
+        } else if(strcmp(name, "polyline") == 0 || strcmp(name, "polygon") == 0) {
+            if(!attribute("points", value)) return geometry;
+            vector<string> *numbers = splitD(value);
+            vector<Point> points;
+            for(size_t i = 0 ; i + 1 < numbers->size() ; i += 2) {
+                points.push_back(Point {parseDouble(numbers->at(i)), parseDouble(numbers->at(i + 1))});
+            }
+            delete numbers;
+            for(size_t i = 1 ; i < points.size() ; i++) geometry->push_back(new Line(points[i - 1], points[i]));
+            if(strcmp(name, "polygon") == 0 && points.size() > 2) geometry->push_back(new Line(points.back(), points.front()));
+        }
+        return geometry;
+    }
+
+    //Attributes createGeometry reads, the only ones that change the geometry of an element
+    static const char *geometry_attributes[] = {"d", "x", "y", "width", "height", "rx", "ry", "cx", "cy", "r", "x1", "y1", "x2", "y2", "points"};
+
+    //FNV-1a, continued from the hash so far
+    static uint64_t hashBytes(uint64_t hash, const char *data, size_t length) {
+        for(size_t i = 0 ; i < length ; i++) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 0x100000001B3ULL;
+        }
+        return hash;
+    }
+
+    uint64_t hashElement(const char *name, const AttributeGetter &attribute) {
+        uint64_t hash = hashBytes(0xCBF29CE484222325ULL, name, strlen(name) + 1);
+        string value;
+        for(const char *attributeName : geometry_attributes) {
+            if(!attribute(attributeName, value)) continue;
+            hash = hashBytes(hash, attributeName, strlen(attributeName) + 1);
+            hash = hashBytes(hash, value.data(), value.length() + 1);
+        }
+        return hash;
+    }
+
+#ifdef LASERWORKS_STATS
+    //Adds elements of a geometry to the counters of their types
+    static void countElements(const Geometry *geometry) {
+        if(!geometry) return;
+        uint64_t lines = 0, cubics = 0, quadratics = 0, arcs = 0;
+        for(PathElement *element : *geometry) {
+            if(dynamic_cast<Line*>(element)) lines++;
+            else if(dynamic_cast<CubicBezier*>(element)) cubics++;
+            else if(dynamic_cast<QuadraticBezier*>(element)) quadratics++;
+            else if(dynamic_cast<Arc*>(element)) arcs++;
+        }
+        stats::add(stats::lines, lines);
+        stats::add(stats::cubicBeziers, cubics);
+        stats::add(stats::quadraticBeziers, quadratics);
+        stats::add(stats::arcs, arcs);
+    }
+#define STATS_COUNT_ELEMENTS(geometry) countElements(geometry)
+#else
+#define STATS_COUNT_ELEMENTS(geometry)
+#endif
+
+    //Finds all elements with id attribute, so use elements can reference them
+    void collectIds(xml_node<> *node, ParseContext &context) {
+        for(xml_node<> *n = node->first_node() ; n ; n = n->next_sibling()) {
+            if(n->type() != node_element) continue;
+            xml_attribute<> *id = n->first_attribute("id");
+            if(id) context.ids[string(id->value())] = n;
+            collectIds(n, context);
+        }
     }
 
 
@@ -170,15 +369,58 @@ namespace svg {
         return result;
     }
 
-    Path::~Path() {
+    Geometry::~Geometry() {
         for(int i = 0 ; i < size() ; i++) {
             delete at(i);
         }
         clear();
     }
 
+    Path::Path() : geometry(make_shared<Geometry>()) {}
+
+    Path::Path(const string &d, Transformation t) : geometry(make_shared<Geometry>(d)), transformation(t) {}
+
+    Path::Path(shared_ptr<Geometry> geometry, Transformation t, Fill fill) : geometry(geometry), transformation(t), fill(fill) {}
+
+    Fill Fill::inherit(const Fill &parent) const {
+        Fill result = *this;
+        if(result.paint == -1) result.paint = parent.paint;
+        if(result.evenOdd == -1) result.evenOdd = parent.evenOdd;
+        return result;
+    }
+
+    //Removes whitespace from both ends
+    static string trim(const string &str) {
+        size_t first = str.find_first_not_of(" \t\r\n");
+        if(first == string::npos) return string();
+        return str.substr(first, str.find_last_not_of(" \t\r\n") - first + 1);
+    }
+
+    Fill parseFill(const function<bool(const char*, string&)> &attribute) {
+        Fill fill;
+        auto apply = [&fill](const string &name, const string &value) {
+            if(value == "inherit") return;
+            if(name == "fill") fill.paint = value == "none" ? 0 : 1;
+            else if(name == "fill-rule") fill.evenOdd = value == "evenodd" ? 1 : 0;
+        };
+        string value;
+        if(attribute("fill", value)) apply("fill", trim(value));
+        if(attribute("fill-rule", value)) apply("fill-rule", trim(value));
+        if(attribute("style", value)) {
+            size_t position = 0;
+            while(position < value.length()) {
+                size_t end = value.find(';', position);
+                if(end == string::npos) end = value.length();
+                size_t colon = value.find(':', position);
+                if(colon < end) apply(trim(value.substr(position, colon - position)), trim(value.substr(colon + 1, end - colon - 1)));
+                position = end + 1;
+            }
+        }
+        return fill;
+    }
+
     //Parses SVG Path 
-    Path::Path(const string &d, Transformation t) : transformation(t) {
+    Geometry::Geometry(const string &d) {
         vector<string> *vec = splitD(d);
         vector<string>::iterator iterator = vec->begin(), end = vec->end();
 
@@ -253,9 +495,16 @@ namespace svg {
                     } else {
                         throw invalid_argument("Failed Loading SVG Path. Invalid usage of \"shorthand\".");
                     }
-                } else if(command == 'A') {
-                    //Not implemented yet
-                    iterator += 7;
+                } else if(command == 'A') { //Parses elliptical arc
+                    if(iterator + 6 >= end) throw out_of_range("Failed loading SVG Path.");
+                    double rx = parseDouble(*(iterator++));
+                    double ry = parseDouble(*(iterator++));
+                    double rotation = parseDouble(*(iterator++)) / 180 * PI;
+                    bool largeArc = parseDouble(*(iterator++)) != 0;
+                    bool sweep = parseDouble(*(iterator++)) != 0;
+                    Point p = iterateAndGetPoints(1, iterator, end, r)[0];
+                    push_back(endpointArc(current, rx, ry, rotation, largeArc, sweep, p));
+                    current = p;
                 }
 
             } catch(exception& e) {
@@ -266,31 +515,279 @@ namespace svg {
         delete vec;
     }
 
-    //Loads all paths from svg file
-    vector<Path>* loadPaths(string path) {
+    //Loads all paths and images from svg file
+    Document* loadDocument(string path, const Document *previous) {
         unsigned int len = 0;
-        ifstream file(path, std::ios::binary);
-        len = file.tellg();
-        file.seekg(0, ios::end);
-        len = static_cast<unsigned int>(file.tellg()) - len;
-        char *cstr = new char[len + 1];
-        cstr[len] = 0;
-        file.seekg(0, ios::beg);
-        file.read(cstr, len);
-        file.close();
+        char *cstr;
+        {
+            STATS_TIMER(readFile);
+            ifstream file(path, std::ios::binary);
+            if(!file.good()) throw invalid_argument("Unable to open " + path);
+            len = file.tellg();
+            file.seekg(0, ios::end);
+            len = static_cast<unsigned int>(file.tellg()) - len;
+            cstr = new char[len + 1];
+            cstr[len] = 0;
+            file.seekg(0, ios::beg);
+            file.read(cstr, len);
+            file.close();
+        }
 
         xml_document<> doc;
-        doc.parse<0>(cstr);
+        {
+            STATS_TIMER(parseXml);
+            doc.parse<0>(cstr);
+        }
 
         xml_node<> *node = doc.first_node("svg");
 
-        vector<Path>* result = parseNode(node, Transformation());
+        ParseContext context;
+        size_t slash = path.rfind('/');
+        if(slash != string::npos) context.directory = path.substr(0, slash + 1);
+        vector<PathInstance> instances;
+        if(node) {
+            STATS_TIMER(parseTree);
+            collectIds(&doc, context);
+            parseNode(node, Transformation(), Fill(), context, instances);
+        }
+
+        //Path data is independent, so it is parsed in parallel. Elements that haven't changed since the previous
+        //document keep their geometry.
+        vector<shared_ptr<Geometry>> geometries(context.geometries.size());
+        vector<uint64_t> hashes(context.geometries.size());
+        try {
+            STATS_TIMER(parseGeometry);
+            scheduler::parallelFor(0, geometries.size(), [&](size_t begin, size_t end) {
+                TRACE_SPAN("geometry batch", end - begin);
+                size_t reused = 0;
+                for(size_t i = begin ; i < end ; i++) {
+                    xml_node<> *node = context.geometries[i];
+                    AttributeGetter attribute = [node](const char *name, string &value) {
+                        xml_attribute<> *attr = node->first_attribute(name);
+                        if(attr) value = attr->value();
+                        return attr != nullptr;
+                    };
+                    hashes[i] = hashElement(node->name(), attribute);
+                    if(previous) {
+                        auto found = previous->sources.find(hashes[i]);
+                        if(found != previous->sources.end()) {
+                            geometries[i] = found->second;
+                            reused++;
+                            continue;
+                        }
+                    }
+                    geometries[i] = createGeometry(node->name(), attribute);
+                    STATS_COUNT_ELEMENTS(geometries[i].get());
+                }
+                STATS_COUNT(reusedGeometries, reused);
+            });
+        } catch(...) {
+            delete[] cstr;
+            throw;
+        }
+
+        Document* result = new Document();
+        TRACE_SPAN("build paths", instances.size());
+        result->paths.reserve(instances.size());
+        for(const PathInstance &instance : instances) {
+            result->paths.push_back(Path(geometries[instance.geometry], instance.transformation, instance.fill));
+        }
+        result->images = context.images;
+        result->sources.reserve(geometries.size());
+        for(size_t i = 0 ; i < geometries.size() ; i++) {
+            if(geometries[i]) result->sources[hashes[i]] = geometries[i];
+        }
+        STATS_COUNT(paths, result->paths.size());
+        STATS_COUNT(images, result->images.size());
 
         delete[] cstr;
 
         return result;
     }
 
+    const size_t stream_buffer_size = 1 << 16;
+
+    //Returns value of an attribute of a start tag. Tag starts with element name and doesn't contain brackets.
+    string getAttribute(const string &tag, const string &name, bool &found) {
+        found = false;
+        size_t i = tag.find_first_of(" \t\r\n");
+        while(i < tag.length()) {
+            i = tag.find_first_not_of(" \t\r\n", i);
+            if(i == string::npos) break;
+            size_t nameEnd = tag.find_first_of("= \t\r\n", i);
+            if(nameEnd == string::npos) break;
+            size_t quote = tag.find_first_of("\"'", nameEnd);
+            if(quote == string::npos) break;
+            size_t valueEnd = tag.find(tag[quote], quote + 1);
+            if(valueEnd == string::npos) throw invalid_argument("Failed loading SVG file. Unterminated attribute value.");
+            if(tag.compare(i, nameEnd - i, name) == 0) {
+                found = true;
+                string value = tag.substr(quote + 1, valueEnd - quote - 1);
+                if(value.find('&') == string::npos) return value;
+                //Translating character references the same way the DOM parser does
+                string result;
+                for(size_t j = 0 ; j < value.length() ; j++) {
+                    size_t semicolon;
+                    if(value[j] == '&' && (semicolon = value.find(';', j)) != string::npos) {
+                        string entity = value.substr(j + 1, semicolon - j - 1);
+                        if(entity == "amp") result += '&';
+                        else if(entity == "lt") result += '<';
+                        else if(entity == "gt") result += '>';
+                        else if(entity == "quot") result += '"';
+                        else if(entity == "apos") result += '\'';
+                        else if(entity.length() > 1 && entity[0] == '#') result += static_cast<char>(entity[1] == 'x' ? strtol(entity.c_str() + 2, nullptr, 16) : atoi(entity.c_str() + 1));
+                        else {
+                            result += value[j];
+                            continue;
+                        }
+                        j = semicolon;
+                    } else {
+                        result += value[j];
+                    }
+                }
+                return result;
+            }
+            i = valueEnd + 1;
+        }
+        return string();
+    }
+
+    StreamParser::StreamParser(istream &in) : in(in), buffer(stream_buffer_size) {}
+
+    int StreamParser::get() {
+        if(position == length) {
+            in.read(buffer.data(), buffer.size());
+            length = in.gcount();
+            position = 0;
+            if(length == 0) return -1;
+        }
+        return static_cast<unsigned char>(buffer[position++]);
+    }
+
+    //Skips characters up to and including c. Returns false at the end of the file.
+    bool StreamParser::skipTo(char c) {
+        while(true) {
+            const char *found = static_cast<const char*>(memchr(buffer.data() + position, c, length - position));
+            if(found) {
+                position = found - buffer.data() + 1;
+                return true;
+            }
+            position = length;
+            int next = get();
+            if(next == -1) return false;
+            if(next == c) return true;
+        }
+    }
+
+    //Skips characters up to and including given terminator, e.g. end of a comment
+    void StreamParser::skipPast(const char *end) {
+        size_t n = strlen(end);
+        string window;
+        while(window.length() < n || window.compare(window.length() - n, n, end) != 0) {
+            int c = get();
+            if(c == -1) throw invalid_argument("Failed loading SVG file. Unexpected end of file.");
+            window += static_cast<char>(c);
+            if(window.length() > n) window.erase(0, 1);
+        }
+    }
+
+    //Reads the rest of a tag up to the closing bracket, which isn't stored
+    void StreamParser::readTag(string &tag) {
+        char quote = 0;
+        while(true) {
+            int c = get();
+            if(c == -1) throw invalid_argument("Failed loading SVG file. Unexpected end of file.");
+            if(quote) {
+                if(c == quote) quote = 0;
+            } else if(c == '"' || c == '\'') {
+                quote = c;
+            } else if(c == '>') {
+                return;
+            }
+            tag += static_cast<char>(c);
+        }
+    }
+
+    //Scans the file until the next path. Follows the same rules as parseNode: only the first svg element,
+    //its groups and paths inside them are taken into account.
+    bool StreamParser::next(Path &path) {
+        string tag;
+        while(!(rootFound && stack.empty()) && skipTo('<')) {
+            int c = get();
+            if(c == '!') {
+                c = get();
+                if(c == '-') {
+                    skipPast("-->");
+                } else if(c == '[') {
+                    skipPast("]]>");
+                } else {
+                    //Document type declaration, may contain internal subset in square brackets
+                    int depth = 0;
+                    while(c != '>' || depth > 0) {
+                        if(c == -1) throw invalid_argument("Failed loading SVG file. Unexpected end of file.");
+                        if(c == '[') depth++;
+                        else if(c == ']') depth--;
+                        c = get();
+                    }
+                }
+                continue;
+            } else if(c == '?') {
+                skipPast("?>");
+                continue;
+            } else if(c == '/') {
+                skipTo('>');
+                if(!stack.empty()) stack.pop_back();
+                continue;
+            } else if(c == -1) {
+                break;
+            }
+
+            tag.assign(1, static_cast<char>(c));
+            readTag(tag);
+            bool selfClosing = tag.back() == '/';
+            if(selfClosing) tag.pop_back();
+            string name = tag.substr(0, tag.find_first_of(" \t\r\n"));
+
+            Element element {Transformation(), false, Fill()};
+            bool found = false;
+            if(stack.empty()) {
+                if(!rootFound && name == "svg") {
+                    rootFound = true;
+                    element.container = true;
+                }
+            } else if(stack.back().container) {
+                string transform = getAttribute(tag, "transform", found);
+                element.transformation = stack.back().transformation * (found ? parseTransformation(transform) : Transformation());
+                element.fill = parseFill([&tag](const char *attribute, string &value) {
+                    bool found;
+                    value = getAttribute(tag, attribute, found);
+                    return found;
+                }).inherit(stack.back().fill);
+                if(name == "g") {
+                    element.container = true;
+                    found = false;
+                } else if(isShape(name.c_str())) {
+                    shared_ptr<Geometry> geometry = createGeometry(name.c_str(), [&tag](const char *attribute, string &value) {
+                        bool found;
+                        value = getAttribute(tag, attribute, found);
+                        return found;
+                    });
+                    found = geometry != nullptr;
+                    STATS_COUNT_ELEMENTS(geometry.get());
+                    STATS_COUNT(paths, found ? 1 : 0);
+                    if(name == "line") element.fill.paint = 0;
+                    if(found) path = Path(geometry, element.transformation, element.fill);
+                } else {
+                    found = false;
+                }
+            }
+            if(!selfClosing) stack.push_back(element);
+            if(found) return true;
+        }
+        if(!stack.empty()) throw invalid_argument("Failed loading SVG file. Unexpected end of file.");
+        return false;
+    }
+
     Transformation::Transformation() {
         for(int y = 0 ; y < 3; y++) for(int x = 0 ; x < 3; x++) matrix[x][y] = 0;
         matrix[0][0] = 1;
@@ -308,6 +805,15 @@ namespace svg {
         matrix[2][2] = 1;
     }
 
+    void Transformation::getMatrix(double values[6]) const {
+        values[0] = matrix[0][0];
+        values[1] = matrix[0][1];
+        values[2] = matrix[1][0];
+        values[3] = matrix[1][1];
+        values[4] = matrix[2][0];
+        values[5] = matrix[2][1];
+    }
+
     void Transformation::print() {
         printf("[\n");
         for(int y = 0 ; y < 3; y++) {
@@ -329,6 +835,14 @@ namespace svg {
         return result;
     }
 
+    Transformation Transformation::inverse() const {
+        double a = matrix[0][0], b = matrix[0][1], c = matrix[1][0], d = matrix[1][1], e = matrix[2][0], f = matrix[2][1];
+        double determinant = a * d - b * c;
+        if(determinant == 0) return Transformation();
+        return Transformation(d / determinant, -b / determinant, -c / determinant, a / determinant,
+                              (c * f - d * e) / determinant, (b * e - a * f) / determinant);
+    }
+
     Point operator*(const Point& p, const Transformation& t) {
         Point result;
         result.x = p.x * t.matrix[0][0] + p.y * t.matrix[1][0] + t.matrix[2][0];
@@ -386,6 +900,78 @@ namespace svg {
 
     QuadraticBezier::QuadraticBezier(Point p1, Point p2, Point p3) : p1(p1), p2(p2), p3(p3) {}
 
+    Arc::Arc(Point center, double rx, double ry, double rotation, double start, double sweep) : center(center), start(start), sweep(sweep) {
+        u = Point {rx * cos(rotation), rx * sin(rotation)};
+        v = Point {-ry * sin(rotation), ry * cos(rotation)};
+    }
+
+    Arc::Arc(Point center, Point u, Point v, double start, double sweep) : center(center), u(u), v(v), start(start), sweep(sweep) {}
+
+    void Arc::print() {
+        printf("Arc center (%f, %f), axes (%f, %f), (%f, %f), angles %f, %f\n", center.x, center.y, u.x, u.y, v.x, v.y, start, sweep);
+    }
+
+    //Converts endpoint parametrization of an arc to the center one, following SVG implementation notes
+    PathElement* endpointArc(Point p1, double rx, double ry, double rotation, bool largeArc, bool sweep, Point p2) {
+        rx = abs(rx);
+        ry = abs(ry);
+        if(rx == 0 || ry == 0) return new Line(p1, p2);
+        if(p1.x == p2.x && p1.y == p2.y) return new Line(p1, p2);
+
+        double c = cos(rotation), s = sin(rotation);
+        double dx = (p1.x - p2.x) / 2, dy = (p1.y - p2.y) / 2;
+        double x1 = c * dx + s * dy;
+        double y1 = -s * dx + c * dy;
+
+        double lambda = x1 * x1 / (rx * rx) + y1 * y1 / (ry * ry);
+        if(lambda > 1) {
+            rx *= sqrt(lambda);
+            ry *= sqrt(lambda);
+        }
+
+        double numerator = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+        double denominator = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+        double coefficient = sqrt(max(0.0, numerator / denominator)) * (largeArc != sweep ? 1 : -1);
+        double cx1 = coefficient * rx * y1 / ry;
+        double cy1 = -coefficient * ry * x1 / rx;
+        Point center {c * cx1 - s * cy1 + (p1.x + p2.x) / 2, s * cx1 + c * cy1 + (p1.y + p2.y) / 2};
+
+        double start = atan2((y1 - cy1) / ry, (x1 - cx1) / rx);
+        double end = atan2((-y1 - cy1) / ry, (-x1 - cx1) / rx);
+        double delta = fmod(end - start, 2 * PI);
+        if(!sweep && delta > 0) delta -= 2 * PI;
+        else if(sweep && delta < 0) delta += 2 * PI;
+        return new Arc(center, rx, ry, rotation, start, delta);
+    }
+
+    bool Arc::isCircular(const Transformation &t, bool &positive) {
+        Point c = center * t;
+        Point tu = (center + u) * t - c;
+        Point tv = (center + v) * t - c;
+        double lu = sqrt(tu.x * tu.x + tu.y * tu.y);
+        double lv = sqrt(tv.x * tv.x + tv.y * tv.y);
+        double tolerance = 1e-9 * max(lu, lv);
+        positive = (tu.x * tv.y - tu.y * tv.x) * sweep > 0;
+        return abs(lu - lv) <= tolerance && abs(tu.x * tv.x + tu.y * tv.y) <= tolerance * max(lu, lv);
+    }
+
+    //Splits the arc into parts of at most 90 degrees, each approximated with a cubic bezier curve
+    vector<CubicBezier> Arc::toBeziers() {
+        vector<CubicBezier> result;
+        int parts = max(1, static_cast<int>(ceil(abs(sweep) / (PI / 2) - 1e-9)));
+        double step = sweep / parts;
+        double k = 4.0 / 3.0 * tan(step / 4);
+        for(int i = 0 ; i < parts ; i++) {
+            double a1 = start + i * step, a2 = a1 + step;
+            Point p1 = center + u * Point {cos(a1), cos(a1)} + v * Point {sin(a1), sin(a1)};
+            Point p4 = center + u * Point {cos(a2), cos(a2)} + v * Point {sin(a2), sin(a2)};
+            Point d1 = u * Point {-sin(a1), -sin(a1)} + v * Point {cos(a1), cos(a1)};
+            Point d2 = u * Point {-sin(a2), -sin(a2)} + v * Point {cos(a2), cos(a2)};
+            result.push_back(CubicBezier(p1, p1 + d1 * Point {k, k}, p4 - d2 * Point {k, k}, p4));
+        }
+        return result;
+    }
+
     //Polymorphic classes need clone function to work properly
     Line* Line::clone() {
         return new Line(*this);
@@ -399,6 +985,50 @@ namespace svg {
         return new QuadraticBezier(*this);
     }
 
+    Arc* Arc::clone() {
+        return new Arc(*this);
+    }
+
+    Line* Line::reversed() {
+        return new Line(p2, p1);
+    }
+
+    CubicBezier* CubicBezier::reversed() {
+        return new CubicBezier(p4, p3, p2, p1);
+    }
+
+    QuadraticBezier* QuadraticBezier::reversed() {
+        return new QuadraticBezier(p3, p2, p1);
+    }
+
+    Arc* Arc::reversed() {
+        Arc *result = new Arc(*this);
+        result->start = start + sweep;
+        result->sweep = -sweep;
+        return result;
+    }
+
+    //Affine transformations keep lines and curves exact
+    Line* Line::transformed(const Transformation &t) {
+        return new Line(p1 * t, p2 * t);
+    }
+
+    CubicBezier* CubicBezier::transformed(const Transformation &t) {
+        return new CubicBezier(p1 * t, p2 * t, p3 * t, p4 * t);
+    }
+
+    QuadraticBezier* QuadraticBezier::transformed(const Transformation &t) {
+        return new QuadraticBezier(p1 * t, p2 * t, p3 * t);
+    }
+
+    Arc* Arc::transformed(const Transformation &t) {
+        Arc *result = new Arc(*this);
+        result->center = center * t;
+        result->u = (center + u) * t - result->center;
+        result->v = (center + v) * t - result->center;
+        return result;
+    }
+
     //Calculating points for PathElements
     Point Line::getPoint(double t) {
         if(t > 1) t = 1;
@@ -427,6 +1057,13 @@ namespace svg {
         return p;
     }
 
+    Point Arc::getPoint(double t) {
+        if(t > 1) t = 1;
+        else if(t < 0) t = 0;
+        double a = start + sweep * t;
+        return center + u * Point {cos(a), cos(a)} + v * Point {sin(a), sin(a)};
+    }
+
     Point QuadraticBezier::getPoint(double t) {
         if(t > 1) t = 1;
         else if(t < 0) t = 0;
@@ -436,14 +1073,6 @@ namespace svg {
         return p;
     }
 
-    //Path needs cloning constructor to avoid memory errors connected with pointers
-    Path::Path(const Path& path) {
-        this->transformation = path.transformation;
-        for(int i = 0 ; i < path.size() ; i++) {
-            push_back(path.at(i)->clone());
-        }
-    }
-
     Point operator+(const Point& p1, const Point& p2) {
         Point p3;
         p3.x = p1.x + p2.x;
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <string>
+#include <istream>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <functional>
 #include <math.h>
 #include "rapidxml.hpp"
 
@@ -22,8 +29,10 @@ namespace svg {
         Transformation();
         Transformation(double, double, double, double, double, double);
         Transformation operator*(const Transformation&) const; //Transformations can be combined by multiplying them
+        Transformation inverse() const;
         friend Point operator*(const Point&, const Transformation&);
         friend Point operator*(const Transformation&, const Point&);
+        void getMatrix(double values[6]) const; //a to f of SVG matrix(), inverse of the six argument constructor
         void print();
     };
 
@@ -59,33 +68,118 @@ namespace svg {
 
     class PathElement {
     private:
-        friend class Path;
+        friend class Geometry;
     
     public:
         virtual ~PathElement() {};
         virtual Point getPoint(double t) {return Point{0, 0};}; //Calculates point for 0 <= t <= 1
         virtual void print() = 0;
         virtual PathElement* clone() = 0;
+        virtual PathElement* reversed() = 0; //New element going the other way
+        virtual PathElement* transformed(const Transformation &t) = 0; //New element with transformation applied
     };
 
-    class Path : public vector<PathElement*> { //Path is a vector of PathElements with transformation
+    class Geometry : public vector<PathElement*> { //Elements of a path, shared by all paths drawing the same shape
+    public:
+        Geometry() {};
+        Geometry(const string&); //Argument is 'd' attribute of SVG path.
+        Geometry(const Geometry&) = delete;
+        Geometry& operator=(const Geometry&) = delete;
+        ~Geometry();
+    };
+
+    //Fill and fill-rule properties. Values not set on an element are inherited from its parent.
+    struct Fill {
+        int paint = -1; //0 for fill="none", 1 for any other value, -1 if not set
+        int evenOdd = -1; //1 for fill-rule="evenodd", 0 for nonzero, -1 if not set
+        Fill inherit(const Fill &parent) const;
+        bool filled() const {return paint != 0;}; //Shapes are filled with black by default
+        bool isEvenOdd() const {return evenOdd == 1;};
+    };
+
+    //Reads fill properties from attributes and from style attribute, which takes precedence
+    Fill parseFill(const function<bool(const char*, string&)> &attribute);
+
+    class Path { //Path is a shared geometry with transformation
     private:
+        shared_ptr<Geometry> geometry;
         Transformation transformation;
+        Fill fill;
     
     public:
+        typedef Geometry::iterator iterator;
+
+        Path();
         Path(const string&, Transformation t); //First argument is 'd' attribute of SVG path.
-        Path(const Path& path);
-        ~Path();
+        Path(shared_ptr<Geometry> geometry, Transformation t, Fill fill = Fill());
         Transformation getTransformation() {return transformation;};
+        Fill getFill() const {return fill;};
+        shared_ptr<Geometry> getGeometry() {return geometry;};
+
+        iterator begin() {return geometry->begin();};
+        iterator end() {return geometry->end();};
+        size_t size() const {return geometry->size();};
+        bool empty() const {return geometry->empty();};
+        PathElement* at(size_t i) {return geometry->at(i);};
+        PathElement* operator[](size_t i) {return (*geometry)[i];};
     };
     
-    //The function that loads a vector of all paths from SVG file
-    vector<Path>* loadPaths(string path);
+    //Bitmap placed in the document, engraved line by line
+    struct Image {
+        string href; //Data URI or absolute path of a linked file
+        double x = 0;
+        double y = 0;
+        double width = 0;
+        double height = 0;
+        bool preserveAspectRatio = true; //Image is centered and scaled to fit, as with default xMidYMid meet
+        Transformation transformation;
+    };
+
+    //Everything that can be converted from SVG file
+    struct Document {
+        vector<Path> paths;
+        vector<Image> images;
+        unordered_map<uint64_t, shared_ptr<Geometry>> sources; //Geometries by hash of the element they were built from
+    };
+
+    //Version of the document loadDocument builds. Increase it when parsing changes, so cached documents are parsed again.
+    const unsigned parser_version = 2;
+
+    //The function that loads all paths and images from SVG file. Geometries of elements unchanged since
+    //the previous document was loaded are taken from it instead of being parsed again.
+    Document* loadDocument(string path, const Document *previous = nullptr);
+
+    //Reads paths one by one while scanning the file, without building the whole document in memory.
+    //Memory use depends only on the size of the largest element.
+    class StreamParser {
+    private:
+        struct Element {
+            Transformation transformation;
+            bool container; //Children of the root and of groups are parsed
+            Fill fill;
+        };
+
+        istream &in;
+        vector<char> buffer;
+        size_t position = 0;
+        size_t length = 0;
+        vector<Element> stack;
+        bool rootFound = false;
+
+        int get(); //Returns next character or -1 at the end of the file
+        bool skipTo(char c);
+        void skipPast(const char *end);
+        void readTag(string &tag);
+
+    public:
+        StreamParser(istream &in);
+        bool next(Path &path); //Returns false when there are no more paths
+    };
 
 
     class Line : public PathElement {
     private:
-        friend class Path;
+        friend class Geometry;
         Point p1;
         Point p2;
     public:
@@ -93,13 +187,15 @@ namespace svg {
         void print();
         Point getPoint(double);
         Line* clone();
+        Line* reversed();
+        Line* transformed(const Transformation &t);
         Point getP1() {return p1;};
         Point getP2() {return p2;};
     };
 
     class CubicBezier : public PathElement {
     private:
-        friend class Path;
+        friend class Geometry;
         Point p1;
         Point p2;
         Point p3;
@@ -109,6 +205,8 @@ namespace svg {
         void print();
         Point getPoint(double);
         CubicBezier* clone();
+        CubicBezier* reversed();
+        CubicBezier* transformed(const Transformation &t);
         Point getP1() {return p1;};
         Point getP2() {return p2;};
         Point getP3() {return p3;};
@@ -117,7 +215,7 @@ namespace svg {
 
     class QuadraticBezier : public PathElement {
     private:
-        friend class Path;
+        friend class Geometry;
         Point p1;
         Point p2;
         Point p3;
@@ -126,20 +224,80 @@ namespace svg {
         void print();
         Point getPoint(double);
         QuadraticBezier* clone();
+        QuadraticBezier* reversed();
+        QuadraticBezier* transformed(const Transformation &t);
         Point getP1() {return p1;};
         Point getP2() {return p2;};
         Point getP3() {return p3;};
     };
 
-    class Arc : public PathElement {
+    class Arc : public PathElement { //Elliptical arc stored as an affine image of a unit circle arc
+    private:
+        friend class Geometry;
+        Point center;
+        Point u; //Image of (1, 0)
+        Point v; //Image of (0, 1)
+        double start; //Angles on the unit circle
+        double sweep;
+    public:
+        Arc(Point center, double rx, double ry, double rotation, double start, double sweep);
+        Arc(Point center, Point u, Point v, double start, double sweep);
+        void print();
+        Point getPoint(double);
+        Arc* clone();
+        Arc* reversed();
+        Arc* transformed(const Transformation &t);
+        Point getCenter() {return center;};
+        Point getU() {return u;};
+        Point getV() {return v;};
+        double getStart() {return start;};
+        double getSweep() {return sweep;};
+        bool isCircular(const Transformation &t, bool &positive); //Checks if the arc stays circular after transformation
+        vector<CubicBezier> toBeziers(); //Approximation used for drawing
+    };
+
+    //Arc between two points, as described by SVG 'A' command
+    PathElement* endpointArc(Point p1, double rx, double ry, double rotation, bool largeArc, bool sweep, Point p2);
+
+    //Instance of a geometry found in the document
+    struct PathInstance {
+        size_t geometry;
+        Transformation transformation;
+        Fill fill; //Referenced elements leave unset values to the use element
+    };
+
+    //Reads attribute of an element being parsed. Returns false if it is missing.
+    typedef function<bool(const char*, string&)> AttributeGetter;
+
+    //Checks if element can be converted into geometry
+    bool isShape(const char *name);
+    //Builds geometry of a path or a basic shape (rect, circle, ellipse, line, polyline, polygon)
+    shared_ptr<Geometry> createGeometry(const char *name, const AttributeGetter &attribute);
+    //Hash of an element name and the attributes createGeometry reads. Transformation and fill aren't part of it,
+    //they belong to the instances.
+    uint64_t hashElement(const char *name, const AttributeGetter &attribute);
 
+    //State of parsing a document. Every path element is parsed once, no matter how many times it is used,
+    //so memory and parsing time depend on the number of unique shapes.
+    struct ParseContext {
+        vector<rapidxml::xml_node<>*> geometries; //Unique shapes, parsed later in parallel
+        map<rapidxml::xml_node<>*, size_t> geometryIndices;
+        map<string, rapidxml::xml_node<>*> ids;
+        map<rapidxml::xml_node<>*, vector<PathInstance>> definitions; //Instances of referenced elements in their own coordinates
+        map<rapidxml::xml_node<>*, vector<Image>> definitionImages; //Images of referenced elements in their own coordinates
+        set<rapidxml::xml_node<>*> resolving; //Protects against recursive references
+        vector<Image> images;
+        string directory; //Linked images are relative to the document
     };
 
     //No need to use those from the outside
-    vector<Path>* parseNode(rapidxml::xml_node<> *node);
+    void parseNode(rapidxml::xml_node<> *node, const Transformation &t, const Fill &fill, ParseContext &context, vector<PathInstance> &instances);
+    void parseElement(rapidxml::xml_node<> *node, const Transformation &t, const Fill &fill, ParseContext &context, vector<PathInstance> &instances, bool referenced);
+    void collectIds(rapidxml::xml_node<> *node, ParseContext &context);
     vector<string>* splitD(const string &d);
     Transformation parseTransformation(const string str);
     double* getValues(const string &str, const string name, const int argc);
+    string getAttribute(const string &tag, const string &name, bool &found);
     vector<Point> iterateAndGetPoints(int n, vector<string>::iterator &iterator, const vector<string>::iterator &end, Point relative);
 
 }
\ No newline at end of file
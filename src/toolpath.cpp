@@ -0,0 +1,408 @@
+#include <math.h>
+#include <algorithm>
+
+#include "toolpath.h"
+#include "raster.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace toolpath {
+
+    using namespace std;
+
+    const double curve_tolerance = 0.01; //mm, largest distance between a curve and the moves sampled along it, the default resolution
+    const size_t curve_probes = 16; //Samples telling how much a curve bends
+    const size_t max_curve_steps = 1000; //Moves of one curve, at most
+
+    void Toolpath::clear() {
+        points.clear();
+        powers.clear();
+        cuts.clear();
+    }
+
+    void Toolpath::append(const Toolpath &other) {
+        size_t pointOffset = points.size(), powerOffset = powers.size(), first = cuts.size();
+        points.insert(points.end(), other.points.begin(), other.points.end());
+        powers.insert(powers.end(), other.powers.begin(), other.powers.end());
+        cuts.insert(cuts.end(), other.cuts.begin(), other.cuts.end());
+        for(size_t i = first ; i < cuts.size() ; i++) {
+            cuts[i].first += pointOffset;
+            cuts[i].power += powerOffset;
+        }
+    }
+
+    size_t Toolpath::groupEnd(size_t begin) const {
+        size_t end = begin + 1;
+        while(end < cuts.size() && cuts[end].group == cuts[begin].group) end++;
+        return end;
+    }
+
+    //Moves that keep a curve within tolerance. A chord over a parameter step h deviates from the curve by at most
+    //h^2 / 8 times its second derivative, which is taken from second differences of a few samples and extended
+    //linearly to the ends, where that of a cubic curve is largest.
+    size_t curveSteps(svg::PathElement *element, const svg::Transformation &transformation, const svg::Point &start, const svg::Point &end) {
+        svg::Point probes[curve_probes + 1], differences[curve_probes + 1];
+        probes[0] = start;
+        probes[curve_probes] = end;
+        for(size_t i = 1 ; i < curve_probes ; i++) probes[i] = element->getPoint(static_cast<double>(i) / curve_probes) * transformation;
+        for(size_t i = 1 ; i < curve_probes ; i++) {
+            differences[i] = {probes[i - 1].x - 2 * probes[i].x + probes[i + 1].x, probes[i - 1].y - 2 * probes[i].y + probes[i + 1].y};
+        }
+        const size_t last = curve_probes - 1;
+        differences[0] = {2 * differences[1].x - differences[2].x, 2 * differences[1].y - differences[2].y};
+        differences[curve_probes] = {2 * differences[last].x - differences[last - 1].x, 2 * differences[last].y - differences[last - 1].y};
+        double bend = 0;
+        for(const svg::Point &d : differences) bend = max(bend, sqrt(d.x * d.x + d.y * d.y) * curve_probes * curve_probes);
+        double steps = ceil(sqrt(bend / (8 * curve_tolerance)));
+        return static_cast<size_t>(min(static_cast<double>(max_curve_steps), max(1.0, steps)));
+    }
+
+    void addPath(Toolpath &toolpath, svg::Path &path, size_t group) {
+        svg::Transformation transformation = path.getTransformation();
+        vector<svg::Point> &points = toolpath.points;
+        for(svg::PathElement *element : path) {
+            Cut cut;
+            cut.group = group;
+            cut.first = points.size();
+            svg::Line *line = dynamic_cast<svg::Line*>(element);
+            svg::Arc *arc = dynamic_cast<svg::Arc*>(element);
+            bool positive;
+            if(line) {
+                cut.start = line->getP1() * transformation;
+                cut.end = line->getP2() * transformation;
+                points.push_back(cut.end);
+            } else if(arc && arc->isCircular(transformation, positive)) {
+                cut.start = arc->getPoint(0) * transformation;
+                cut.end = arc->getPoint(1) * transformation;
+                cut.kind = toolpath::arc;
+                cut.clockwise = positive; //Positive direction with Y axis pointing down becomes clockwise on the machine
+                cut.center = arc->getCenter() * transformation;
+                points.push_back(cut.end);
+            } else {
+                cut.start = element->getPoint(0) * transformation;
+                cut.end = element->getPoint(1) * transformation;
+                //Parameters are computed from the step number, adding up the step would drift from the curve
+                size_t steps = curveSteps(element, transformation, cut.start, cut.end);
+                for(size_t i = 1 ; i < steps ; i++) {
+                    points.push_back(element->getPoint(static_cast<double>(i) / steps) * transformation);
+                }
+                points.push_back(cut.end);
+            }
+            cut.count = points.size() - cut.first;
+            toolpath.cuts.push_back(cut);
+        }
+    }
+
+    void addImage(Toolpath &toolpath, const svg::Image &image, double spacing, int mode) {
+        raster::Settings settings;
+        settings.spacing = spacing;
+        settings.mode = static_cast<raster::Mode>(mode);
+        for(raster::Stroke &stroke : raster::engrave(image, settings)) {
+            Cut cut;
+            cut.kind = raster;
+            cut.start = cut.end = stroke.start;
+            cut.first = toolpath.points.size();
+            cut.power = toolpath.powers.size();
+            cut.count = stroke.moves.size();
+            for(raster::Move &move : stroke.moves) {
+                toolpath.points.push_back(move.to);
+                toolpath.powers.push_back(move.power);
+                cut.end = move.to;
+            }
+            toolpath.cuts.push_back(cut);
+        }
+    }
+
+    State stateBefore(const Toolpath &toolpath, size_t index) {
+        State state;
+        if(index == 0) return state;
+        const Cut &cut = toolpath.cuts[index - 1];
+        state.last = cut.end;
+        state.toolEnabled = true; //Tool is turned on before every cut
+        state.raster = cut.kind == raster;
+        return state;
+    }
+
+    void emit(const Toolpath &toolpath, size_t begin, size_t end, const Settings &settings, State &state, Emitter &emitter) {
+        for(size_t i = begin ; i < end ; i++) {
+            const Cut &cut = toolpath.cuts[i];
+            if(state.raster && cut.kind != raster) finish(state, emitter);
+
+            //Travel, unless the gap is small enough to cut through
+            bool moved = false;
+            bool wasEnabled = state.toolEnabled;
+            if(abs(state.last.x - cut.start.x) > settings.joinTolerance || abs(state.last.y - cut.start.y) > settings.joinTolerance) {
+                if(state.toolEnabled) {
+                    emitter.toolOff();
+                    state.toolEnabled = false;
+                }
+                emitter.speed(settings.travelSpeed);
+                emitter.travel(cut.start);
+                moved = true;
+            }
+            if(!state.toolEnabled) {
+                emitter.toolOn();
+                state.toolEnabled = true;
+            }
+            if(moved || !wasEnabled) emitter.speed(settings.workingSpeed);
+            bool atStart = moved || (wasEnabled && state.last.x == cut.start.x && state.last.y == cut.start.y);
+            if(!atStart) emitter.line(cut.start);
+
+            const svg::Point *points = toolpath.points.data() + cut.first;
+            if(cut.kind == raster) {
+                const double *powers = toolpath.powers.data() + cut.power;
+                for(size_t j = 0 ; j < cut.count ; j++) emitter.raster(points[j], powers[j]);
+            } else if(cut.count > 0) {
+                for(size_t j = 0 ; j + 1 < cut.count ; j++) emitter.line(points[j]);
+                if(cut.kind == arc) emitter.arc(cut.start, points[cut.count - 1], cut.center, cut.clockwise);
+                else emitter.line(points[cut.count - 1]);
+            }
+            state.last = cut.end;
+            state.raster = cut.kind == raster;
+        }
+    }
+
+    void finish(State &state, Emitter &emitter) {
+        if(!state.raster) return;
+        //Tool on command of paths has to set the power again
+        if(state.toolEnabled) {
+            emitter.toolOff();
+            state.toolEnabled = false;
+        }
+        state.raster = false;
+    }
+
+    void OffsetEmitter::setOffset(const svg::Point &offset, State &state) {
+        state.last = {state.last.x + this->offset.x - offset.x, state.last.y + this->offset.y - offset.y};
+        this->offset = offset;
+    }
+
+    void JoinPass::run(Toolpath &toolpath) {
+        vector<Cut> &cuts = toolpath.cuts;
+        for(size_t i = 1 ; i < cuts.size() ; i++) {
+            const Cut &previous = cuts[i - 1];
+            Cut &cut = cuts[i];
+            if(cut.group == previous.group || cut.kind == raster || previous.kind == raster) continue;
+            if(abs(previous.end.x - cut.start.x) > tolerance || abs(previous.end.y - cut.start.y) > tolerance) continue;
+            size_t group = cut.group;
+            for(size_t j = i ; j < cuts.size() && cuts[j].group == group ; j++) cuts[j].group = previous.group;
+        }
+    }
+
+    //Starts of groups not ordered yet, in cells of a grid
+    class StartGrid {
+    private:
+        double minX, minY, cell;
+        long long columns, rows;
+        vector<vector<size_t>> cells;
+        const vector<svg::Point> &starts;
+
+        long long column(double x) const {return min(columns - 1, max(0LL, static_cast<long long>((x - minX) / cell)));};
+        long long row(double y) const {return min(rows - 1, max(0LL, static_cast<long long>((y - minY) / cell)));};
+
+    public:
+        StartGrid(const vector<svg::Point> &starts, const vector<size_t> &remaining) : starts(starts) {
+            minX = minY = INFINITY;
+            double maxX = -INFINITY, maxY = -INFINITY;
+            for(size_t i : remaining) {
+                minX = min(minX, starts[i].x);
+                minY = min(minY, starts[i].y);
+                maxX = max(maxX, starts[i].x);
+                maxY = max(maxY, starts[i].y);
+            }
+            //About one start per cell
+            double width = max(maxX - minX, 1e-6), height = max(maxY - minY, 1e-6);
+            cell = max(sqrt(width * height / max<size_t>(1, remaining.size())), 1e-6);
+            columns = min(4096LL, static_cast<long long>(width / cell) + 1);
+            rows = min(4096LL, static_cast<long long>(height / cell) + 1);
+            cell = max(width / columns, height / rows) * (1 + 1e-9);
+            cells.resize(columns * rows);
+            for(size_t i : remaining) cells[row(starts[i].y) * columns + column(starts[i].x)].push_back(i);
+        }
+
+        size_t size() const {return cells.size();};
+
+        //Removes and returns the start closest to p
+        size_t takeNearest(const svg::Point &p) {
+            long long cx = column(p.x), cy = row(p.y);
+            size_t best = 0;
+            vector<size_t> *bestCell = nullptr;
+            size_t bestIndex = 0;
+            double bestDistance = INFINITY;
+            for(long long r = 0 ; r <= max(columns, rows) ; r++) {
+                //Starts in ring r are at least (r - 1) cells away
+                if(bestCell && (r - 1) * cell > sqrt(bestDistance)) break;
+                for(long long y = cy - r ; y <= cy + r ; y++) {
+                    if(y < 0 || y >= rows) continue;
+                    bool edge = y == cy - r || y == cy + r;
+                    for(long long x = cx - r ; x <= cx + r ; x += edge ? 1 : 2 * r) {
+                        if(x >= 0 && x < columns) {
+                            vector<size_t> &candidates = cells[y * columns + x];
+                            for(size_t k = 0 ; k < candidates.size() ; k++) {
+                                const svg::Point &s = starts[candidates[k]];
+                                double distance = (s.x - p.x) * (s.x - p.x) + (s.y - p.y) * (s.y - p.y);
+                                if(distance < bestDistance || (distance == bestDistance && candidates[k] < best)) {
+                                    bestDistance = distance;
+                                    best = candidates[k];
+                                    bestCell = &candidates;
+                                    bestIndex = k;
+                                }
+                            }
+                        }
+                        if(r == 0) break;
+                    }
+                }
+            }
+            bestCell->erase(bestCell->begin() + bestIndex);
+            return best;
+        }
+    };
+
+    void OrderPass::run(Toolpath &toolpath) {
+        vector<Cut> &cuts = toolpath.cuts;
+        size_t first = 0;
+        while(first < cuts.size() && cuts[first].kind == raster) first++;
+        if(cuts.size() - first < 3) return;
+
+        vector<size_t> begins; //First cut of every group
+        vector<svg::Point> starts;
+        for(size_t i = first ; i < cuts.size() ; i = toolpath.groupEnd(i)) {
+            begins.push_back(i);
+            starts.push_back(cuts[i].start);
+        }
+        begins.push_back(cuts.size());
+        size_t groups = starts.size();
+
+        vector<size_t> remaining(groups);
+        for(size_t i = 0 ; i < groups ; i++) remaining[i] = i;
+        StartGrid *grid = new StartGrid(starts, remaining);
+        vector<char> used(groups, 0);
+        vector<Cut> ordered(cuts.begin(), cuts.begin() + first);
+        ordered.reserve(cuts.size());
+        svg::Point position = first > 0 ? cuts[first - 1].end : svg::Point {0, 0};
+        for(size_t left = groups ; left > 0 ; left--) {
+            //Mostly empty grid is rebuilt smaller, so searches don't scan empty cells
+            if(left * 16 < grid->size() && grid->size() > 64) {
+                remaining.clear();
+                for(size_t i = 0 ; i < groups ; i++) {
+                    if(!used[i]) remaining.push_back(i);
+                }
+                delete grid;
+                grid = new StartGrid(starts, remaining);
+            }
+            size_t group = grid->takeNearest(position);
+            used[group] = 1;
+            ordered.insert(ordered.end(), cuts.begin() + begins[group], cuts.begin() + begins[group + 1]);
+            position = ordered.back().end;
+        }
+        delete grid;
+        cuts.swap(ordered);
+    }
+
+    //Squared distance of p from the segment between a and b
+    static double segmentDistance(const svg::Point &p, const svg::Point &a, const svg::Point &b) {
+        double dx = b.x - a.x, dy = b.y - a.y;
+        double length = dx * dx + dy * dy;
+        double t = length > 0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / length : 0;
+        t = max(0.0, min(1.0, t));
+        double x = a.x + t * dx - p.x, y = a.y + t * dy - p.y;
+        return x * x + y * y;
+    }
+
+    void SimplifyPass::run(Toolpath &toolpath) {
+        double limit = tolerance * tolerance;
+        //Cuts own disjoint ranges of points, so they are simplified in place and in parallel
+        scheduler::parallelFor(0, toolpath.cuts.size(), [&](size_t begin, size_t end) {
+            vector<char> keep;
+            vector<pair<size_t, size_t>> stack;
+            for(size_t c = begin ; c < end ; c++) {
+                Cut &cut = toolpath.cuts[c];
+                if(cut.kind != line || cut.count < 2) continue;
+                //Polyline is the start followed by the points, index 0 is the start
+                svg::Point *points = toolpath.points.data() + cut.first;
+                auto at = [&](size_t i) -> const svg::Point& {return i == 0 ? cut.start : points[i - 1];};
+                size_t n = cut.count + 1;
+                keep.assign(n, 0);
+                keep[0] = keep[n - 1] = 1;
+                stack.clear();
+                stack.push_back({0, n - 1});
+                while(!stack.empty()) {
+                    size_t a = stack.back().first, b = stack.back().second;
+                    stack.pop_back();
+                    double farthest = limit;
+                    size_t index = 0;
+                    for(size_t i = a + 1 ; i < b ; i++) {
+                        double distance = segmentDistance(at(i), at(a), at(b));
+                        if(distance > farthest) {
+                            farthest = distance;
+                            index = i;
+                        }
+                    }
+                    if(index == 0) continue;
+                    keep[index] = 1;
+                    stack.push_back({a, index});
+                    stack.push_back({index, b});
+                }
+                size_t count = 0;
+                for(size_t i = 1 ; i < n ; i++) {
+                    if(keep[i]) points[count++] = points[i - 1];
+                }
+                cut.count = count;
+            }
+        }, 256);
+    }
+
+    void QuantizePass::run(Toolpath &toolpath) {
+        auto snap = [this](const svg::Point &p) -> svg::Point {
+            return {origin.x + llround((p.x - origin.x) / step) * step, origin.y + llround((p.y - origin.y) / step) * step};
+        };
+        scheduler::parallelFor(0, toolpath.cuts.size(), [&](size_t begin, size_t end) {
+            for(size_t c = begin ; c < end ; c++) {
+                Cut &cut = toolpath.cuts[c];
+                cut.start = snap(cut.start);
+                cut.end = snap(cut.end);
+                cut.center = snap(cut.center);
+                svg::Point *points = toolpath.points.data() + cut.first;
+                if(cut.kind == raster) { //Every engraving move sets its power, so none are dropped
+                    for(size_t j = 0 ; j < cut.count ; j++) points[j] = snap(points[j]);
+                    continue;
+                }
+                size_t count = 0;
+                svg::Point last = cut.start;
+                for(size_t j = 0 ; j < cut.count ; j++) {
+                    svg::Point p = snap(points[j]);
+                    if((cut.kind == arc && j + 1 == cut.count) || p.x != last.x || p.y != last.y) {
+                        points[count++] = p;
+                        last = p;
+                    }
+                }
+                cut.count = count;
+            }
+        }, 256);
+    }
+
+    PassManager::~PassManager() {
+        for(Pass *pass : passes) delete pass;
+    }
+
+    void PassManager::add(Pass *pass) {
+        passes.push_back(pass);
+        Timing timing;
+        timing.name = pass->name();
+        timings.push_back(timing);
+    }
+
+    void PassManager::run(Toolpath &toolpath) {
+        for(size_t i = 0 ; i < passes.size() ; i++) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            passes[i]->run(toolpath);
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            timings[i].seconds += chrono::duration<double>(end - start).count();
+            timings[i].runs++;
+            stats::recordPass(passes[i]->name(), chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+            trace::record(passes[i]->name(), start, end, nullptr, toolpath.cuts.size());
+        }
+    }
+
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "svg.h"
+
+//Toolpath between the document and the output: cuts reduced to machine moves in document coordinates.
+//Passes reorder and simplify it, emitters serialize it to GCODE or other formats. Travel, tool toggles and speed
+//changes aren't stored, they follow from the gaps between cuts when emitting, so passes that reorder or join cuts
+//never have to keep them consistent.
+namespace toolpath {
+
+    using namespace std;
+
+    enum Kind : unsigned char {
+        line, //Straight moves through the points
+        arc, //Straight moves, the last one is an arc around center
+        raster //Moves engraving an image, each with its own power
+    };
+
+    //Continuous run of the tool from start through points
+    struct Cut {
+        svg::Point start;
+        svg::Point end; //Last point, or start if there are none
+        svg::Point center; //Of the arc
+        size_t first = 0; //Index of the first point
+        size_t count = 0;
+        size_t power = 0; //Index of the power of the first point, raster cuts only
+        size_t group = 0; //Source path. Passes keep cuts of a group together and in order, like hatching before its outline.
+        Kind kind = line;
+        bool clockwise = false;
+    };
+
+    struct Toolpath {
+        vector<svg::Point> points;
+        vector<double> powers; //0 to 1
+        vector<Cut> cuts; //Raster cuts come first
+
+        void clear();
+        void append(const Toolpath &other); //Cuts keep their groups
+        size_t groupEnd(size_t begin) const; //Index of the first cut of the next group
+    };
+
+    //Moves that keep a curve element within 0.01 mm, from 1 to 1000. Start and end are the ends of the element with
+    //the transformation applied. Anything flattening curves uses it, so sampled shapes match the cut outline.
+    size_t curveSteps(svg::PathElement *element, const svg::Transformation &transformation, const svg::Point &start, const svg::Point &end);
+
+    //Appends cuts of a path, one for every element. Lines are a single move, circular arcs a single arc move,
+    //other elements are sampled with the moves of curveSteps.
+    void addPath(Toolpath &toolpath, svg::Path &path, size_t group);
+
+    //Appends raster engraving of an image, one cut for every stroke
+    void addImage(Toolpath &toolpath, const svg::Image &image, double spacing, int mode);
+
+    //Motion the emitters are told about, besides the cuts
+    struct Settings {
+        double joinTolerance = 0.07; //Largest gap cut through without turning the tool off
+        double travelSpeed = 800;
+        double workingSpeed = 400;
+    };
+
+    //Back end serializing a toolpath. Points are in document coordinates.
+    class Emitter {
+    public:
+        virtual ~Emitter() {};
+        virtual void toolOn() = 0;
+        virtual void toolOff() = 0;
+        virtual void speed(double speed) = 0; //Of the following moves
+        virtual void travel(const svg::Point &to) = 0; //Move with the tool off
+        virtual void line(const svg::Point &to) = 0;
+        virtual void arc(const svg::Point &start, const svg::Point &to, const svg::Point &center, bool clockwise) = 0;
+        virtual void raster(const svg::Point &to, double power) = 0;
+    };
+
+    //Tool between two cuts
+    struct State {
+        svg::Point last = {0, 0};
+        bool toolEnabled = false;
+        bool raster = false; //Last cut engraved an image
+    };
+
+    //State after the cut before index, so ranges of a toolpath can be emitted independently
+    State stateBefore(const Toolpath &toolpath, size_t index);
+
+    //Emits cuts of a range with the travels, tool toggles and speed changes between them. Gaps up to the join
+    //tolerance are cut through. The tool is turned off after engraving, the power of paths is set again.
+    void emit(const Toolpath &toolpath, size_t begin, size_t end, const Settings &settings, State &state, Emitter &emitter);
+
+    //Turns the tool off if the toolpath ends with engraving
+    void finish(State &state, Emitter &emitter);
+
+    //Emitter moving every point by an offset, so copies of a toolpath are emitted without copying it
+    class OffsetEmitter : public Emitter {
+    private:
+        Emitter &target;
+        svg::Point offset;
+    public:
+        OffsetEmitter(Emitter &target, const svg::Point &offset) : target(target), offset(offset) {};
+        svg::Point shift(const svg::Point &p) const {return {p.x + offset.x, p.y + offset.y};};
+        //Points of the state are moved the other way, so the tool stays where the previous offset left it
+        void setOffset(const svg::Point &offset, State &state);
+        void toolOn() {target.toolOn();};
+        void toolOff() {target.toolOff();};
+        void speed(double speed) {target.speed(speed);};
+        void travel(const svg::Point &to) {target.travel(shift(to));};
+        void line(const svg::Point &to) {target.line(shift(to));};
+        void arc(const svg::Point &start, const svg::Point &to, const svg::Point &center, bool clockwise) {target.arc(shift(start), shift(to), shift(center), clockwise);};
+        void raster(const svg::Point &to, double power) {target.raster(shift(to), power);};
+    };
+
+    //Transformation of a toolpath
+    class Pass {
+    public:
+        virtual ~Pass() {};
+        virtual const char* name() const = 0;
+        virtual void run(Toolpath &toolpath) = 0;
+    };
+
+    //Merges groups that continue where the previous one ends, within tolerance, so ordering keeps them together
+    class JoinPass : public Pass {
+    private:
+        double tolerance;
+    public:
+        JoinPass(double tolerance) : tolerance(tolerance) {};
+        const char* name() const {return "join groups";};
+        void run(Toolpath &toolpath);
+    };
+
+    //Orders groups of vector cuts by the nearest start from where the previous group ended. Groups are found
+    //through a hash grid, so time grows almost linearly with their number. Engraving stays first.
+    class OrderPass : public Pass {
+    public:
+        const char* name() const {return "order groups";};
+        void run(Toolpath &toolpath);
+    };
+
+    //Removes points of straight cuts deviating from the simplified line by less than tolerance (Douglas-Peucker)
+    class SimplifyPass : public Pass {
+    private:
+        double tolerance;
+    public:
+        SimplifyPass(double tolerance) : tolerance(tolerance) {};
+        const char* name() const {return "simplify";};
+        void run(Toolpath &toolpath);
+    };
+
+    //Rounds points to a grid of step, the resolution coordinates are written with, and drops moves of straight
+    //cuts that end where the move before them does. Origin is a document point on the grid.
+    class QuantizePass : public Pass {
+    private:
+        double step;
+        svg::Point origin;
+    public:
+        QuantizePass(double step, const svg::Point &origin) : step(step), origin(origin) {};
+        const char* name() const {return "quantize";};
+        void run(Toolpath &toolpath);
+    };
+
+    //Runs passes in order, timing each of them
+    class PassManager {
+    public:
+        struct Timing {
+            string name;
+            double seconds = 0;
+            size_t runs = 0;
+        };
+    private:
+        vector<Pass*> passes;
+        vector<Timing> timings;
+    public:
+        PassManager() {};
+        ~PassManager();
+        PassManager(const PassManager&) = delete;
+        PassManager& operator=(const PassManager&) = delete;
+
+        void add(Pass *pass); //Takes ownership
+        bool empty() const {return passes.empty();};
+        void run(Toolpath &toolpath);
+        const vector<Timing>& getTimings() const {return timings;};
+    };
+
+}
@@ -0,0 +1,172 @@
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <vector>
+
+#include "trace.h"
+
+namespace trace {
+
+    using namespace std;
+
+    struct Event {
+        const char *name;
+        string detail;
+        size_t count;
+        chrono::steady_clock::time_point start, end;
+    };
+
+    //Events of one thread. Threads only contend for their own lock, unless events are being collected.
+    struct Buffer {
+        mutex lock;
+        vector<Event> events;
+        string name;
+        size_t id;
+    };
+
+    static mutex registryLock;
+    static vector<shared_ptr<Buffer>> buffers;
+    static size_t nextId = 1;
+    static atomic<bool> recording {false};
+    static chrono::steady_clock::time_point origin;
+    static ofstream output;
+    static thread_local shared_ptr<Buffer> threadBuffer;
+
+    static Buffer& currentBuffer() {
+        if(!threadBuffer) {
+            threadBuffer = make_shared<Buffer>();
+            lock_guard<mutex> guard(registryLock);
+            threadBuffer->id = nextId++;
+            buffers.push_back(threadBuffer);
+        }
+        return *threadBuffer;
+    }
+
+    static void writeString(ostream &out, const string &text) {
+        out << '"';
+        for(char c : text) {
+            if(c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if(static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out << escaped;
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    static double microseconds(chrono::steady_clock::duration duration) {
+        return chrono::duration_cast<chrono::nanoseconds>(duration).count() / 1000.0;
+    }
+
+    void start(const string &path) {
+#ifndef LASERWORKS_STATS
+        throw runtime_error("Tracing is not available, the program was built without LASERWORKS_STATS.");
+#endif
+        if(recording) throw logic_error("Trace is already being recorded");
+        output.open(path, ios::out | ios::trunc);
+        if(!output.good()) {
+            output.close();
+            output.clear();
+            throw runtime_error("Unable to open " + path);
+        }
+        {
+            lock_guard<mutex> guard(registryLock);
+            for(auto &buffer : buffers) {
+                lock_guard<mutex> bufferGuard(buffer->lock);
+                buffer->events.clear();
+            }
+        }
+        if(currentBuffer().name.empty()) nameThread("main");
+        origin = chrono::steady_clock::now();
+        recording = true;
+    }
+
+    bool stop() {
+        if(!recording) return true;
+        recording = false;
+        output << fixed;
+        output.precision(3);
+        output << "{\"traceEvents\":[\n";
+        bool first = true;
+        lock_guard<mutex> guard(registryLock);
+        for(auto &buffer : buffers) {
+            lock_guard<mutex> bufferGuard(buffer->lock);
+            if(!buffer->name.empty()) {
+                output << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":";
+                writeString(output, buffer->name);
+                output << "}}";
+                first = false;
+            }
+            for(const Event &event : buffer->events) {
+                output << (first ? "" : ",\n") << "{\"name\":";
+                writeString(output, event.name);
+                output << ",\"cat\":\"laserworks\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id;
+                output << ",\"ts\":" << microseconds(event.start - origin) << ",\"dur\":" << microseconds(event.end - event.start);
+                if(!event.detail.empty() || event.count > 0) {
+                    output << ",\"args\":{";
+                    if(!event.detail.empty()) {
+                        output << "\"detail\":";
+                        writeString(output, event.detail);
+                    }
+                    if(event.count > 0) output << (event.detail.empty() ? "" : ",") << "\"count\":" << event.count;
+                    output << "}";
+                }
+                output << "}";
+                first = false;
+            }
+            vector<Event>().swap(buffer->events);
+        }
+        output << "\n]}\n";
+        output.close();
+        bool failed = !output;
+        output.clear();
+
+        //Buffers of finished threads are no longer needed
+        for(size_t i = 0 ; i < buffers.size() ; ) {
+            if(buffers[i].use_count() == 1) {
+                buffers[i] = buffers.back();
+                buffers.pop_back();
+            } else {
+                i++;
+            }
+        }
+        return !failed;
+    }
+
+    bool active() {
+        return recording.load(memory_order_relaxed);
+    }
+
+    void nameThread(const string &name) {
+        Buffer &buffer = currentBuffer();
+        lock_guard<mutex> guard(buffer.lock);
+        buffer.name = name;
+    }
+
+    void record(const char *name, chrono::steady_clock::time_point start, chrono::steady_clock::time_point end, const char *detail, size_t count) {
+        if(!active()) return;
+        Buffer &buffer = currentBuffer();
+        lock_guard<mutex> guard(buffer.lock);
+        buffer.events.push_back(Event {name, detail ? string(detail) : string(), count, start, end});
+    }
+
+    Span::Span(const char *name, size_t count) : name(name), detail(nullptr), count(count), enabled(active()) {
+        if(enabled) start = chrono::steady_clock::now();
+    }
+
+    Span::Span(const char *name, const char *detail) : name(name), detail(detail), count(0), enabled(active()) {
+        if(enabled) start = chrono::steady_clock::now();
+    }
+
+    Span::~Span() {
+        if(enabled) record(name, start, chrono::steady_clock::now(), detail, count);
+    }
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+//Spans of work written as Chrome trace events, viewable in chrome://tracing or Perfetto. Like statistics,
+//spans are built only with LASERWORKS_STATS defined and are recorded only between start() and stop().
+namespace trace {
+
+    using namespace std;
+
+    void start(const string &path); //Throws if the file can't be created or tracing isn't built in
+    bool stop(); //Writes recorded events to the file, returns false if writing failed
+    bool active();
+    void nameThread(const string &name); //Shown instead of the thread number
+
+    //Adds a finished span of the calling thread
+    void record(const char *name, chrono::steady_clock::time_point start, chrono::steady_clock::time_point end,
+                const char *detail = nullptr, size_t count = 0);
+
+    //Records a trace to the path from construction to finish() or destruction, so it is written when the work
+    //throws too. Nothing is recorded if the path is empty. Errors of writing are only returned by finish().
+    class Recording {
+    private:
+        bool started = false;
+    public:
+        Recording(const string &path) {
+            if(path.empty()) return;
+            start(path);
+            started = true;
+        };
+        ~Recording() {finish();};
+        bool finish() { //Returns false if the trace couldn't be written
+            if(!started) return true;
+            started = false;
+            return stop();
+        };
+        Recording(const Recording&) = delete;
+        Recording& operator=(const Recording&) = delete;
+    };
+
+    //Records time between construction and destruction. Detail must stay valid until destruction.
+    class Span {
+    private:
+        const char *name;
+        const char *detail;
+        size_t count;
+        bool enabled;
+        chrono::steady_clock::time_point start;
+    public:
+        Span(const char *name, size_t count = 0);
+        Span(const char *name, const char *detail);
+        ~Span();
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+    };
+
+}
+
+#ifdef LASERWORKS_STATS
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(...) trace::Span TRACE_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
+#define TRACE_THREAD(name) trace::nameThread(name)
+#else
+#define TRACE_SPAN(...)
+#define TRACE_THREAD(name)
+#endif
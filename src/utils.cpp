@@ -16,4 +16,9 @@ double parseDouble(const string& str) {
         throw invalid_argument(s);
     }
     return d;
-}
\ No newline at end of file
+}
+
+bool has_suffix(const std::string &str, const std::string &suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
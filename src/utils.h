@@ -1,3 +1,6 @@
 #pragma once
 
-double parseDouble(const std::string& str);
\ No newline at end of file
+#include <string>
+
+double parseDouble(const std::string& str);
+bool has_suffix(const std::string &str, const std::string &suffix);
@@ -0,0 +1,497 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <math.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "viewer.h"
+#include "scheduler.h"
+#include "trace.h"
+
+namespace viewer {
+
+    using namespace std;
+
+    const size_t block_lines = 2048; //Lines parsed by one task
+    const size_t index_chunk = 1 << 22; //Bytes searched for line breaks by one task
+    const double arc_tolerance = 0.01; //mm, largest distance between an arc and its chords while analyzing
+
+    string describe(const Summary &summary) {
+        char text[320];
+        snprintf(text, sizeof(text), "%zu lines, cut %.0f mm in %zu moves, travel %.0f mm in %zu moves, X %.1f to %.1f, Y %.1f to %.1f, loaded in %.2f s",
+            summary.lines, summary.cutLength, summary.cutMoves, summary.travelLength, summary.travelMoves,
+            summary.minX, summary.maxX, summary.minY, summary.maxY, summary.loadTime);
+        return text;
+    }
+
+    //First line of a command, which is what is recognized in the file
+    static string firstLine(const string &gcode) {
+        size_t begin = gcode.find_first_not_of(" \t\r\n");
+        if(begin == string::npos) return string();
+        size_t end = gcode.find_first_of(";\r\n", begin); //Lines are compared without comments
+        string result = gcode.substr(begin, end == string::npos ? string::npos : end - begin);
+        return result.substr(0, result.find_last_not_of(" \t") + 1);
+    }
+
+    //Parses a decimal number. Mantissas up to 15 digits are divided by an exact power of ten, which rounds
+    //the same as strtod; other numbers are left to strtod. Returns pointer past the number, or p if there is none.
+    static const char* parseNumber(const char *p, const char *end, double &value) {
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+        const char *q = p;
+        bool negative = false;
+        if(q < end && (*q == '-' || *q == '+')) negative = *q++ == '-';
+        uint64_t mantissa = 0;
+        int digits = 0, decimals = 0;
+        bool point = false;
+        for( ; q < end ; q++) {
+            if(*q >= '0' && *q <= '9') {
+                mantissa = mantissa * 10 + (*q - '0');
+                digits++;
+                if(point) decimals++;
+            } else if(*q == '.' && !point) {
+                point = true;
+            } else {
+                break;
+            }
+        }
+        if(digits == 0) return p;
+        if(digits > 15 || (q < end && (*q == 'e' || *q == 'E'))) {
+            char *next;
+            value = strtod(p, &next);
+            return next > end ? p : next;
+        }
+        value = static_cast<double>(mantissa) / powers[decimals];
+        if(negative) value = -value;
+        return q;
+    }
+
+    //Line reduced to what changes the toolpath
+    struct Command {
+        enum Type {other, move, absolute, relative, home, toolOn, toolOff};
+        Type type = other;
+        int motion = -1; //G0 to G3 if given on the line
+        bool hasX = false, hasY = false;
+        double x = 0, y = 0, i = 0, j = 0;
+    };
+
+    static void parseCommand(const char *begin, const char *end, const string &toolOn, const string &toolOff, Command &command) {
+        command = Command();
+        const char *comment = static_cast<const char*>(memchr(begin, ';', end - begin));
+        if(comment) end = comment;
+        while(begin < end && (*begin == ' ' || *begin == '\t')) begin++;
+        while(end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+        if(begin == end) return;
+        size_t length = end - begin;
+        if(length == toolOn.length() && toolOn.compare(0, length, begin, length) == 0) {
+            command.type = Command::toolOn;
+            return;
+        }
+        if(length == toolOff.length() && toolOff.compare(0, length, begin, length) == 0) {
+            command.type = Command::toolOff;
+            return;
+        }
+
+        bool hasI = false, hasJ = false;
+        const char *p = begin;
+        while(p < end) {
+            char letter = toupper(*p++);
+            if(letter < 'A' || letter > 'Z') continue;
+            double value;
+            const char *next = parseNumber(p, end, value);
+            if(next == p) continue;
+            p = next;
+            switch(letter) {
+                case 'G': {
+                    int g = static_cast<int>(value);
+                    if(g >= 0 && g <= 3) command.motion = g;
+                    else if(g == 90) command.type = Command::absolute;
+                    else if(g == 91) command.type = Command::relative;
+                    else if(g == 28) command.type = Command::home;
+                    break;
+                }
+                case 'M': return; //Machine commands don't move
+                case 'X': command.x = value; command.hasX = true; break;
+                case 'Y': command.y = value; command.hasY = true; break;
+                case 'I': command.i = value; hasI = true; break;
+                case 'J': command.j = value; hasJ = true; break;
+            }
+        }
+        if(command.type == Command::other && (command.hasX || command.hasY || (command.motion >= 2 && (hasI || hasJ)))) {
+            command.type = Command::move;
+        }
+    }
+
+    //Calls line(begin, end) for every line of the text
+    template<typename Line>
+    static void forEachLine(const char *begin, const char *end, Line line) {
+        while(begin < end) {
+            const char *newline = static_cast<const char*>(memchr(begin, '\n', end - begin));
+            if(!newline) newline = end;
+            line(begin, newline);
+            begin = newline + 1;
+        }
+    }
+
+    //Follows commands from the given state. Calls visit(cut, x1, y1, x2, y2, first) for every move and chord of an arc,
+    //first is set for the first chord of a command.
+    template<typename Visit>
+    static void simulate(const char *begin, const char *end, State &state, const string &toolOn, const string &toolOff, double tolerance, Visit visit) {
+        Command command;
+        forEachLine(begin, end, [&](const char *lineBegin, const char *lineEnd) {
+            parseCommand(lineBegin, lineEnd, toolOn, toolOff, command);
+            if(command.motion >= 0) state.motion = command.motion;
+            switch(command.type) {
+                case Command::toolOn: state.toolEnabled = true; return;
+                case Command::toolOff: state.toolEnabled = false; return;
+                case Command::absolute: state.relative = false; return;
+                case Command::relative: state.relative = true; return;
+                case Command::home: state.x = state.y = 0; return;
+                case Command::other: return;
+                case Command::move: break;
+            }
+            double toX = command.hasX ? (state.relative ? state.x + command.x : command.x) : state.x;
+            double toY = command.hasY ? (state.relative ? state.y + command.y : command.y) : state.y;
+            bool cut = state.toolEnabled && state.motion != 0;
+            if(state.motion >= 2) {
+                //Arc split into chords short enough to stay within tolerance
+                double cx = state.x + command.i, cy = state.y + command.j;
+                double radius = sqrt(command.i * command.i + command.j * command.j);
+                double startAngle = atan2(state.y - cy, state.x - cx);
+                double sweep = atan2(toY - cy, toX - cx) - startAngle;
+                if(state.motion == 2 && sweep >= 0) sweep -= 2 * M_PI;
+                if(state.motion == 3 && sweep <= 0) sweep += 2 * M_PI;
+                double step = radius > tolerance ? 2 * acos(1 - tolerance / radius) : M_PI;
+                int chords = min(1 << 16, max(1, static_cast<int>(ceil(abs(sweep) / step))));
+                double x = state.x, y = state.y;
+                for(int i = 1 ; i < chords ; i++) {
+                    double angle = startAngle + sweep * i / chords;
+                    double nextX = cx + radius * cos(angle), nextY = cy + radius * sin(angle);
+                    visit(cut, x, y, nextX, nextY, i == 1);
+                    x = nextX;
+                    y = nextY;
+                }
+                visit(cut, x, y, toX, toY, chords == 1);
+            } else if(toX != state.x || toY != state.y) {
+                visit(cut, state.x, state.y, toX, toY, true);
+            }
+            state.x = toX;
+            state.y = toY;
+        });
+    }
+
+    GcodeFile::GcodeFile(const string &path, const string &toolOnGcode, const string &toolOffGcode) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        toolOn = firstLine(toolOnGcode);
+        toolOff = firstLine(toolOffGcode);
+
+        fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) throw runtime_error("Unable to open " + path);
+        struct stat status;
+        if(fstat(fd, &status) != 0) {
+            close(fd);
+            throw runtime_error("Unable to read " + path);
+        }
+        length = static_cast<size_t>(status.st_size);
+        if(length > 0) {
+            void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("Unable to map " + path);
+            }
+            madvise(mapping, length, MADV_WILLNEED);
+            data = static_cast<const char*>(mapping);
+        }
+
+        {
+            TRACE_SPAN("index GCODE");
+            index();
+        }
+        {
+            TRACE_SPAN("resolve GCODE", blocks.size());
+            resolve();
+        }
+        {
+            TRACE_SPAN("analyze GCODE", blocks.size());
+            analyze();
+        }
+        summary.loadTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    GcodeFile::~GcodeFile() {
+        if(data) munmap(const_cast<char*>(data), length);
+        if(fd >= 0) close(fd);
+    }
+
+    void GcodeFile::index() {
+        //Counting line breaks of every chunk gives the number of the first line starting in the following ones
+        size_t chunks = length / index_chunk + 1;
+        vector<size_t> breaks(chunks);
+        scheduler::parallelFor(0, chunks, [&](size_t begin, size_t end) {
+            for(size_t c = begin ; c < end ; c++) {
+                const char *p = data + c * index_chunk;
+                const char *last = data + min(length, (c + 1) * index_chunk);
+                size_t count = 0;
+                while(p < last && (p = static_cast<const char*>(memchr(p, '\n', last - p)))) {
+                    count++;
+                    p++;
+                }
+                breaks[c] = count;
+            }
+        }, 1);
+        vector<size_t> firstLines(chunks);
+        size_t lines = 0;
+        for(size_t c = 0 ; c < chunks ; c++) {
+            firstLines[c] = lines;
+            lines += breaks[c];
+        }
+        if(length > 0 && data[length - 1] != '\n') lines++;
+        summary.lines = lines;
+
+        //Blocks start at every block_lines line
+        blocks.assign((lines + block_lines - 1) / block_lines, Block());
+        if(blocks.empty()) return;
+        blocks[0].begin = 0;
+        scheduler::parallelFor(0, chunks, [&](size_t begin, size_t end) {
+            for(size_t c = begin ; c < end ; c++) {
+                const char *p = data + c * index_chunk;
+                const char *last = data + min(length, (c + 1) * index_chunk);
+                size_t line = firstLines[c];
+                while(p < last && (p = static_cast<const char*>(memchr(p, '\n', last - p)))) {
+                    p++;
+                    line++;
+                    if(line % block_lines == 0 && static_cast<size_t>(p - data) < length) blocks[line / block_lines].begin = p - data;
+                }
+            }
+        }, 1);
+        for(size_t b = 0 ; b < blocks.size() ; b++) {
+            blocks[b].end = b + 1 < blocks.size() ? blocks[b + 1].begin : length;
+        }
+    }
+
+    void GcodeFile::resolve() {
+        //Every block is followed without knowing the state it starts in. Modes end up as the last ones set in the block.
+        //Coordinates are either set by an absolute move or moved by relative ones; which of them depends on the
+        //distance mode at the start, so both cases are tracked until the block sets the mode itself.
+        struct Effect {
+            int relative = -1, toolEnabled = -1, motion = -1; //-1 if not changed by the block
+            bool absoluteX[2] = {false, false}, absoluteY[2] = {false, false}; //Indexed by distance mode at the start
+            double x[2] = {0, 0}, y[2] = {0, 0}; //Position if absolute, otherwise distance moved
+        };
+        vector<Effect> effects(blocks.size());
+        scheduler::parallelFor(0, blocks.size(), [&](size_t begin, size_t end) {
+            Command command;
+            for(size_t b = begin ; b < end ; b++) {
+                Effect &effect = effects[b];
+                forEachLine(data + blocks[b].begin, data + blocks[b].end, [&](const char *lineBegin, const char *lineEnd) {
+                    parseCommand(lineBegin, lineEnd, toolOn, toolOff, command);
+                    if(command.motion >= 0) effect.motion = command.motion;
+                    switch(command.type) {
+                        case Command::toolOn: effect.toolEnabled = 1; break;
+                        case Command::toolOff: effect.toolEnabled = 0; break;
+                        case Command::absolute: effect.relative = 0; break;
+                        case Command::relative: effect.relative = 1; break;
+                        case Command::home:
+                            for(int h = 0 ; h < 2 ; h++) {
+                                effect.absoluteX[h] = effect.absoluteY[h] = true;
+                                effect.x[h] = effect.y[h] = 0;
+                            }
+                            break;
+                        case Command::move:
+                            for(int h = 0 ; h < 2 ; h++) {
+                                bool relative = effect.relative >= 0 ? effect.relative == 1 : h == 1;
+                                if(command.hasX) {
+                                    if(relative) effect.x[h] += command.x;
+                                    else effect.x[h] = command.x;
+                                    if(!relative) effect.absoluteX[h] = true;
+                                }
+                                if(command.hasY) {
+                                    if(relative) effect.y[h] += command.y;
+                                    else effect.y[h] = command.y;
+                                    if(!relative) effect.absoluteY[h] = true;
+                                }
+                            }
+                            break;
+                        case Command::other:
+                            break;
+                    }
+                });
+            }
+        });
+
+        //Effects are chained in order, which only takes a step per block
+        State state;
+        for(size_t b = 0 ; b < blocks.size() ; b++) {
+            blocks[b].entry = state;
+            const Effect &effect = effects[b];
+            int h = state.relative ? 1 : 0;
+            state.x = effect.absoluteX[h] ? effect.x[h] : state.x + effect.x[h];
+            state.y = effect.absoluteY[h] ? effect.y[h] : state.y + effect.y[h];
+            if(effect.relative >= 0) state.relative = effect.relative == 1;
+            if(effect.toolEnabled >= 0) state.toolEnabled = effect.toolEnabled == 1;
+            if(effect.motion >= 0) state.motion = effect.motion;
+        }
+    }
+
+    void GcodeFile::analyze() {
+        vector<Summary> partial(blocks.size());
+        scheduler::parallelFor(0, blocks.size(), [&](size_t begin, size_t end) {
+            for(size_t b = begin ; b < end ; b++) {
+                Block &block = blocks[b];
+                Summary &sum = partial[b];
+                block.minX = block.minY = HUGE_VAL;
+                block.maxX = block.maxY = -HUGE_VAL;
+                block.cuts = false;
+                State state = block.entry;
+                simulate(data + block.begin, data + block.end, state, toolOn, toolOff, arc_tolerance,
+                         [&](bool cut, double x1, double y1, double x2, double y2, bool first) {
+                    double distance = sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+                    if(cut) {
+                        sum.cutLength += distance;
+                        if(first) sum.cutMoves++;
+                        block.cuts = true;
+                    } else {
+                        sum.travelLength += distance;
+                        if(first) sum.travelMoves++;
+                    }
+                    block.minX = min(block.minX, min(x1, x2));
+                    block.minY = min(block.minY, min(y1, y2));
+                    block.maxX = max(block.maxX, max(x1, x2));
+                    block.maxY = max(block.maxY, max(y1, y2));
+                });
+            }
+        });
+
+        double minX = HUGE_VAL, minY = HUGE_VAL, maxX = -HUGE_VAL, maxY = -HUGE_VAL;
+        for(size_t b = 0 ; b < blocks.size() ; b++) {
+            summary.cutMoves += partial[b].cutMoves;
+            summary.travelMoves += partial[b].travelMoves;
+            summary.cutLength += partial[b].cutLength;
+            summary.travelLength += partial[b].travelLength;
+            minX = min(minX, blocks[b].minX);
+            minY = min(minY, blocks[b].minY);
+            maxX = max(maxX, blocks[b].maxX);
+            maxY = max(maxY, blocks[b].maxY);
+        }
+        if(minX <= maxX) {
+            summary.minX = minX;
+            summary.minY = minY;
+            summary.maxX = maxX;
+            summary.maxY = maxY;
+        }
+    }
+
+    //Builds polylines of one color, skipping points that are too close to the previous one to be seen
+    class Tracer {
+    private:
+        Polylines &out;
+        bool open = false;
+        bool pending = false; //Last point was skipped
+        float lastX, lastY, pendingX, pendingY;
+
+        void add(float x, float y) {
+            out.points.push_back(x);
+            out.points.push_back(y);
+            lastX = x;
+            lastY = y;
+        }
+
+    public:
+        Tracer(Polylines &out) : out(out) {};
+
+        void segment(float x1, float y1, float x2, float y2) {
+            bool continued = open && (pending ? pendingX == x1 && pendingY == y1 : lastX == x1 && lastY == y1);
+            if(!continued) {
+                finish();
+                out.starts.push_back(out.points.size() / 2);
+                add(x1, y1);
+                open = true;
+            }
+            if(abs(x2 - lastX) < 1 && abs(y2 - lastY) < 1) {
+                pending = true;
+                pendingX = x2;
+                pendingY = y2;
+            } else {
+                add(x2, y2);
+                pending = false;
+            }
+        }
+
+        void finish() {
+            if(pending) add(pendingX, pendingY);
+            pending = false;
+            open = false;
+        }
+    };
+
+    void GcodeFile::render(const View &view, Polylines &cuts, Polylines &travels) const {
+        cuts.clear();
+        travels.clear();
+        const float margin = 2;
+        const float left = -margin, top = -margin, right = view.width + margin, bottom = view.height + margin;
+        double tolerance = max(0.001, 0.5 / view.scale);
+        vector<Polylines> blockCuts(blocks.size()), blockTravels(blocks.size());
+
+        scheduler::parallelFor(0, blocks.size(), [&](size_t begin, size_t end) {
+            TRACE_SPAN("render GCODE", end - begin);
+            for(size_t b = begin ; b < end ; b++) {
+                const Block &block = blocks[b];
+                if(block.minX > block.maxX) continue;
+                float x1 = view.originX + block.minX * view.scale, x2 = view.originX + block.maxX * view.scale;
+                float y1 = view.originY - block.maxY * view.scale, y2 = view.originY - block.minY * view.scale;
+                if(x2 < left || x1 > right || y2 < top || y1 > bottom) continue;
+
+                //Blocks smaller than a pixel become a dot
+                if(x2 - x1 < 1 && y2 - y1 < 1) {
+                    Polylines &out = block.cuts ? blockCuts[b] : blockTravels[b];
+                    out.starts.push_back(0);
+                    out.points.insert(out.points.end(), {x1, y1, x1 + 1, y1});
+                    continue;
+                }
+
+                Tracer cutTracer(blockCuts[b]), travelTracer(blockTravels[b]);
+                State state = block.entry;
+                simulate(data + block.begin, data + block.end, state, toolOn, toolOff, tolerance,
+                         [&](bool cut, double mx1, double my1, double mx2, double my2, bool) {
+                    float sx1 = view.originX + mx1 * view.scale, sy1 = view.originY - my1 * view.scale;
+                    float sx2 = view.originX + mx2 * view.scale, sy2 = view.originY - my2 * view.scale;
+                    Tracer &tracer = cut ? cutTracer : travelTracer;
+                    //Moves entirely on one side of the view are not drawn
+                    if((sx1 < left && sx2 < left) || (sx1 > right && sx2 > right) || (sy1 < top && sy2 < top) || (sy1 > bottom && sy2 > bottom)) {
+                        tracer.finish();
+                        return;
+                    }
+                    tracer.segment(sx1, sy1, sx2, sy2);
+                });
+                cutTracer.finish();
+                travelTracer.finish();
+            }
+        });
+
+        //Joining blocks in order
+        auto join = [](vector<Polylines> &parts, Polylines &out) {
+            size_t points = 0, starts = 0;
+            for(Polylines &part : parts) {
+                points += part.points.size();
+                starts += part.starts.size();
+            }
+            out.points.reserve(points);
+            out.starts.reserve(starts);
+            for(Polylines &part : parts) {
+                size_t offset = out.points.size() / 2;
+                for(size_t start : part.starts) out.starts.push_back(start + offset);
+                out.points.insert(out.points.end(), part.points.begin(), part.points.end());
+            }
+        };
+        join(blockCuts, cuts);
+        join(blockTravels, travels);
+    }
+
+}
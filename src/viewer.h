@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+//Loading GCODE files for preview. Files are mapped into memory and split into blocks of lines in parallel.
+//Moves are parsed only while analyzing and drawing, so even files of hundreds of megabytes open in seconds.
+namespace viewer {
+
+    using namespace std;
+
+    //Totals of a toolpath
+    struct Summary {
+        size_t lines = 0;
+        size_t cutMoves = 0; //Move commands, arcs count once
+        size_t travelMoves = 0;
+        double cutLength = 0; //mm
+        double travelLength = 0;
+        double minX = 0, minY = 0, maxX = 0, maxY = 0; //Bounds of all moves, in machine coordinates
+        double loadTime = 0; //Seconds spent mapping, indexing and analyzing
+    };
+
+    //One line summary of the file
+    string describe(const Summary &summary);
+
+    //Moves of one color in canvas coordinates. Every polyline starts with a point where the tool is lifted.
+    struct Polylines {
+        vector<float> points; //x and y of every point
+        vector<size_t> starts; //Index of the first point of every polyline
+        void clear() {points.clear(); starts.clear();};
+    };
+
+    //Machine coordinates x, y are drawn at originX + x * scale, originY - y * scale
+    struct View {
+        double originX, originY;
+        double scale; //Pixels per mm
+        int width, height; //Canvas size, moves outside are culled
+    };
+
+    //Position and modes of the machine between two lines
+    struct State {
+        double x = 0, y = 0;
+        bool relative = false;
+        bool toolEnabled = false;
+        int motion = 0; //Modal G0 to G3, used by lines with coordinates only
+    };
+
+    class GcodeFile {
+    private:
+        //Consecutive lines handled by one task
+        struct Block {
+            size_t begin, end; //Offsets in the file
+            State entry; //State before the first line
+            double minX, minY, maxX, maxY; //Bounds of moves, empty if min > max
+            bool cuts; //Contains cut moves
+        };
+
+        int fd = -1;
+        const char *data = nullptr;
+        size_t length = 0;
+        vector<Block> blocks;
+        Summary summary;
+        string toolOn, toolOff;
+
+        void index(); //Splits the file into blocks
+        void resolve(); //Finds the state each block starts in
+        void analyze(); //Bounds and totals
+
+    public:
+        GcodeFile(const string &path, const string &toolOnGcode, const string &toolOffGcode); //Throws if the file can't be read
+        ~GcodeFile();
+        GcodeFile(const GcodeFile&) = delete;
+        GcodeFile& operator=(const GcodeFile&) = delete;
+
+        const Summary& getSummary() const {return summary;};
+
+        //Parses moves of blocks inside the view, in parallel. Blocks smaller than a pixel are drawn as a dot and
+        //points within a pixel of the previous one are skipped, so dense toolpaths give far fewer points than moves.
+        void render(const View &view, Polylines &cuts, Polylines &travels) const;
+    };
+
+}
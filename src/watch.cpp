@@ -0,0 +1,56 @@
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "watch.h"
+
+namespace watch {
+
+    using namespace std;
+
+    FileWatcher::FileWatcher(const string &path) {
+        size_t slash = path.rfind('/');
+        string directory = slash == string::npos ? "." : path.substr(0, slash + 1);
+        name = slash == string::npos ? path : path.substr(slash + 1);
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(fd < 0) throw runtime_error(string("Unable to watch files: ") + strerror(errno));
+        if(inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            int error = errno;
+            close(fd);
+            throw runtime_error("Unable to watch " + directory + ": " + strerror(error));
+        }
+    }
+
+    FileWatcher::~FileWatcher() {
+        close(fd);
+    }
+
+    bool FileWatcher::changed() {
+        bool result = false;
+        alignas(inotify_event) char buffer[4096];
+        while(true) {
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if(length <= 0) break;
+            for(ssize_t offset = 0 ; offset < length ; ) {
+                inotify_event *event = reinterpret_cast<inotify_event*>(buffer + offset);
+                if(event->len > 0 && name == event->name) result = true;
+                offset += sizeof(inotify_event) + event->len;
+            }
+        }
+        return result;
+    }
+
+    void FileWatcher::wait(int settle) {
+        pollfd descriptor {fd, POLLIN, 0};
+        while(true) {
+            if(poll(&descriptor, 1, -1) < 0 && errno != EINTR) throw runtime_error(string("Watching failed: ") + strerror(errno));
+            if(changed()) break;
+        }
+        //Saving may take several writes and renames
+        while(poll(&descriptor, 1, settle) > 0) changed();
+    }
+
+}
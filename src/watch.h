@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+//Notifies about changes of a file through inotify. The directory is watched rather than the file, because
+//editors often save by writing a new file and renaming it over the old one.
+namespace watch {
+
+    using namespace std;
+
+    class FileWatcher {
+    private:
+        int fd = -1;
+        string name; //File name within the directory
+
+    public:
+        FileWatcher(const string &path); //Throws if the file can't be watched
+        ~FileWatcher();
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+
+        int getDescriptor() const {return fd;}; //Readable when events are pending, for main loops
+        bool changed(); //Reads pending events without blocking. Returns true if the file was written or replaced.
+        void wait(int settle); //Blocks until the file changes and no more changes arrive for settle milliseconds
+    };
+
+}
@@ -0,0 +1,134 @@
+//Round trip of MeatPack packing through the decoder: every character that can be sent, packed and escaped pairs,
+//lines of odd length, a last line without a line break and output split into pieces at every position. Prints the
+//failures and returns 1 if there are any.
+
+#include <stdio.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "meatpack.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static string printable(const string &text) {
+    string result;
+    char code[8];
+    for(unsigned char c : text) {
+        if(c >= 32 && c < 127) {
+            result.push_back(static_cast<char>(c));
+        } else {
+            snprintf(code, sizeof(code), "\\x%02X", c);
+            result += code;
+        }
+    }
+    return result;
+}
+
+static void check(const char *name, const string &expected, const string &actual) {
+    if(expected == actual) return;
+    if(failures++ < 20) {
+        size_t at = 0;
+        while(at < expected.size() && at < actual.size() && expected[at] == actual[at]) at++;
+        size_t from = at > 20 ? at - 20 : 0;
+        printf("%s: differs at %zu\n  expected %s\n  got      %s\n", name, at,
+            printable(expected.substr(from, 40)).c_str(), printable(actual.substr(from, 40)).c_str());
+    }
+}
+
+//Packs text through the stream buffer, written in pieces of the given size
+static string encode(const string &text, bool noSpaces, size_t piece) {
+    stringbuf packed;
+    {
+        meatpack::EncodeBuffer buffer(&packed, noSpaces);
+        ostream out(&buffer);
+        for(size_t i = 0 ; i < text.size() ; i += piece) out.write(text.data() + i, min(piece, text.size() - i));
+        out.flush();
+        if(!buffer.finish()) check("finish", "written", "failed");
+    }
+    return packed.str();
+}
+
+//Unpacks data given to the decoder in pieces of the given size
+static string decode(const string &data, size_t piece) {
+    meatpack::Decoder decoder;
+    string text;
+    for(size_t i = 0 ; i < data.size() ; i += piece) decoder.decode(data.data() + i, min(piece, data.size() - i), text);
+    if(decoder.isActive()) check("decoder", "inactive after the end", "active");
+    return text;
+}
+
+//Spaces of G commands are left out when the code of ' ' is used for 'E'
+static string withoutSpaces(const string &text) {
+    string result;
+    bool drop = false, start = true;
+    for(char c : text) {
+        if(start) drop = c == 'G' || c == 'g';
+        start = c == '\n';
+        if(!(drop && c == ' ')) result.push_back(c);
+    }
+    return result;
+}
+
+int main() {
+    //Every byte but the signal byte, which the firmware can't receive inside packed data
+    string characters;
+    for(int c = 1 ; c < meatpack::signal_byte ; c++) {
+        if(c != '\n') characters.push_back(static_cast<char>(c));
+    }
+    const string packable = "0123456789. GXE";
+
+    //Lines of every pair of a packable character and any other, in both orders, and of single characters
+    string pairs;
+    for(char a : packable) {
+        for(char b : characters) {
+            pairs += string {a, b} + "\n" + string {b, a} + "\n";
+        }
+    }
+    for(char c : characters) pairs += string {c} + "\n";
+
+    //Lines of one to five characters with escapes in every position, followed by empty lines
+    string tails;
+    for(size_t length = 1 ; length <= 5 ; length++) {
+        for(size_t mask = 0 ; mask < (1u << length) ; mask++) {
+            string line;
+            for(size_t i = 0 ; i < length ; i++) line.push_back(mask & (1u << i) ? 'Y' : '1');
+            tails += line + "\n\n";
+        }
+    }
+
+    const string gcode = "G21\nG90\nM4 S0\nG0 X10.5 Y20.25\nG1 X11 Y20.5 F1200 S1000\nG2 X12 Y21 I0.5 J0.5\nM5\n; done\n";
+    vector<pair<const char*, string>> texts {{"characters", pairs}, {"tails", tails}, {"gcode", gcode}};
+    for(pair<const char*, string> &text : texts) {
+        for(bool noSpaces : {false, true}) {
+            string expected = noSpaces ? withoutSpaces(text.second) : text.second;
+            check(text.first, expected, decode(encode(text.second, noSpaces, 1 << 20), 1 << 20));
+        }
+    }
+
+    //Last lines without a line break get one, at both lengths of a last byte
+    for(const char *last : {"G1 X1", "G1 X12", "M5"}) {
+        string text = gcode + last;
+        check(last, text + "\n", decode(encode(text, false, 1 << 20), 1 << 20));
+    }
+
+    //Lines and signal bytes split between writes and between reads
+    string packed = encode(gcode, false, 1 << 20);
+    for(size_t piece = 1 ; piece <= 16 ; piece++) {
+        check("split writes", encode(gcode, false, piece), packed);
+        check("split reads", gcode, decode(packed, piece));
+    }
+
+    //Plain text around packed text stays as it is
+    string mixed = "G28\n" + packed + "M2\n";
+    check("plain around packed", "G28\n" + gcode + "M2\n", decode(mixed, 1 << 20));
+
+    if(failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("MeatPack round trip passed\n");
+    return 0;
+}
@@ -0,0 +1,76 @@
+//Images inside elements referenced by use: engraved once for every use element, where it puts them, and never
+//where they are defined. Prints the failures and returns 1 if there are any.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+
+#include "svg.h"
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(const char *name, bool passed) {
+    if(passed) return;
+    failures++;
+    printf("%s failed\n", name);
+}
+
+//Document coordinates of the top left corner of an image
+static svg::Point corner(const svg::Image &image) {
+    return svg::Point {image.x, image.y} * image.transformation;
+}
+
+static bool near(const svg::Point &p, double x, double y) {
+    return fabs(p.x - x) < 1e-9 && fabs(p.y - y) < 1e-9;
+}
+
+int main() {
+    const char *pixel = "data:image/png;base64,iVBORw0KGgo=";
+    string document = string() +
+        "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" width=\"100mm\" height=\"100mm\" viewBox=\"0 0 100 100\">\n"
+        "<defs>\n"
+        "  <g id=\"part\" transform=\"translate(1,2)\">\n"
+        "    <image x=\"3\" y=\"4\" width=\"10\" height=\"10\" xlink:href=\"" + pixel + "\"/>\n"
+        "    <path d=\"M 0 0 L 10 0\"/>\n"
+        "  </g>\n"
+        "</defs>\n"
+        "<use xlink:href=\"#part\" x=\"20\" y=\"30\"/>\n"
+        "<use xlink:href=\"#part\" transform=\"translate(50,0)\"/>\n"
+        "<g id=\"outer\"><use xlink:href=\"#part\" x=\"5\"/></g>\n"
+        "<use xlink:href=\"#outer\" y=\"60\"/>\n"
+        "</svg>\n";
+
+    char path[] = "/tmp/svg-use-testXXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        printf("Unable to create a temporary file\n");
+        return 1;
+    }
+    close(fd);
+    ofstream(path) << document;
+    svg::Document *loaded = svg::loadDocument(path);
+    unlink(path);
+
+    //Drawn by the four use elements only, the nested one through the group using it
+    check("image count", loaded->images.size() == 4);
+    check("path count", loaded->paths.size() == 4);
+    if(loaded->images.size() == 4) {
+        check("use with x and y", near(corner(loaded->images[0]), 24, 36));
+        check("use with transform", near(corner(loaded->images[1]), 54, 6));
+        check("use inside a group", near(corner(loaded->images[2]), 9, 6));
+        check("group referenced by use", near(corner(loaded->images[3]), 9, 66));
+    }
+    delete loaded;
+
+    if(failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("Images of use elements passed\n");
+    return 0;
+}
@@ -0,0 +1,274 @@
+//Synthetic SVG drawings for benchmarking how loading and export scale. The number of segments, their mix of path
+//commands, the nesting depth of groups and how many elements are transformed are configurable, and the same seed
+//always produces the same file.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Settings {
+    size_t segments = 1000; //Path commands after the moveto, in total
+    size_t pathSegments = 100; //Per path, the last path gets the rest
+    size_t groupPaths = 16; //Paths in every innermost group
+    int depth = 2; //Groups around every path
+    double transforms = 0.1; //Share of groups and paths with a transform attribute
+    double relative = 0.5; //Share of commands with relative coordinates
+    string mix = "L=4,C=2,Q=1,S=1,T=1,H=1,V=1,A=1"; //Weights of path commands
+    double size = 200; //Width and height of the drawing, mm
+    unsigned long long seed = 1;
+    string output;
+};
+
+static void printUsage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("Writes a synthetic SVG drawing for benchmarks.\n");
+    printf("Options:\n");
+    printf("  --segments N         Path segments in total, defaults to 1000\n");
+    printf("  --path-segments N    Segments of every path, defaults to 100\n");
+    printf("  --group-paths N      Paths in every innermost group, defaults to 16\n");
+    printf("  --depth N            Groups nested around every path, defaults to 2\n");
+    printf("  --transforms SHARE   Share of groups and paths with a transform, 0 to 1, defaults to 0.1\n");
+    printf("  --relative SHARE     Share of commands with relative coordinates, 0 to 1, defaults to 0.5\n");
+    printf("  --mix WEIGHTS        Weights of commands, defaults to L=4,C=2,Q=1,S=1,T=1,H=1,V=1,A=1\n");
+    printf("  --size MM            Width and height of the drawing, defaults to 200\n");
+    printf("  --seed N             Seed of the random numbers, defaults to 1\n");
+    printf("  -o, --output FILE    File to write, defaults to standard output\n");
+    printf("  -h, --help           Show this message\n");
+}
+
+static bool parseArguments(int argc, char **argv, Settings &settings) {
+    for(int i = 1 ; i < argc ; i++) {
+        string arg = argv[i];
+        bool value = i + 1 < argc;
+        if(arg == "--segments" && value) {
+            settings.segments = strtoull(argv[++i], nullptr, 10);
+        } else if(arg == "--path-segments" && value) {
+            settings.pathSegments = strtoull(argv[++i], nullptr, 10);
+        } else if(arg == "--group-paths" && value) {
+            settings.groupPaths = strtoull(argv[++i], nullptr, 10);
+        } else if(arg == "--depth" && value) {
+            settings.depth = atoi(argv[++i]);
+        } else if(arg == "--transforms" && value) {
+            settings.transforms = atof(argv[++i]);
+        } else if(arg == "--relative" && value) {
+            settings.relative = atof(argv[++i]);
+        } else if(arg == "--mix" && value) {
+            settings.mix = argv[++i];
+        } else if(arg == "--size" && value) {
+            settings.size = atof(argv[++i]);
+        } else if(arg == "--seed" && value) {
+            settings.seed = strtoull(argv[++i], nullptr, 10);
+        } else if((arg == "-o" || arg == "--output") && value) {
+            settings.output = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return settings.pathSegments > 0 && settings.groupPaths > 0 && settings.depth >= 0 && settings.size > 0;
+}
+
+//Weights of commands from a list like L=4,C=2. Returns false if a command is unknown or all weights are 0.
+static bool parseMix(const string &mix, vector<pair<char, double>> &weights) {
+    size_t position = 0;
+    double total = 0;
+    while(position < mix.size()) {
+        size_t end = mix.find(',', position);
+        if(end == string::npos) end = mix.size();
+        string item = mix.substr(position, end - position);
+        position = end + 1;
+        if(item.size() < 3 || item[1] != '=' || !strchr("LCQSTHVA", item[0])) return false;
+        double weight = atof(item.c_str() + 2);
+        if(weight < 0) return false;
+        weights.push_back({item[0], weight});
+        total += weight;
+    }
+    return total > 0;
+}
+
+class Generator {
+private:
+    const Settings &settings;
+    vector<pair<char, double>> weights;
+    mt19937_64 random;
+    FILE *out;
+    double x = 0, y = 0; //Current point
+    double controlX = 0, controlY = 0; //Last control point, reflected by S and T
+    char previous = 'M';
+
+    double uniform(double low, double high) {return uniform_real_distribution<double>(low, high)(random);};
+    bool chance(double share) {return uniform(0, 1) < share;};
+
+    //Point near the current one, kept inside the drawing
+    void nextPoint(double &toX, double &toY) {
+        double reach = settings.size / 20;
+        toX = min(settings.size, max(0.0, x + uniform(-reach, reach)));
+        toY = min(settings.size, max(0.0, y + uniform(-reach, reach)));
+    }
+
+    char pickCommand() {
+        double total = 0;
+        for(const pair<char, double> &weight : weights) total += weight.second;
+        double pick = uniform(0, total);
+        for(const pair<char, double> &weight : weights) {
+            if(pick < weight.second) return weight.first;
+            pick -= weight.second;
+        }
+        return weights.back().first;
+    }
+
+    //Coordinates relative to the current point if the command is lowercase
+    void writePoint(bool relative, double px, double py) {
+        fprintf(out, " %.3f %.3f", relative ? px - x : px, relative ? py - y : py);
+    }
+
+    void writeTransform() {
+        switch(random() % 4) {
+            case 0: fprintf(out, " transform=\"translate(%.3f %.3f)\"", uniform(-10, 10), uniform(-10, 10)); break;
+            case 1: fprintf(out, " transform=\"rotate(%.2f %.3f %.3f)\"", uniform(-10, 10), settings.size / 2, settings.size / 2); break;
+            case 2: fprintf(out, " transform=\"scale(%.4f)\"", uniform(0.9, 1.1)); break;
+            default: fprintf(out, " transform=\"matrix(%.4f %.4f %.4f %.4f %.3f %.3f)\"", uniform(0.9, 1.1), uniform(-0.1, 0.1),
+                             uniform(-0.1, 0.1), uniform(0.9, 1.1), uniform(-5, 5), uniform(-5, 5));
+        }
+    }
+
+    void writeSegment() {
+        char command = pickCommand();
+        //Smooth curves are written only after curves they continue, which is what the parser accepts
+        if(command == 'S' && previous != 'C' && previous != 'S') command = 'C';
+        if(command == 'T' && previous != 'Q' && previous != 'T') command = 'Q';
+        bool relative = chance(settings.relative);
+        fputc(relative ? command - 'A' + 'a' : command, out);
+        double toX, toY, c1x, c1y, c2x, c2y;
+        nextPoint(toX, toY);
+        double reflectedX = 2 * x - controlX, reflectedY = 2 * y - controlY;
+        switch(command) {
+            case 'L':
+                writePoint(relative, toX, toY);
+                break;
+            case 'H':
+                fprintf(out, " %.3f", relative ? toX - x : toX);
+                toY = y;
+                break;
+            case 'V':
+                fprintf(out, " %.3f", relative ? toY - y : toY);
+                toX = x;
+                break;
+            case 'C':
+                nextPoint(c1x, c1y);
+                nextPoint(c2x, c2y);
+                writePoint(relative, c1x, c1y);
+                writePoint(relative, c2x, c2y);
+                writePoint(relative, toX, toY);
+                controlX = c2x;
+                controlY = c2y;
+                break;
+            case 'S':
+                nextPoint(c2x, c2y);
+                writePoint(relative, c2x, c2y);
+                writePoint(relative, toX, toY);
+                controlX = c2x;
+                controlY = c2y;
+                break;
+            case 'Q':
+                nextPoint(c1x, c1y);
+                writePoint(relative, c1x, c1y);
+                writePoint(relative, toX, toY);
+                controlX = c1x;
+                controlY = c1y;
+                break;
+            case 'T':
+                writePoint(relative, toX, toY);
+                controlX = reflectedX;
+                controlY = reflectedY;
+                break;
+            case 'A': {
+                double radius = settings.size / 40;
+                fprintf(out, " %.3f %.3f %.1f %d %d", uniform(0.5, 1.5) * radius, uniform(0.5, 1.5) * radius, uniform(0, 180),
+                        static_cast<int>(random() % 2), static_cast<int>(random() % 2));
+                writePoint(relative, toX, toY);
+                break;
+            }
+        }
+        x = toX;
+        y = toY;
+        previous = command;
+    }
+
+    void writePath(size_t segments) {
+        fprintf(out, "<path fill=\"none\" stroke=\"black\"");
+        if(chance(settings.transforms)) writeTransform();
+        x = uniform(0, settings.size);
+        y = uniform(0, settings.size);
+        previous = 'M';
+        fprintf(out, " d=\"M %.3f %.3f", x, y);
+        for(size_t i = 0 ; i < segments ; i++) {
+            fputc(' ', out);
+            writeSegment();
+        }
+        fprintf(out, "\"/>\n");
+    }
+
+    void openGroups() {
+        for(int i = 0 ; i < settings.depth ; i++) {
+            fprintf(out, "<g");
+            if(chance(settings.transforms)) writeTransform();
+            fprintf(out, ">\n");
+        }
+    }
+
+    void closeGroups() {
+        for(int i = 0 ; i < settings.depth ; i++) fprintf(out, "</g>\n");
+    }
+
+public:
+    Generator(const Settings &settings, const vector<pair<char, double>> &weights, FILE *out)
+        : settings(settings), weights(weights), random(settings.seed), out(out) {};
+
+    void write() {
+        fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+        fprintf(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%gmm\" height=\"%gmm\" viewBox=\"0 0 %g %g\">\n",
+                settings.size, settings.size, settings.size, settings.size);
+        size_t written = 0, paths = 0;
+        while(written < settings.segments) {
+            if(paths % settings.groupPaths == 0) {
+                if(paths > 0) closeGroups();
+                openGroups();
+            }
+            size_t segments = min(settings.pathSegments, settings.segments - written);
+            writePath(segments);
+            written += segments;
+            paths++;
+        }
+        if(paths > 0) closeGroups();
+        fprintf(out, "</svg>\n");
+    }
+};
+
+int main(int argc, char **argv) {
+    Settings settings;
+    vector<pair<char, double>> weights;
+    if(!parseArguments(argc, argv, settings) || !parseMix(settings.mix, weights)) {
+        printUsage(argv[0]);
+        return argc > 1 && (string(argv[1]) == "-h" || string(argv[1]) == "--help") ? 0 : 1;
+    }
+    FILE *out = settings.output.empty() ? stdout : fopen(settings.output.c_str(), "w");
+    if(!out) {
+        fprintf(stderr, "Unable to open %s\n", settings.output.c_str());
+        return 1;
+    }
+    static char buffer[1 << 20];
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+    Generator generator(settings, weights, out);
+    generator.write();
+    if(fflush(out) != 0 || (out != stdout && fclose(out) != 0)) {
+        fprintf(stderr, "Writing %s failed\n", settings.output.empty() ? "output" : settings.output.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,404 @@
+//Virtual GRBL or Marlin controller on a pseudo terminal, for benchmarking streaming without a machine.
+//Bytes are read at the pace of the baud rate into a receive buffer of the configured size. Lines are parsed one at a
+//time, taking the configured time each, and moves are queued in a planner, which runs them at their feed rate.
+//A line is acknowledged with "ok" once its moves are queued, like the firmware does. The report counts moves per
+//second and planner starvation: times the machine stopped because the next move hadn't arrived yet.
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "meatpack.h"
+
+using namespace std;
+
+typedef chrono::steady_clock timer;
+
+enum Protocol {grbl, marlin};
+
+struct Settings {
+    Protocol protocol = grbl;
+    int baudRate = 115200; //Received bytes are paced at a tenth of it, for start and stop bits
+    size_t bufferSize = 128; //Receive buffer, bytes. Data arriving while it is full is lost.
+    size_t queue = 4; //Commands Marlin reads ahead of parsing
+    size_t planner = 16; //Moves queued for motion
+    double parseTime = 0; //Seconds per line
+    double bootTime = 0.2; //Seconds from opening the port to the greeting
+    double feed = 1000; //mm/min while neither F nor M203 is set
+    double rapid = 6000; //mm/min of G0
+    double arcSegment = 1; //mm, arcs are split into moves of this length
+    double speedup = 1; //Moves run this many times faster, to benchmark long jobs quickly
+    string link; //Symbolic link to the terminal
+    bool keep = false; //Serve sessions until killed
+};
+
+struct Report {
+    size_t bytes = 0; //Received
+    size_t lines = 0;
+    size_t moves = 0; //Planner blocks run
+    size_t overflows = 0; //Bytes lost to a full receive buffer
+    size_t starvations = 0;
+    double starvedTime = 0; //Seconds
+    timer::time_point connected, firstMove, lastMove;
+};
+
+//Machine state between lines
+struct Machine {
+    double x = 0, y = 0;
+    bool relative = false;
+    int motion = 0;
+    double feed = 0; //mm/min, 0 until F is set
+    double speedLimit = 0; //mm/min, set by M203
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int) {
+    interrupted = 1;
+}
+
+static double seconds(timer::duration duration) {
+    return chrono::duration<double>(duration).count();
+}
+
+static void printUsage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("Creates a pseudo terminal emulating a controller, prints its path and reports each session.\n");
+    printf("Options:\n");
+    printf("  --protocol NAME      grbl or marlin, defaults to grbl\n");
+    printf("  --baud RATE          Pace of received bytes, defaults to 115200\n");
+    printf("  --buffer BYTES       Receive buffer, defaults to 128\n");
+    printf("  --queue LINES        Commands Marlin reads ahead, defaults to 4\n");
+    printf("  --planner MOVES      Planner depth, defaults to 16\n");
+    printf("  --parse MICROSECONDS Time to parse a line, defaults to 0\n");
+    printf("  --boot MILLISECONDS  Time from opening the port to the greeting, defaults to 200\n");
+    printf("  --feed MM_PER_MIN    Feed rate until F or M203 is set, defaults to 1000\n");
+    printf("  --rapid MM_PER_MIN   Speed of G0, defaults to 6000\n");
+    printf("  --arc-segment MM     Length of moves arcs are split into, defaults to 1\n");
+    printf("  --speedup FACTOR     Runs moves this many times faster than their feed rate\n");
+    printf("  --link PATH          Symbolic link to the terminal, for a stable device name\n");
+    printf("  --keep               Serve sessions until interrupted\n");
+    printf("  -h, --help           Show this message\n");
+}
+
+static bool parseArguments(int argc, char **argv, Settings &settings) {
+    for(int i = 1 ; i < argc ; i++) {
+        string arg = argv[i];
+        bool value = i + 1 < argc;
+        if(arg == "--protocol" && value) {
+            string name = argv[++i];
+            if(name != "grbl" && name != "marlin") return false;
+            settings.protocol = name == "grbl" ? grbl : marlin;
+        } else if(arg == "--baud" && value) {
+            settings.baudRate = atoi(argv[++i]);
+        } else if(arg == "--buffer" && value) {
+            settings.bufferSize = strtoul(argv[++i], nullptr, 10);
+        } else if(arg == "--queue" && value) {
+            settings.queue = strtoul(argv[++i], nullptr, 10);
+        } else if(arg == "--planner" && value) {
+            settings.planner = strtoul(argv[++i], nullptr, 10);
+        } else if(arg == "--parse" && value) {
+            settings.parseTime = atof(argv[++i]) / 1e6;
+        } else if(arg == "--boot" && value) {
+            settings.bootTime = atof(argv[++i]) / 1e3;
+        } else if(arg == "--feed" && value) {
+            settings.feed = atof(argv[++i]);
+        } else if(arg == "--rapid" && value) {
+            settings.rapid = atof(argv[++i]);
+        } else if(arg == "--arc-segment" && value) {
+            settings.arcSegment = atof(argv[++i]);
+        } else if(arg == "--speedup" && value) {
+            settings.speedup = atof(argv[++i]);
+        } else if(arg == "--link" && value) {
+            settings.link = argv[++i];
+        } else if(arg == "--keep") {
+            settings.keep = true;
+        } else {
+            return false;
+        }
+    }
+    return settings.baudRate > 0 && settings.bufferSize > 0 && settings.queue > 0 && settings.planner > 0 &&
+        settings.feed > 0 && settings.rapid > 0 && settings.arcSegment > 0 && settings.speedup > 0;
+}
+
+//Durations of the planner blocks of a line, in seconds. Moves run at their feed rate, limited by M203.
+static void parseLine(const string &line, Machine &machine, const Settings &settings, vector<double> &blocks) {
+    int g = -1, m = -1;
+    double x = 0, y = 0, i = 0, j = 0;
+    bool hasX = false, hasY = false, hasArc = false;
+    const char *c = line.c_str();
+    while(*c) {
+        char letter = toupper(*c++);
+        if(letter < 'A' || letter > 'Z') continue;
+        char *end;
+        double value = strtod(c, &end);
+        if(end == c) continue;
+        c = end;
+        switch(letter) {
+            case 'G': g = static_cast<int>(value); break;
+            case 'M': m = static_cast<int>(value); break;
+            case 'X': x = value; hasX = true; break;
+            case 'Y': y = value; hasY = true; break;
+            case 'I': i = value; hasArc = true; break;
+            case 'J': j = value; hasArc = true; break;
+            case 'F': if(value > 0) machine.feed = value; break;
+        }
+    }
+
+    if(m == 203 && hasX) { //mm/s
+        machine.speedLimit = x * 60;
+        return;
+    } else if(g == 90 || g == 91) {
+        machine.relative = g == 91;
+        return;
+    } else if(g == 28) {
+        machine.x = machine.y = 0;
+        return;
+    } else if(g >= 0 && g <= 3) {
+        machine.motion = g;
+    } else if(g >= 0 || m >= 0) { //Other commands, coordinates aren't a move
+        return;
+    }
+    x = hasX ? (machine.relative ? machine.x + x : x) : machine.x;
+    y = hasY ? (machine.relative ? machine.y + y : y) : machine.y;
+    bool arc = machine.motion >= 2 && hasArc;
+    if(x == machine.x && y == machine.y && !arc) return;
+
+    double speed = machine.motion == 0 ? settings.rapid : machine.feed;
+    if(machine.speedLimit > 0) speed = speed > 0 ? min(speed, machine.speedLimit) : machine.speedLimit;
+    else if(speed == 0) speed = settings.feed;
+    speed *= settings.speedup / 60;
+    if(arc) { //Split into segments like the firmware
+        double cx = machine.x + i, cy = machine.y + j;
+        double radius = hypot(i, j);
+        double sweep = atan2(y - cy, x - cx) - atan2(machine.y - cy, machine.x - cx);
+        if(machine.motion == 2 && sweep >= 0) sweep -= 2 * M_PI;
+        if(machine.motion == 3 && sweep <= 0) sweep += 2 * M_PI;
+        double length = fabs(sweep) * radius;
+        size_t segments = max<size_t>(1, static_cast<size_t>(ceil(length / settings.arcSegment)));
+        for(size_t s = 0 ; s < segments ; s++) blocks.push_back(length / segments / speed);
+    } else {
+        blocks.push_back(hypot(x - machine.x, y - machine.y) / speed);
+    }
+    machine.x = x;
+    machine.y = y;
+}
+
+static void printReport(const Report &report, const Settings &settings) {
+    double elapsed = seconds(timer::now() - report.connected);
+    double running = report.moves > 0 ? seconds(report.lastMove - report.firstMove) : 0;
+    printf("Received %zu lines, %.1f kB in %.2f s, %.2f kB/s of %.2f kB/s the link carries\n",
+        report.lines, report.bytes / 1000.0, elapsed, elapsed > 0 ? report.bytes / elapsed / 1000 : 0, settings.baudRate / 10000.0);
+    printf("Ran %zu moves in %.2f s, %.0f moves/s\n", report.moves, running, running > 0 ? report.moves / running : 0);
+    printf("Planner starved %zu times for %.2f s, %zu bytes lost to a full receive buffer\n",
+        report.starvations, report.starvedTime, report.overflows);
+    fflush(stdout);
+}
+
+static bool connected(int master) {
+    pollfd descriptor = {master, POLLIN, 0};
+    poll(&descriptor, 1, 0);
+    return !(descriptor.revents & POLLHUP);
+}
+
+static void writeText(int master, const char *text) {
+    size_t length = strlen(text);
+    while(length > 0) {
+        ssize_t written = write(master, text, length);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        text += written;
+        length -= written;
+    }
+}
+
+//Runs one session, from opening the port to closing it
+static void serve(int master, const Settings &settings) {
+    Report report;
+    report.connected = timer::now();
+    this_thread::sleep_for(chrono::duration<double>(settings.bootTime));
+    tcflush(master, TCIFLUSH); //Boards drop what arrives while booting
+    writeText(master, settings.protocol == grbl ? "Grbl 1.1h ['$' for help]\r\n" : "start\n");
+
+    const double bytesPerSecond = settings.baudRate / 10.0;
+    timer::time_point start = timer::now(), last = start, parsedAt = start, starvedSince;
+    bool starving = false;
+    deque<char> received; //Receive buffer
+    deque<string> commands; //Marlin command queue
+    string text; //Line being read
+    meatpack::Decoder decoder;
+    string decoded;
+    deque<double> planner; //Remaining seconds of every block
+    Machine machine;
+    vector<double> blocks; //Blocks of the line being parsed, not queued yet
+    size_t queuedBlocks = 0;
+    bool parsing = false;
+    bool open = true;
+
+    while(!interrupted && (open || parsing || !planner.empty() || !received.empty() || !commands.empty())) {
+        timer::time_point now = timer::now();
+
+        //Motion
+        double dt = seconds(now - last);
+        last = now;
+        while(dt > 0 && !planner.empty()) {
+            double step = min(dt, planner.front());
+            planner.front() -= step;
+            dt -= step;
+            if(planner.front() <= 0) {
+                planner.pop_front();
+                report.moves++;
+                report.lastMove = now - chrono::duration_cast<timer::duration>(chrono::duration<double>(dt));
+                if(planner.empty() && open) {
+                    starving = true;
+                    starvedSince = report.lastMove;
+                }
+            }
+        }
+
+        //Receiving at the pace of the link
+        if(open) {
+            //Time the link was idle isn't saved up: the budget is limited to one receive buffer, so a sender that
+            //stalled can't be read in a burst faster than the baud rate
+            double budget = seconds(now - start) * bytesPerSecond - report.bytes;
+            double limit = static_cast<double>(settings.bufferSize);
+            if(budget > limit) {
+                start += chrono::duration_cast<timer::duration>(chrono::duration<double>((budget - limit) / bytesPerSecond));
+                budget = limit;
+            }
+            size_t allowed = budget > 0 ? static_cast<size_t>(budget) : 0;
+            pollfd descriptor = {master, POLLIN, 0};
+            poll(&descriptor, 1, allowed > 0 ? 1 : 0);
+            if(descriptor.revents & POLLIN && allowed > 0) {
+                char data[4096];
+                ssize_t length = read(master, data, min(allowed, sizeof(data)));
+                for(ssize_t i = 0 ; i < length ; i++) {
+                    if(received.size() < settings.bufferSize) received.push_back(data[i]);
+                    else report.overflows++;
+                }
+                if(length > 0) report.bytes += length;
+            } else if(descriptor.revents & POLLHUP) {
+                open = false;
+            }
+            if(allowed == 0) this_thread::sleep_for(chrono::microseconds(200));
+        } else if(!planner.empty() && !parsing) {
+            this_thread::sleep_for(chrono::duration<double>(min(planner.front(), 0.01)));
+        }
+
+        //Reading lines, through MeatPack on Marlin. Marlin moves them to its command queue, GRBL parses straight from the buffer.
+        while(!received.empty() && (settings.protocol == grbl ? !parsing : commands.size() < settings.queue)) {
+            char c = received.front();
+            received.pop_front();
+            if(settings.protocol == marlin) {
+                decoded.clear();
+                decoder.decode(&c, 1, decoded);
+            } else {
+                decoded.assign(1, c);
+            }
+            bool complete = false;
+            for(char d : decoded) {
+                if(d == '\n') complete = true;
+                else if(d != '\r') text.push_back(d);
+            }
+            if(!complete) continue;
+            report.lines++;
+            string line = text.substr(0, text.find(';'));
+            text.clear();
+            bool empty = line.find_first_not_of(" \t") == string::npos;
+            if(settings.protocol == marlin) {
+                if(!empty) commands.push_back(line); //Empty lines and comments aren't acknowledged
+                continue;
+            }
+            parseLine(line, machine, settings, blocks);
+            parsing = true;
+            parsedAt = now + chrono::duration_cast<timer::duration>(chrono::duration<double>(settings.parseTime));
+        }
+        if(settings.protocol == marlin && !parsing && !commands.empty()) {
+            parseLine(commands.front(), machine, settings, blocks);
+            commands.pop_front();
+            parsing = true;
+            parsedAt = now + chrono::duration_cast<timer::duration>(chrono::duration<double>(settings.parseTime));
+        }
+
+        //Queueing moves, the line is acknowledged when all of them are in the planner
+        if(parsing && now >= parsedAt) {
+            while(queuedBlocks < blocks.size() && planner.size() < settings.planner) {
+                if(starving) {
+                    report.starvations++;
+                    report.starvedTime += seconds(now - starvedSince);
+                    starving = false;
+                }
+                if(report.moves == 0 && planner.empty()) report.firstMove = now;
+                planner.push_back(blocks[queuedBlocks++]);
+            }
+            if(queuedBlocks == blocks.size()) {
+                blocks.clear();
+                queuedBlocks = 0;
+                parsing = false;
+                if(open) writeText(master, settings.protocol == grbl ? "ok\r\n" : "ok\n");
+            }
+        }
+    }
+    printReport(report, settings);
+}
+
+int main(int argc, char **argv) {
+    Settings settings;
+    if(!parseArguments(argc, argv, settings)) {
+        printUsage(argv[0]);
+        return argc > 1 && (string(argv[1]) == "-h" || string(argv[1]) == "--help") ? 0 : 1;
+    }
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        fprintf(stderr, "Unable to create a pseudo terminal: %s\n", strerror(errno));
+        return 1;
+    }
+    string path = ptsname(master);
+    //Raw mode, so line breaks and bytes of MeatPack pass unchanged
+    int slave = open(path.c_str(), O_RDWR | O_NOCTTY);
+    termios options;
+    if(slave < 0 || tcgetattr(slave, &options) != 0) {
+        fprintf(stderr, "Unable to configure %s\n", path.c_str());
+        return 1;
+    }
+    cfmakeraw(&options);
+    tcsetattr(slave, TCSANOW, &options);
+    close(slave); //Hang up until a sender opens the terminal
+    if(!settings.link.empty()) {
+        unlink(settings.link.c_str());
+        if(symlink(path.c_str(), settings.link.c_str()) != 0) {
+            fprintf(stderr, "Unable to link %s: %s\n", settings.link.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+    printf("%s\n", path.c_str());
+    fflush(stdout);
+
+    do {
+        while(!interrupted && !connected(master)) this_thread::sleep_for(chrono::milliseconds(10));
+        if(interrupted) break;
+        serve(master, settings);
+    } while(settings.keep && !interrupted);
+
+    if(!settings.link.empty()) unlink(settings.link.c_str());
+    close(master);
+    return 0;
+}